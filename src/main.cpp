@@ -28,20 +28,130 @@
 #include <Preferences.h>
 #include <SPIFFS.h>
 #include <FS.h>
+#include <esp_idf_version.h>
 
 // ==================== CONFIGURATION ====================
-#define MAX_BLOCKS 50           // Increased for SPIFFS storage
-#define MAX_PEERS 10            // Maximum peer nodes
+#ifndef MAX_BLOCKS
+#define MAX_BLOCKS 16           // Newest blocks held in RAM and the chain file (~860 B each)
+#endif
 #define BLOCK_TIME_MS 30000     // 30 seconds per block
-#define MAX_TX_PER_BLOCK 4      // Transactions per block
-#define TX_POOL_SIZE 20         // Transaction pool size
+#define MAX_TX_PER_BLOCK 24     // Hard cap on tx hashes per block
+#define MAX_BLOCK_BYTES 864     // Encoded block size budget (header + 32B per tx)
+#define MIN_BLOCK_BYTES 222     // Smallest budget used when the pool is shallow
+#define TX_POOL_SIZE 48         // Transaction pool size
+#define VALIDATOR_SET_MAX 8     // Validators in the round-robin schedule
+#define VALIDATOR_EPOCH_BLOCKS 10    // The set is rebuilt only when height crosses an epoch
+#define VALIDATOR_CANDIDATES 16 // Validators tracked from heartbeats
+#define VALIDATOR_EXPIRY_MS 35000    // Left out of the next epoch after this long unheard
+#define HEARTBEAT_INTERVAL_MS 10000  // Validators flood a heartbeat this often
+#define SLOT_TIMEOUT_MS 10000   // A late block's turn passes to the next validator after this
 #define PEER_ANNOUNCE_INTERVAL 60000  // Announce every 60s
+#define PEER_TABLE_SLOTS 32     // Known-peer hash table slots (power of two)
+#define PEER_TABLE_MAX 24       // Peers kept before the least recently seen is evicted
+#define PEER_EXPIRY_MS 180000   // Forget peers silent for three announce intervals
+#define PEER_MAINTENANCE_MS 5000     // Expiry sweep interval
+#define RX_FRAME_RATE 100       // Frames/s one peer may send us (token bucket)...
+#define RX_FRAME_BURST 100      // ...and how many may arrive at once
+#define RX_TX_RATE 2            // Telemetry txs/s one peer may hand us
+#define RX_TX_BURST 10
+#define POOL_SENSOR_SHARE 12    // Pool slots one sensor's txs may hold
+#define BAN_SCORE 100           // Misbehavior points before a peer is ignored...
+#define BAN_MS 60000            // ...for this long
+#define ESPNOW_PEER_LIMIT 16    // Unicast peers registered with the radio (max 20, minus broadcast)
 #define SAVE_INTERVAL 60000     // Save to SPIFFS every 60s
+#define SEEN_TX_BLOCKS 8        // Recent blocks covered by duplicate check
+#define SEEN_TX_SLOTS 512       // Seen-tx hash set slots (power of two)
+#define MAX_TRACKED_SENSORS 16  // Per-sensor inclusion latency slots
+#define SENSOR_INTERVAL_MS 10000     // One reading every 10s
+#define TX_BATCH_MAX 5          // Readings one transaction can carry (fits a packet)
+#define TX_BATCH_SIZE 5         // Seal a batch after this many readings...
+#define TX_BATCH_WINDOW_MS (TX_BATCH_SIZE * SENSOR_INTERVAL_MS)  // ...or once its first reading is this old (a late reading's slack)
+#define MAX_SENSOR_IDS 32       // Interned sensorId registry size
+#ifndef TX_LOG_SLOTS
+#define TX_LOG_SLOTS 2048       // Committed transactions kept in /txlog.dat (ring)
+#endif
+#define MAX_INDEXED_SENSORS 16  // Sensors with a per-sensor time index
+#define SENSOR_INDEX_DEPTH 128  // Most recent readings indexed per sensor
+#define ZONE_SEGMENT_RECORDS 32 // Tx log records per segment zone map
+#define ROLLUP_SENSORS 8        // Sensors with pre-aggregated rollups
+#define ROLLUP_MINUTES 60       // 1-minute buckets kept per sensor
+#define ROLLUP_HOURS 24         // 1-hour buckets kept per sensor
+#define ROLLUP_DAYS 14          // 1-day buckets kept per sensor
+#define STATS_EWMA_ALPHA 0.2f   // Weight of the newest reading in the EWMA
+#define ALARM_ZSCORE 4.0f       // |z| above this raises an outlier alarm
+#define ALARM_MIN_SAMPLES 10    // Readings before z-score alarms arm
+#define ALARM_STUCK_READINGS 12 // Identical consecutive readings flagged as stuck
+#define ALARM_HOLDOFF_S 300     // Minimum gap between repeats of one alarm
+#define STATS_REPORT_MS 60000   // Sensing nodes flood their own sensor's stats this often
+#define QUANTILE_SENSORS 8      // Sensors with quantile sketches
+#define DIGEST_CENTROIDS 24     // Centroids kept per quantile sketch
+#define DIGEST_BUFFER 16        // Readings buffered before a sketch is compressed
+#define ESPNOW_MAX_FRAME 250    // ESP-NOW payload limit
+#define COALESCE_WINDOW_MS 50   // Hold broadcasts this long to share a frame (0 = off)
+#define CMD_LINE_MAX 96         // Longest serial command line
+#define STREAM_CHUNK 16         // Readings gathered per streaming pass
+#define STREAM_MIN_WRITE 96     // Free UART TX bytes needed to emit a record
+#define FRAME_START 0xA5        // Binary frame marker
+#define QUERY_PAGE_READINGS 13  // Readings per remote query page (fits NetworkPacket.data)
+#define QUERY_WINDOW 4          // Pages a responder may send per request
+#define QUERY_PAGE_GAP_MS 20    // Pacing between pages
+#define QUERY_TIMEOUT_MS 2000   // Re-request after this long without a page
+#define QUERY_RETRIES 3
+#define SYNC_OVERLAP 4          // Newest blocks re-checked against a peer's chain for a fork
+#define SYNC_HEADERS_PER_FRAME 5     // Block hashes per headers frame
+#define SYNC_CHUNK 184          // Encoded block bytes per body frame
+#define SYNC_WINDOW 8           // Blocks in flight before an acknowledgement
+#define SYNC_FRAMES_PER_PASS 8  // Frames a chain server sends per loop pass
+#define SYNC_TIMEOUT_MS 600     // Retransmit after this long without progress
+#define SYNC_RETRIES 5
+#define SHORT_ID_BYTES 4        // Tx hash prefix naming a tx in a compact block
+#define BLOCK_TXN_TIMEOUT_MS 1000    // Re-request missing block txs after this long
+#define BLOCK_TXN_RETRIES 2     // ...then fall back to chain sync
+#define GOSSIP_TTL 6            // Hops a flooded message may travel
+#define GOSSIP_SEEN_SLOTS 64    // Recent message IDs remembered to drop duplicates
+#define GOSSIP_JITTER_MS 300    // Relays wait a random 0..this before re-broadcasting
+#define GOSSIP_QUEUE 16         // Relays waiting out their jitter
+#define GOSSIP_SUPPRESS 2       // Cancel a pending relay after this many copies heard (0 = off)
+#define INV_MAX_IDS 40          // Short tx IDs per inventory frame
+#define INV_BATCH_MS 500        // Gather newly accepted txs this long before announcing
+#define INV_SUPPRESS 2          // Drop a relayed ID from our inventory once this many neighbors announce it
+#ifndef INV_PUSH_MAX
+#define INV_PUSH_MAX 2          // Push the full tx instead when at most this many neighbors may lack it
+#endif
+#define INV_REQUEST_JITTER_MS 200    // Random wait before pulling, so one neighbor's request covers others
+#define INV_SERVE_SLOTS 24      // Requested txs waiting to be sent
+#define INV_SERVE_HOLD_MS 500   // Requests for a tx we just broadcast are answered by that copy
+#define INV_REQUESTS 48         // Outstanding tx requests tracked
+#define INV_REQUEST_TIMEOUT_MS 1500  // Ask again if a requested tx hasn't arrived
+#define INV_REQUEST_RETRIES 2
+#define TX_QUEUE_DEPTH 16       // Outbound frames waiting for the radio
+#define RX_QUEUE_DEPTH 16       // Received frames waiting for loop()
+#define TX_QUEUE_RESERVE 4      // Slots bulk senders (sync, queries) leave free
+#define TX_WINDOW 2             // Frames handed to ESP-NOW before a send completion
+#define TX_RETRIES 3            // Resends of a unicast frame the peer didn't acknowledge
+#define TX_BACKOFF_MS 20        // Hold on a failing peer, doubled per consecutive failure
+#define TX_BACKOFF_MAX_MS 640
+#define TX_COMPLETION_TIMEOUT_MS 250 // Treat a send with no completion as failed
+
+// Link layer. Native (Linux) builds pick RADIO_SIM or RADIO_UDP with -DRADIO_BACKEND=
+#define RADIO_ESPNOW 0
+#define RADIO_SIM 1             // In-process simulated air, see sim_air.h
+#define RADIO_UDP 2             // UDP multicast: each process is a node
+#ifndef RADIO_BACKEND
+#define RADIO_BACKEND RADIO_ESPNOW
+#endif
+#define UDP_RADIO_GROUP "239.255.42.1"
+#define UDP_RADIO_PORT 4242
 
 // Storage paths
 #define BLOCKCHAIN_FILE "/blockchain.dat"
 #define TXPOOL_FILE "/txpool.dat"
 #define METADATA_FILE "/metadata.dat"
+#define SENSORS_FILE "/sensors.dat"
+#define TXLOG_FILE "/txlog.dat"
+#define ZONES_FILE "/zones.dat"
+#define ROLLUPS_FILE "/rollups.dat"
+#define QUANTILES_FILE "/quantiles.dat"
 
 // Node role
 enum NodeRole {
@@ -61,6 +171,24 @@ enum RoleStrategy {
 RoleStrategy ROLE_STRATEGY = STRATEGY_MAC_BASED;
 NodeRole MY_ROLE = SENSOR_NODE;
 
+// What to drop when a reading arrives and the pool is full
+enum TxEvictPolicy {
+    EVICT_OLDEST,          // Drop the oldest pending reading
+    EVICT_LOWEST_QUALITY,  // Drop the pending batch whose worst reading scores lowest
+    EVICT_REJECT_NEW       // Keep the pool, reject the incoming reading
+};
+
+TxEvictPolicy TX_EVICT_POLICY = EVICT_OLDEST;
+
+// Which pending readings createBlock() picks first
+enum TxSelectPolicy {
+    SELECT_OLDEST,         // Arrival order (FIFO)
+    SELECT_QUALITY,        // Best worst-reading dataQuality first, oldest on ties
+    SELECT_ROUND_ROBIN     // One reading per sensorId in turn, oldest first
+};
+
+TxSelectPolicy TX_SELECT_POLICY = SELECT_ROUND_ROBIN;
+
 // ==================== DATA STRUCTURES ====================
 
 typedef uint8_t Hash32[32];
@@ -76,11 +204,34 @@ struct TelemetryData {
     uint8_t dataQuality;
 } __attribute__((packed));
 
+// Fixed-point reading as stored and sent (14 bytes vs 35 for TelemetryData)
+struct CompactReading {
+    int16_t temperature;        // 0.01 °C
+    uint16_t humidity;          // 0.1 %
+    uint16_t pressure;          // 0.1 hPa
+    uint16_t batteryVoltage;    // mV
+    uint32_t timestamp;
+    int8_t rssi;
+    uint8_t dataQuality;
+} __attribute__((packed));
+
+// One or more readings from a sensor under a single hash and signature
 struct Transaction {
     Hash32 txHash;
-    TelemetryData data;
     uint8_t signature[32];
-    uint8_t verified;
+    uint16_t sensor;                            // Interned sensorId handle
+    uint16_t sensorTag;                         // sensorTagOf(sensorId): tells apart sensorIds sharing a handle
+    uint8_t readingCount;                       // 1 = single reading
+    CompactReading readings[TX_BATCH_MAX];      // Oldest first
+} __attribute__((packed));
+
+// Bytes of a transaction that carry data (unused batch slots trimmed)
+#define TX_WIRE_SIZE(count) (sizeof(Transaction) - (TX_BATCH_MAX - (count)) * sizeof(CompactReading))
+
+// Gossiped with peer announcements so others can name our handle
+struct SensorIdEntry {
+    uint16_t handle;
+    char sensorId[16];
 } __attribute__((packed));
 
 struct Block {
@@ -94,13 +245,48 @@ struct Block {
     uint32_t nonce;
 } __attribute__((packed));
 
-struct BlockHeader {
+// Encoded size of the fixed block fields (everything except txHashes)
+#define BLOCK_HEADER_BYTES (sizeof(Block) - sizeof(Hash32) * MAX_TX_PER_BLOCK)
+
+// Block announcement: the block's fixed fields and a short ID per transaction.
+// Receivers rebuild txHashes from their own pool and fetch only what they lack.
+struct CompactBlock {
     uint32_t index;
     uint32_t timestamp;
     uint8_t txCount;
-    Hash32 blockHash;
     Hash32 previousHash;
+    Hash32 blockHash;
     char validator[17];
+    uint32_t nonce;
+    uint8_t shortIds[MAX_TX_PER_BLOCK][SHORT_ID_BYTES];
+} __attribute__((packed));
+
+// Transactions of a compact block the receiver could not find in its pool
+struct BlockTxnRequest {
+    uint32_t height;
+    uint8_t blockId[SHORT_ID_BYTES];    // Block hash prefix
+    uint32_t missing;                   // Bit per tx position
+} __attribute__((packed));
+
+struct BlockTxn {
+    uint32_t height;
+    uint8_t position;
+    Transaction tx;             // Trimmed to TX_WIRE_SIZE on air
+} __attribute__((packed));
+
+// Inventory (MSG_INV): our height, then short IDs of txs we accepted since the last one
+struct InvAnnounce {
+    uint32_t height;
+    uint8_t count;
+    uint8_t ids[INV_MAX_IDS][SHORT_ID_BYTES];
+} __attribute__((packed));
+
+// Tx pull (MSG_GET_TX, broadcast): IDs we lack from the target's inventory.
+// The target answers with MSG_NEW_TELEMETRY broadcasts.
+struct TxRequest {
+    uint8_t target[6];
+    uint8_t count;
+    uint8_t ids[INV_MAX_IDS][SHORT_ID_BYTES];
 } __attribute__((packed));
 
 // Metadata structure for storage
@@ -109,6 +295,7 @@ struct ChainMetadata {
     uint32_t totalBlocks;
     uint32_t lastSaveTime;
     char lastValidator[17];
+    uint32_t chainBase;         // Added later; older files end before it
 } __attribute__((packed));
 
 enum MessageType {
@@ -117,16 +304,313 @@ enum MessageType {
     MSG_REQUEST_CHAIN,
     MSG_CHAIN_DATA,
     MSG_PEER_ANNOUNCE,
-    MSG_VALIDATOR_HEARTBEAT
+    MSG_VALIDATOR_HEARTBEAT,
+    MSG_QUERY_REQUEST,
+    MSG_QUERY_PAGE,
+    MSG_SENSOR_ALARM,
+    MSG_BUNDLE,                 // Several messages sharing one frame
+    MSG_GET_BLOCK_TXN,
+    MSG_BLOCK_TXN,
+    MSG_INV,
+    MSG_GET_TX,
+    MSG_GET_SKETCH,
+    MSG_SKETCH,
+    MSG_SENSOR_STATS,
+    MSG_TYPES                   // Count, not sent
 };
 
+// Decoded message. On air it is framed by encodePacket(): 1-byte type, varint
+// length, 6-byte sender MAC, then the payload. A MSG_BUNDLE frame's payload is a
+// run of records, each a type, varint length and payload. Flooded types (see
+// isGossipType()) start their payload with a 4-byte message ID and a TTL byte.
 struct NetworkPacket {
     MessageType type;
     uint8_t data[200];
     uint16_t dataLen;
     char sender[17];
+    uint32_t gossipId;          // Flooded types only
+    uint8_t ttl;
+} __attribute__((packed));
+
+#define GOSSIP_HEADER 5         // gossipId + ttl
+
+#define WIRE_HEADER_MAX 9       // type + 2-byte varint + MAC
+
+// Received message, read in place from the radio buffer: nothing is copied until
+// a handler keeps something. Only valid until the receive callback returns.
+struct PacketView {
+    MessageType type;
+    const uint8_t* data;
+    uint16_t dataLen;
+    const uint8_t* senderMac;
+    uint32_t gossipId;          // Flooded types only
+    uint8_t ttl;
+};
+
+// Typed access to a received payload; NULL unless `need` bytes arrived. Wire
+// structs are packed, so any byte offset is a valid address for them.
+template<typename T>
+inline const T* viewAs(const PacketView* packet, size_t need = sizeof(T)) {
+    return (packet->dataLen >= need) ? (const T*)packet->data : NULL;
+}
+
+// Remote history query: the requester asks for readings from cursor on and grants
+// a window of pages; each new request acknowledges the pages before it
+struct QueryRequest {
+    uint16_t queryId;
+    uint8_t seq;                // Bumped per request so stale pages are ignored
+    uint8_t window;             // Pages the responder may send
+    char sensorId[16];
+    uint32_t startTime;
+    uint32_t endTime;
+    uint32_t cursor;
+    uint16_t cursorSkip;        // Readings at 'cursor' already received
+} __attribute__((packed));
+
+enum QueryPageFlags {
+    QUERY_LAST = 0x01,          // No readings after this page
+    QUERY_WINDOW_END = 0x02,    // Window used up; send the next request
+    QUERY_BUSY = 0x04           // Serving someone else, retry later
+};
+
+struct QueryPage {
+    uint16_t queryId;
+    uint8_t seq;
+    uint8_t page;
+    uint8_t count;
+    uint8_t flags;
+    uint32_t nextCursor;
+    uint16_t nextSkip;
+    CompactReading readings[QUERY_PAGE_READINGS];
+} __attribute__((packed));
+
+// Quantile sketch exchange: MSG_GET_SKETCH (broadcast) names a sensor, and each
+// neighbor tracking it answers with one MSG_SKETCH per field. Means and bounds
+// travel in the field's CompactReading units (0.01 °C, 0.1 %RH).
+struct SketchRequest {
+    char sensorId[16];
+} __attribute__((packed));
+
+struct WireCentroid {
+    int16_t mean;
+    uint32_t weight;
+} __attribute__((packed));
+
+struct SketchMessage {
+    char sensorId[16];
+    uint8_t field;              // STAT_TEMPERATURE or STAT_HUMIDITY
+    uint32_t count;
+    int16_t min;
+    int16_t max;
+    uint8_t centroidCount;
+    WireCentroid centroids[DIGEST_CENTROIDS];
+} __attribute__((packed));
+
+// Bytes of a sketch message that carry centroids
+#define SKETCH_WIRE_SIZE(count) (sizeof(SketchMessage) - (DIGEST_CENTROIDS - (count)) * sizeof(WireCentroid))
+
+// Chain sync: a lagging node fetches block hashes first, checks them against its
+// own chain for a fork, then pulls bodies SYNC_WINDOW blocks at a time. Each body
+// request acknowledges every block below its 'from'.
+enum SyncKind {
+    SYNC_HEADERS,
+    SYNC_BODIES
+};
+
+#define SYNC_RESTART 0x01       // ChainRequest.flags: (re)start the stream at 'from'
+
+struct ChainRequest {
+    uint16_t session;
+    uint8_t kind;
+    uint8_t flags;
+    uint32_t from;
+    uint16_t count;
+} __attribute__((packed));
+
+struct ChainHeaders {
+    uint16_t session;
+    uint8_t kind;               // SYNC_HEADERS
+    uint8_t count;
+    uint32_t base;              // Oldest height the sender holds
+    uint32_t tip;               // End of this headers stream
+    uint32_t from;              // Height of hashes[0]
+    Hash32 hashes[SYNC_HEADERS_PER_FRAME];
+} __attribute__((packed));
+
+struct ChainBody {
+    uint16_t session;
+    uint8_t kind;               // SYNC_BODIES
+    uint8_t part;
+    uint8_t parts;
+    uint32_t height;
+    uint8_t data[SYNC_CHUNK];   // Slice of the encoded block
+} __attribute__((packed));
+
+// Announcement payload: our sensorId, plus our chain height so laggards can sync
+struct PeerAnnounce {
+    SensorIdEntry self;
+    uint32_t height;
+    uint8_t tipId[SHORT_ID_BYTES];      // Tip block hash prefix, to spot same-height forks
+} __attribute__((packed));
+
+// Flooded by validators: who they are, and the schedule they follow this epoch
+struct ValidatorHeartbeat {
+    uint8_t validator[6];
+    uint32_t epoch;
+    uint32_t height;
+    uint8_t count;
+    uint8_t macs[VALIDATOR_SET_MAX][6];     // Validators the sender hears itself, ascending
+} __attribute__((packed));
+
+enum StatField {
+    STAT_TEMPERATURE,
+    STAT_HUMIDITY,
+    STAT_BATTERY,
+    STAT_FIELDS
+};
+
+enum AlarmKind {
+    ALARM_LOW,                  // Below the field's threshold
+    ALARM_HIGH,                 // Above the field's threshold
+    ALARM_OUTLIER,              // |z-score| above ALARM_ZSCORE
+    ALARM_STUCK,                // Same value ALARM_STUCK_READINGS times running
+    ALARM_KINDS
+};
+
+// Welford running mean/variance plus EWMA and rate of change for one field
+struct RunningStat {
+    uint32_t n;
+    float mean;
+    float m2;
+    float ewma;
+    float last;
+    float rate;                 // Change per minute between the last two readings
+    uint32_t lastTs;
+    uint16_t repeats;           // Consecutive readings equal to last
+    uint32_t alarmAt[ALARM_KINDS];  // Reading time of the last alarm raised, per kind
+};
+
+struct SensorStats {
+    uint16_t sensor;
+    uint32_t lastUpdate;
+    uint32_t alarms;
+    RunningStat field[STAT_FIELDS];
+};
+
+// Alarm payload (MSG_SENSOR_ALARM), sent by the node that took the reading
+struct SensorAlarm {
+    SensorIdEntry sensor;
+    uint8_t field;
+    uint8_t kind;
+    float value;
+    float mean;
+    float stddev;
+    uint32_t timestamp;
+} __attribute__((packed));
+
+// Running stats payload (MSG_SENSOR_STATS), flooded by the node that took the
+// readings so a bridge anywhere on the mesh can forward them upstream
+struct SensorStatsReport {
+    SensorIdEntry sensor;
+    uint32_t readings;
+    uint32_t alarms;
+    float mean[STAT_FIELDS];
+    float stddev[STAT_FIELDS];
+    float ewma[STAT_FIELDS];
+    float rate[STAT_FIELDS];    // Change per minute
+    uint32_t timestamp;         // Newest reading folded in
+} __attribute__((packed));
+
+// Quantile sketch (merging t-digest): a bounded set of weighted centroids,
+// small near the tails and large in the middle, plus unmerged recent values
+struct Centroid {
+    float mean;
+    uint32_t weight;
+} __attribute__((packed));
+
+struct QuantileSketch {
+    uint32_t count;
+    float min;
+    float max;
+    uint8_t centroidCount;
+    uint8_t bufferCount;
+    Centroid centroids[DIGEST_CENTROIDS];
+    float buffer[DIGEST_BUFFER];
+} __attribute__((packed));
+
+#define QUANTILE_FIELDS 2       // Temperature and humidity (StatField order)
+
+struct SensorQuantiles {
+    uint16_t sensor;
+    uint32_t lastUpdate;
+    QuantileSketch sketch[QUANTILE_FIELDS];
+} __attribute__((packed));
+
+// Zone maps: timestamp bounds and a sensor-handle bitmap over a run of log records
+struct ZoneMap {
+    uint32_t minTs;
+    uint32_t maxTs;
+    uint32_t sensorMask;        // Bit (handle & 31) set for every sensor present
+} __attribute__((packed));
+
+// Per-block zone (parallel to blockchain[]); recordCount 0 = no readings logged
+struct BlockZone {
+    uint32_t firstRecord;
+    uint8_t recordCount;
+    ZoneMap zone;
+} __attribute__((packed));
+
+// Rollup levels, finest first
+enum RollupLevel {
+    ROLLUP_MINUTE,
+    ROLLUP_HOUR,
+    ROLLUP_DAY,
+    ROLLUP_LEVELS
+};
+
+#define ROLLUP_BUCKETS (ROLLUP_MINUTES + ROLLUP_HOURS + ROLLUP_DAYS)
+
+// Aggregate of one field in CompactReading units
+struct RollupStat {
+    int32_t sum;
+    int16_t min;
+    int16_t max;
+    int16_t last;
 } __attribute__((packed));
 
+struct RollupBucket {
+    uint32_t start;             // First second covered
+    uint32_t lastTs;            // Timestamp of the reading held in last
+    uint16_t count;
+    RollupStat temperature;
+    RollupStat humidity;
+} __attribute__((packed));
+
+// Direct-mapped bucket rings per level; newest[] is the latest bucket number seen
+struct SensorRollup {
+    uint16_t sensor;
+    uint32_t lastUpdate;
+    uint32_t newest[ROLLUP_LEVELS];
+    RollupBucket buckets[ROLLUP_BUCKETS];
+    uint8_t dirty[(ROLLUP_BUCKETS + 7) / 8];    // Held a reading a chain rollback took back
+} __attribute__((packed));
+
+// Binary framing: FRAME_START, type, uint16 length (LE), payload, XOR of all bytes after FRAME_START
+enum FrameType {
+    FRAME_READING = 1,          // CompactReading
+    FRAME_AGGREGATE,            // RollupBucket
+    FRAME_BLOCK,                // Block
+    FRAME_END,                  // uint32_t record count
+    FRAME_ERROR                 // Text message
+};
+
+enum StreamKind {
+    STREAM_IDLE,
+    STREAM_READINGS,
+    STREAM_AGGREGATES,
+    STREAM_FILES
+};
+
 // ==================== FORWARD DECLARATIONS ====================
 
 void bin2hex(const uint8_t* bin, size_t len, char* outHex);
@@ -134,6 +618,45 @@ void calculateSHA256Binary(const uint8_t* data, size_t len, uint8_t* out32);
 void calculateTxHash(Transaction* tx);
 void calculateBlockHash(Block* block);
 void signTransaction(Transaction* tx);
+uint8_t removeCommittedTx(const Block* block, BlockZone* zone);
+void zoneAddTransaction(ZoneMap* zone, const Transaction* tx);
+void rebuildSeenTxSet();
+void rollupTransaction(const Transaction* tx);
+void rollupUnwind(const Transaction* tx);
+void printStatus();
+void broadcastPacket(NetworkPacket* packet);
+bool gossipAccept(const PacketView* packet);
+void gossipRemember(uint32_t id);
+void updateSensorStats(const Transaction* tx);
+void handleQueryRequest(const uint8_t* mac, const PacketView* packet);
+void handleQueryPage(const uint8_t* mac, const PacketView* packet);
+void startRemoteQuery(const char* sensorId, uint32_t startTime, uint32_t endTime);
+void handleSketchRequest(const uint8_t* mac, const PacketView* packet);
+void handleSketch(const uint8_t* mac, const PacketView* packet);
+void startSketchQuery(const char* sensorId);
+void rebuildTelemetryIndex();
+void handleChainRequest(const uint8_t* mac, const PacketView* packet);
+void handleChainData(const uint8_t* mac, const PacketView* packet);
+void startChainSync(const uint8_t* mac, uint32_t peerHeight);
+void buildPeerAnnounce(NetworkPacket* announce);
+void broadcastBlock(Block* block);
+void handleCompactBlock(const uint8_t* mac, const PacketView* packet);
+void handleGetBlockTxn(const uint8_t* mac, const PacketView* packet);
+void handleBlockTxn(const uint8_t* mac, const PacketView* packet);
+void requestBlockTxn();
+void sendToPeer(const uint8_t* mac, NetworkPacket* packet);
+void printPeers();
+void announceTransaction(const Transaction* tx, uint8_t holders);
+uint8_t txHolders(const Transaction* tx);
+void heardTransaction(const uint8_t* id);
+void sendInventory();
+void handleInventory(const uint8_t* mac, const PacketView* packet);
+void handleTxRequest(const uint8_t* mac, const PacketView* packet);
+void handleHeartbeat(const PacketView* packet);
+bool inValidatorSet(const char* validator);
+void onDataReceived(const uint8_t* mac, const uint8_t* data, int len, int8_t rssi);
+void handleFrame(const uint8_t* mac, const uint8_t* data, int len, int8_t rssi);
+void receiveTask();
 
 // ==================== GLOBAL STATE ====================
 
@@ -141,21 +664,520 @@ Block blockchain[MAX_BLOCKS];
 uint32_t blockCount = 0;
 uint32_t totalBlocks = 0;
 
+// Ring buffer: pending transactions in arrival order starting at txPoolHead
 Transaction txPool[TX_POOL_SIZE];
+uint8_t txPoolHead = 0;
 uint8_t txPoolCount = 0;
 
-uint8_t peerList[MAX_PEERS][6];
-uint8_t peerCount = 0;
+// Mempool counters (readings committed vs. lost)
+struct MempoolStats {
+    uint32_t accepted;
+    uint32_t committed;
+    uint32_t evicted;
+    uint32_t rejected;
+    uint32_t duplicates;
+};
+
+MempoolStats mempoolStats = {0};
+
+// Arrival sequence number of each pool slot (locates pool readings for the index)
+uint32_t txPoolSeq[TX_POOL_SIZE];
+uint32_t txPoolNextSeq = 0;
+
+// Local time (seconds) each pool slot's tx reached this node's pool
+uint32_t txPoolArrival[TX_POOL_SIZE];
+
+// Committed transactions appended to TXLOG_FILE (record number of the next one)
+uint32_t txLogCount = 0;
+
+// i-th pending transaction in arrival order
+inline Transaction* txPoolAt(uint8_t i) {
+    return &txPool[(txPoolHead + i) % TX_POOL_SIZE];
+}
+
+inline uint32_t* txPoolSeqAt(uint8_t i) {
+    return &txPoolSeq[(txPoolHead + i) % TX_POOL_SIZE];
+}
+
+inline uint32_t* txPoolArrivalAt(uint8_t i) {
+    return &txPoolArrival[(txPoolHead + i) % TX_POOL_SIZE];
+}
+
+// Where an indexed reading lives: pool (by seq) or tx log (by record), plus reading slot
+#define LOC_POOL 0x80000000u
+#define LOC_NONE 0xFFFFFFFFu
+
+inline uint32_t makeLoc(bool inPool, uint32_t id, uint8_t reading) {
+    return (inPool ? LOC_POOL : 0) | ((id & 0x0FFFFFFF) << 3) | reading;
+}
+
+// Per-sensor readings ordered by timestamp (ring, oldest dropped first)
+struct IndexEntry {
+    uint32_t timestamp;
+    uint32_t loc;
+};
+
+struct SensorIndex {
+    uint16_t sensor;
+    uint16_t head;
+    uint16_t count;
+    uint32_t lastUpdate;
+    uint32_t coveredFrom;       // Every reading at or after this time is indexed
+    IndexEntry entries[SENSOR_INDEX_DEPTH];
+};
+
+SensorIndex sensorIndex[MAX_INDEXED_SENSORS];
+uint8_t sensorIndexCount = 0;
+
+BlockZone blockZones[MAX_BLOCKS];
+ZoneMap segmentZones[TX_LOG_SLOTS / ZONE_SEGMENT_RECORDS];
+
+// Work done by the last history query
+struct QueryStats {
+    uint32_t recordsRead;
+    uint32_t blocksSkipped;
+    uint32_t segmentsSkipped;
+};
+
+QueryStats lastQueryStats = {0};
+
+// Per-sensor rollups of committed readings
+SensorRollup sensorRollups[ROLLUP_SENSORS];
+uint8_t sensorRollupCount = 0;
+uint32_t rollupLateDrops = 0;   // Readings older than every retained bucket
+
+const uint32_t ROLLUP_SECONDS[ROLLUP_LEVELS] = {60, 3600, 86400};
+const uint16_t ROLLUP_DEPTH[ROLLUP_LEVELS] = {ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS};
+const uint16_t ROLLUP_OFFSET[ROLLUP_LEVELS] = {0, ROLLUP_MINUTES, ROLLUP_MINUTES + ROLLUP_HOURS};
+
+// Streaming per-sensor statistics over every reading accepted into the pool
+SensorStats sensorStats[MAX_TRACKED_SENSORS];
+uint8_t sensorStatsCount = 0;
+
+// Per-sensor quantile sketches, checkpointed with the chain
+SensorQuantiles sensorQuantiles[QUANTILE_SENSORS];
+uint8_t sensorQuantilesCount = 0;
+
+const char* STAT_NAMES[STAT_FIELDS] = {"temperature", "humidity", "battery"};
+const char* ALARM_NAMES[ALARM_KINDS] = {"low", "high", "outlier", "stuck"};
+
+// Threshold alarms per field (°C, %, V)
+const float STAT_MIN[STAT_FIELDS] = {-20.0f, 5.0f, 3.1f};
+const float STAT_MAX[STAT_FIELDS] = {60.0f, 95.0f, 4.3f};
+
+// Serial command line and the result stream it may have started
+char cmdLine[CMD_LINE_MAX];
+uint8_t cmdLineLen = 0;
+bool cmdLineOverflow = false;
+bool binaryFraming = false;
+
+struct StreamJob {
+    StreamKind kind;
+    bool paused;                // XOFF received
+    bool lastChunk;             // Pending records are the final ones
+    char sensorId[20];
+    uint32_t cursor;            // Next timestamp (readings) or bucket start (aggregates)
+    uint16_t cursorSkip;        // Readings at 'cursor' already sent
+    uint32_t endTime;
+    uint32_t step;              // Aggregate bucket width in seconds, 0 = whole range
+    uint32_t sent;
+    uint8_t pendingCount;
+    uint8_t pendingPos;
+    TelemetryData pending[STREAM_CHUNK];
+    File dir;
+};
+
+StreamJob streamJob;
+
+struct ReadingCollector {
+    TelemetryData* buf;
+    uint8_t capacity;
+    uint8_t count;
+    uint32_t skipTs;            // The first 'skip' readings at this timestamp were sent before
+    uint16_t skip;
+};
+
+// History query we are serving to another node
+struct QueryServe {
+    bool active;
+    uint8_t mac[6];
+    QueryRequest request;
+    uint8_t page;
+    unsigned long lastSend;
+};
+
+QueryServe queryServe = {0};
+
+// History query we asked another node for
+struct RemoteQuery {
+    bool active;
+    bool locked;                // Responder chosen (first to answer)
+    bool requestDue;
+    uint8_t target[6];
+    QueryRequest request;
+    uint8_t expectPage;
+    uint8_t retries;
+    uint32_t received;
+    unsigned long lastActivity;
+};
+
+RemoteQuery remoteQuery = {0};
+uint16_t nextQueryId = 1;
+
+// Sketch request we broadcast; replies are taken until QUERY_TIMEOUT_MS passes
+struct SketchQuery {
+    bool active;
+    char sensorId[17];
+    uint8_t replies;
+    unsigned long sentAt;
+};
+
+SketchQuery sketchQuery = {0};
+
+// Heights below this were never downloaded (chain fast-forwarded from a peer)
+uint32_t chainBase = 0;
+
+// Reassembly buffer for one block body
+struct SyncSlot {
+    uint32_t height;
+    uint8_t parts;              // 0 = free
+    uint8_t received;           // Bitmask of parts in hand
+    uint16_t len;
+    uint8_t data[sizeof(Block)];
+};
+
+// Chain download in progress (one peer at a time)
+struct ChainSync {
+    bool active;
+    bool fastForward;           // Replace our chain, anchored at the first body
+    uint8_t kind;               // SYNC_HEADERS, then SYNC_BODIES
+    uint8_t peer[6];
+    uint16_t session;
+    uint32_t from;              // Height of hashes[0]
+    uint32_t tip;               // Download end (0 until the first headers frame)
+    uint32_t peerHeight;
+    uint16_t headersReceived;
+    uint8_t headerSeen[(MAX_BLOCKS + 7) / 8];
+    uint32_t nextApply;
+    uint32_t acked;             // 'from' of the last body request
+    uint8_t retries;
+    unsigned long lastActivity;
+    unsigned long startedAt;
+    Hash32 hashes[MAX_BLOCKS];
+    SyncSlot slots[SYNC_WINDOW];
+};
+
+ChainSync chainSync = {0};
+
+// Chain stream we are serving
+struct ChainServe {
+    bool active;
+    uint8_t mac[6];
+    uint16_t session;
+    uint8_t kind;
+    uint8_t part;               // Next body part of block 'next'
+    uint32_t next;
+    uint32_t end;
+    unsigned long lastRequest;
+};
+
+ChainServe chainServe = {0};
+
+// Compact block waiting for transactions we don't have
+struct PendingBlock {
+    bool active;
+    bool synced;                // A chain sync body; chain sync applies it once its txs are in
+    bool fullRefetch;           // Short IDs matched the wrong tx; fetching every one
+    uint8_t peer[6];
+    Block block;
+    uint32_t missing;           // Bit per tx position
+    uint32_t txBytes;           // Wire size of the block's txs, for relayStats
+    uint8_t retries;
+    unsigned long requestedAt;
+};
+
+PendingBlock pendingBlock = {0};
+
+// Block transactions we owe a peer
+struct BlockTxnServe {
+    bool active;
+    uint8_t mac[6];
+    uint32_t height;
+    uint32_t missing;
+};
+
+BlockTxnServe blockTxnServe = {0};
+
+// Receive-side cost of compact relay vs. shipping each block with its txs
+struct RelayStats {
+    uint32_t blocks;
+    uint32_t txRebuilt;         // Found in our pool
+    uint32_t txFetched;
+    uint32_t compactBytes;      // Announcements, requests and fetched txs
+    uint32_t fullBytes;         // Full block plus every tx in it
+};
+
+RelayStats relayStats = {0};
+
+// Streaming query sink: return false to stop the scan early
+typedef bool (*TelemetryCallback)(const TelemetryData* reading, void* ctx);
+
+// Interned sensorId <-> handle registry
+SensorIdEntry sensorIds[MAX_SENSOR_IDS];
+uint8_t sensorIdCount = 0;
+bool sensorIdsDirty = false;
+
+// Per-sensor time from pool arrival to block inclusion
+struct SensorLatency {
+    uint16_t sensor;
+    uint32_t included;
+    uint32_t totalDelay;    // seconds
+    uint32_t maxDelay;      // seconds
+};
+
+SensorLatency sensorLatency[MAX_TRACKED_SENSORS];
+uint8_t sensorLatencyCount = 0;
+
+// Open-addressing set of tx hash prefixes (pool + last SEEN_TX_BLOCKS blocks)
+uint64_t seenTx[SEEN_TX_SLOTS];
+uint16_t seenTxCount = 0;
+
+// Outbound frame queue: priority, then FIFO; unicast frames retry until acknowledged
+enum TxPriority {
+    PRIO_CHAIN,                 // Blocks, block txs, chain sync
+    PRIO_DATA,                  // Telemetry, queries, alarms
+    PRIO_ANNOUNCE,              // Announcements and heartbeats
+    PRIO_LEVELS
+};
+
+enum TxState {
+    TX_FREE,
+    TX_QUEUED,
+    TX_SENT                     // Handed to ESP-NOW, waiting for its completion
+};
+
+struct TxFrame {
+    uint8_t state;
+    uint8_t priority;
+    uint8_t attempts;
+    uint8_t len;
+    uint8_t mac[6];
+    uint32_t seq;               // Enqueue order
+    unsigned long sentAt;
+    uint8_t data[ESPNOW_MAX_FRAME];
+};
+
+TxFrame txQueue[TX_QUEUE_DEPTH];
+uint8_t txQueueCount = 0;
+uint8_t txInFlight = 0;
+uint32_t txSeq = 0;
+
+// Send results from the radio task, with the destination they are for
+struct TxDone {
+    uint8_t mac[6];
+    bool ok;
+};
+
+TxDone txDone[8];
+volatile uint8_t txDoneHead = 0;
+volatile uint8_t txDoneTail = 0;
+
+// Frames from the radio task, handled in loop() so handlers never race it
+struct RxFrame {
+    uint8_t mac[6];
+    int8_t rssi;
+    uint8_t len;
+    uint8_t data[ESPNOW_MAX_FRAME];
+};
+
+RxFrame rxQueue[RX_QUEUE_DEPTH];
+volatile uint8_t rxHead = 0;
+volatile uint8_t rxTail = 0;
+
+struct TransportStats {
+    uint32_t queued;
+    uint32_t sent;              // Transmissions, including retries
+    uint32_t acked;             // Unicast frames the peer acknowledged
+    uint32_t retries;
+    uint32_t failed;            // Given up after TX_RETRIES
+    uint32_t dropped;           // Queue full
+    uint32_t timeouts;          // No send completion
+    uint32_t late;              // Completions arriving after their timeout
+    uint8_t peakDepth;
+};
+
+TransportStats transportStats = {0};
+
+// Neighbors heard directly, keyed by MAC in an open-addressing table
+struct PeerEntry {
+    uint8_t mac[6];
+    bool used;
+    bool registered;            // Currently added to the ESP-NOW peer list
+    int8_t rssi;                // Last frame, dBm (0 = not reported)
+    int8_t rssiAvg;             // Smoothed over ~8 frames
+    unsigned long firstSeen;
+    unsigned long lastSeen;
+    unsigned long lastUnicast;
+    uint32_t rxFrames;
+    uint32_t rxBytes;
+    uint32_t txFrames;
+    uint32_t txFailures;        // Unicast frames not acknowledged
+    uint8_t txFailStreak;
+    unsigned long txHoldUntil;  // Backoff after a failure
+    uint32_t frameTokens;       // Receive token buckets, 1000 per frame/tx
+    uint32_t txTokens;
+    unsigned long lastRefill;
+    uint8_t misbehavior;        // Decays 1 point per second
+    unsigned long bannedUntil;  // 0 = not banned
+    uint32_t rxRefused;         // Frames and records admission control dropped
+};
+
+PeerEntry peerTable[PEER_TABLE_SLOTS];
+uint16_t peerCount = 0;         // Live peers (heard within PEER_EXPIRY_MS)
+uint8_t espNowPeerCount = 0;
+uint32_t peersExpired = 0;
+uint32_t peersEvicted = 0;
+unsigned long lastPeerMaintenance = 0;
+
+// Receive-path admission control
+struct AdmissionStats {
+    uint32_t rateLimited;       // Frames/records over a peer's token bucket
+    uint32_t malformed;
+    uint32_t invalidTx;
+    uint32_t overShare;         // Txs refused by the per-sensor pool cap
+    uint32_t handleClash;       // Txs whose sensor tag contradicts our handle registry
+    uint32_t ignored;           // Frames from banned peers
+    uint32_t bans;
+    uint32_t rxOverflow;        // Frames dropped because loop() fell behind
+};
+
+AdmissionStats admissionStats = {0};
 bool broadcastPeerAdded = false;
 
 char myAddress[17];
+uint8_t myMac[6];
+
+// Messages and payload bytes sent per type, and what actually went on air
+struct WireStats {
+    uint32_t frames[MSG_TYPES];
+    uint32_t bytes[MSG_TYPES];
+    uint32_t messages;
+    uint32_t airFrames;
+    uint32_t airBytes;
+};
+
+WireStats wireStats = {0};
+
+// Multi-hop flooding: IDs already seen, and relays waiting out their jitter
+struct GossipRelay {
+    bool active;
+    uint8_t copies;             // Duplicates heard while waiting
+    unsigned long due;
+    NetworkPacket packet;
+};
+
+uint32_t gossipSeen[GOSSIP_SEEN_SLOTS];
+uint8_t gossipSeenNext = 0;
+GossipRelay gossipQueue[GOSSIP_QUEUE];
+
+struct GossipStats {
+    uint32_t originated;
+    uint32_t received;          // New messages delivered
+    uint32_t duplicates;
+    uint32_t relayed;
+    uint32_t suppressed;        // Relays cancelled by copies heard
+    uint32_t dropped;           // Relay queue full
+};
+
+GossipStats gossipStats = {0};
+
+// Inventory relay: txs are announced by short ID and pulled by peers lacking them
+uint8_t invPending[INV_MAX_IDS][SHORT_ID_BYTES];
+uint8_t invPendingHeard[INV_MAX_IDS];   // Neighbors that announced it meanwhile
+uint8_t invPendingHolders[INV_MAX_IDS]; // Neighbors known to have (or be getting) it
+uint8_t invPendingCount = 0;
+unsigned long invPendingDue = 0;
+
+struct InvRequest {
+    bool active;
+    bool sent;                  // Asked (by us, or a neighbor asked the same peer)
+    uint8_t id[SHORT_ID_BYTES];
+    uint8_t peer[6];            // Who announced it
+    uint8_t holders;            // Announcers and requesters heard so far
+    uint8_t tries;
+    unsigned long due;
+    unsigned long sentAt;
+};
+
+InvRequest invRequests[INV_REQUESTS];
+
+// A requested tx waiting to be sent, or recently sent
+struct InvServe {
+    bool active;
+    bool sent;
+    uint8_t id[SHORT_ID_BYTES];
+    unsigned long sentAt;
+};
+
+InvServe invServe[INV_SERVE_SLOTS];
+
+struct InvStats {
+    uint32_t announced;         // IDs in our inventories
+    uint32_t suppressed;        // ...left out, enough neighbors announced them
+    uint32_t pushed;            // ...sent in full, few neighbors could lack them
+    uint32_t requested;         // IDs we pulled
+    uint32_t covered;           // ...or didn't need to, a neighbor asked first
+    uint32_t rerequested;
+    uint32_t served;
+};
+
+InvStats invStats = {0};
+
+// Broadcast records waiting to share a frame
+uint8_t coalesceBuf[ESPNOW_MAX_FRAME - WIRE_HEADER_MAX];
+uint16_t coalesceLen = 0;
+uint8_t coalesceCount = 0;
+uint8_t coalescePriority = 0;   // Most urgent record waiting
+unsigned long coalesceStart = 0;
 Preferences preferences;
 
 unsigned long lastBlockTime = 0;
+unsigned long lastHeartbeat = 0;
+unsigned long scheduleListenUntil = 0;  // No first schedule before a heartbeat round is heard
+
+// Round-robin block schedule: the validator for height h is macs[h % count]
+struct ValidatorSet {
+    uint32_t epoch;
+    uint8_t count;
+    uint8_t macs[VALIDATOR_SET_MAX][6];
+};
+
+struct ValidatorCandidate {
+    uint8_t mac[6];
+    unsigned long lastHeard;    // Its own heartbeat (0 = never)
+    unsigned long lastVouched;  // Listed by a validator that hears it (0 = never)
+};
+
+struct ScheduleStats {
+    uint32_t epochs;            // Sets rebuilt
+    uint32_t merged;            // Validators learned from another's heartbeat
+    uint32_t takeovers;         // Blocks mined in a late validator's place
+    uint32_t mined;             // Blocks we mined, whether or not they stayed on the chain
+};
+
+ValidatorSet validatorSet = {0};
+ValidatorCandidate validatorCandidates[VALIDATOR_CANDIDATES];
+uint8_t validatorCandidateCount = 0;
+ScheduleStats scheduleStats = {0};
 unsigned long lastTelemetryTime = 0;
 unsigned long lastAnnounceTime = 0;
+bool tipAnnounceDue = false;    // Our height moved: announce it without waiting out the interval
 unsigned long lastSaveTime = 0;
 
+// Readings collected for the next telemetry transaction
+Transaction sensorBatch;
+unsigned long sensorBatchStart = 0;
+
 bool spiffsInitialized = false;
 
 // ==================== SPIFFS FUNCTIONS ====================
@@ -195,6 +1217,7 @@ bool saveMetadata() {
     meta.blockCount = blockCount;
     meta.totalBlocks = totalBlocks;
     meta.lastSaveTime = millis() / 1000;
+    meta.chainBase = chainBase;
     
     if(blockCount > 0) {
         Block* lastBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
@@ -224,63 +1247,152 @@ bool loadMetadata() {
         return false;
     }
     
-    ChainMetadata meta;
+    ChainMetadata meta = {0};
     size_t bytesRead = file.read((uint8_t*)&meta, sizeof(meta));
     file.close();
     
-    if(bytesRead != sizeof(meta)) {
+    if(bytesRead != sizeof(meta) && bytesRead != sizeof(meta) - sizeof(meta.chainBase)) {
         Serial.println("✗ Metadata file corrupted");
         return false;
     }
     
     blockCount = meta.blockCount;
     totalBlocks = meta.totalBlocks;
+    chainBase = meta.chainBase;
     
     Serial.printf("✓ Metadata loaded: %u blocks\n", blockCount);
     return true;
 }
 
-// Save blockchain to SPIFFS
-bool saveBlockchain() {
-    if(!spiffsInitialized) return false;
-    
-    Serial.println("💾 Saving blockchain to SPIFFS...");
-    
-    File file = SPIFFS.open(BLOCKCHAIN_FILE, FILE_WRITE);
+// Rollups are written with the chain so they stay in step with committed blocks
+bool saveRollups() {
+    File file = SPIFFS.open(ROLLUPS_FILE, FILE_WRITE);
     if(!file) {
-        Serial.println("✗ Failed to open blockchain file for writing");
+        Serial.println("✗ Failed to open rollups file for writing");
         return false;
     }
     
-    // Write block count first
-    file.write((uint8_t*)&blockCount, sizeof(blockCount));
-    
-    // Write all blocks
-    for(uint32_t i = 0; i < blockCount && i < MAX_BLOCKS; i++) {
-        size_t written = file.write((uint8_t*)&blockchain[i], sizeof(Block));
-        if(written != sizeof(Block)) {
-            Serial.printf("✗ Failed to write block %u\n", i);
-            file.close();
-            return false;
-        }
+    file.write(&sensorRollupCount, 1);
+    file.write((uint8_t*)sensorRollups, sensorRollupCount * sizeof(SensorRollup));
+    file.write((uint8_t*)&rollupLateDrops, sizeof(rollupLateDrops));
+    file.close();
+    return true;
+}
+
+bool saveQuantiles() {
+    File file = SPIFFS.open(QUANTILES_FILE, FILE_WRITE);
+    if(!file) {
+        Serial.println("✗ Failed to open quantiles file for writing");
+        return false;
     }
     
+    file.write(&sensorQuantilesCount, 1);
+    file.write((uint8_t*)sensorQuantiles, sensorQuantilesCount * sizeof(SensorQuantiles));
     file.close();
-    
-    Serial.printf("✓ Saved %u blocks to SPIFFS\n", blockCount);
-    return saveMetadata();
+    return true;
 }
 
-// Load blockchain from SPIFFS
-bool loadBlockchain() {
-    if(!spiffsInitialized) return false;
+bool loadQuantiles() {
+    sensorQuantilesCount = 0;
+    if(!SPIFFS.exists(QUANTILES_FILE)) return false;
     
-    if(!SPIFFS.exists(BLOCKCHAIN_FILE)) {
-        Serial.println("ℹ️  No blockchain file found, starting fresh");
+    File file = SPIFFS.open(QUANTILES_FILE, FILE_READ);
+    if(!file) return false;
+    
+    uint8_t count = 0;
+    file.read(&count, 1);
+    
+    if(count > QUANTILE_SENSORS || file.size() != 1 + count * sizeof(SensorQuantiles)) {
+        Serial.println("⚠️  Quantiles file layout mismatch, starting fresh");
+        file.close();
         return false;
     }
     
-    Serial.println("📖 Loading blockchain from SPIFFS...");
+    file.read((uint8_t*)sensorQuantiles, count * sizeof(SensorQuantiles));
+    file.close();
+    
+    sensorQuantilesCount = count;
+    Serial.printf("✓ Loaded quantile sketches for %u sensors\n", sensorQuantilesCount);
+    return true;
+}
+
+bool loadRollups() {
+    sensorRollupCount = 0;
+    if(!SPIFFS.exists(ROLLUPS_FILE)) return false;
+    
+    File file = SPIFFS.open(ROLLUPS_FILE, FILE_READ);
+    if(!file) return false;
+    
+    uint8_t count = 0;
+    file.read(&count, 1);
+    
+    // Reject files written with a different rollup layout
+    if(count > ROLLUP_SENSORS ||
+       file.size() != 1 + count * sizeof(SensorRollup) + sizeof(rollupLateDrops)) {
+        Serial.println("⚠️  Rollups file layout mismatch, starting fresh");
+        file.close();
+        return false;
+    }
+    
+    file.read((uint8_t*)sensorRollups, count * sizeof(SensorRollup));
+    file.read((uint8_t*)&rollupLateDrops, sizeof(rollupLateDrops));
+    file.close();
+    
+    sensorRollupCount = count;
+    Serial.printf("✓ Loaded rollups for %u sensors\n", sensorRollupCount);
+    return true;
+}
+
+// Save blockchain to SPIFFS
+bool saveBlockchain() {
+    if(!spiffsInitialized) return false;
+    
+    Serial.println("💾 Saving blockchain to SPIFFS...");
+    
+    File file = SPIFFS.open(BLOCKCHAIN_FILE, FILE_WRITE);
+    if(!file) {
+        Serial.println("✗ Failed to open blockchain file for writing");
+        return false;
+    }
+    
+    // Write block count first
+    file.write((uint8_t*)&blockCount, sizeof(blockCount));
+    
+    // Write all blocks
+    for(uint32_t i = 0; i < blockCount && i < MAX_BLOCKS; i++) {
+        size_t written = file.write((uint8_t*)&blockchain[i], sizeof(Block));
+        if(written != sizeof(Block)) {
+            Serial.printf("✗ Failed to write block %u\n", i);
+            file.close();
+            return false;
+        }
+    }
+    
+    file.close();
+    
+    Serial.printf("✓ Saved %u blocks to SPIFFS\n", blockCount);
+    
+    File zones = SPIFFS.open(ZONES_FILE, FILE_WRITE);
+    if(zones) {
+        zones.write((uint8_t*)blockZones, sizeof(blockZones));
+        zones.close();
+    }
+    
+    saveRollups();
+    saveQuantiles();
+    return saveMetadata();
+}
+
+// Load blockchain from SPIFFS
+bool loadBlockchain() {
+    if(!spiffsInitialized) return false;
+    
+    if(!SPIFFS.exists(BLOCKCHAIN_FILE)) {
+        Serial.println("ℹ️  No blockchain file found, starting fresh");
+        return false;
+    }
+    
+    Serial.println("📖 Loading blockchain from SPIFFS...");
     
     File file = SPIFFS.open(BLOCKCHAIN_FILE, FILE_READ);
     if(!file) {
@@ -294,6 +1406,14 @@ bool loadBlockchain() {
     
     Serial.printf("  Found %u blocks in storage\n", savedBlockCount);
     
+    // Files written with a different Block layout can't be read back
+    size_t expectedBlocks = (savedBlockCount < MAX_BLOCKS) ? savedBlockCount : MAX_BLOCKS;
+    if(file.size() != sizeof(savedBlockCount) + expectedBlocks * sizeof(Block)) {
+        Serial.println("✗ Blockchain file layout mismatch, starting fresh");
+        file.close();
+        return false;
+    }
+    
     // Read blocks
     uint32_t blocksToLoad = (savedBlockCount < MAX_BLOCKS) ? savedBlockCount : MAX_BLOCKS;
     
@@ -313,6 +1433,19 @@ bool loadBlockchain() {
     
     Serial.printf("✓ Loaded %u blocks from SPIFFS\n", blockCount);
     
+    // Block zone maps; without them history queries fall back to segment zones
+    memset(blockZones, 0, sizeof(blockZones));
+    File zones = SPIFFS.open(ZONES_FILE, FILE_READ);
+    if(zones) {
+        if(zones.size() == sizeof(blockZones)) {
+            zones.read((uint8_t*)blockZones, sizeof(blockZones));
+        }
+        zones.close();
+    }
+    
+    loadRollups();
+    loadQuantiles();
+    
     // Verify last block
     if(blockCount > 0) {
         Block* lastBlock = &blockchain[blockCount - 1];
@@ -340,7 +1473,7 @@ bool saveTxPool() {
     
     // Write transactions
     for(uint8_t i = 0; i < txPoolCount; i++) {
-        file.write((uint8_t*)&txPool[i], sizeof(Transaction));
+        file.write((uint8_t*)txPoolAt(i), sizeof(Transaction));
     }
     
     file.close();
@@ -366,11 +1499,21 @@ bool loadTxPool() {
     uint8_t savedTxCount;
     file.read((uint8_t*)&savedTxCount, sizeof(savedTxCount));
     
+    // Pool files written with a different Transaction layout are dropped
+    if(file.size() != sizeof(savedTxCount) + savedTxCount * sizeof(Transaction)) {
+        Serial.println("✗ Transaction pool file layout mismatch, ignoring");
+        file.close();
+        return false;
+    }
+    
     // Read transactions
+    txPoolHead = 0;
     txPoolCount = (savedTxCount < TX_POOL_SIZE) ? savedTxCount : TX_POOL_SIZE;
     
     for(uint8_t i = 0; i < txPoolCount; i++) {
         file.read((uint8_t*)&txPool[i], sizeof(Transaction));
+        txPoolSeq[i] = txPoolNextSeq++;
+        txPoolArrival[i] = millis() / 1000;
     }
     
     file.close();
@@ -378,6 +1521,91 @@ bool loadTxPool() {
     return true;
 }
 
+// Open the committed-transaction log (header: total records appended)
+File openTxLog(const char* mode) {
+    if(!spiffsInitialized) return File();
+    
+    if(!SPIFFS.exists(TXLOG_FILE)) {
+        File file = SPIFFS.open(TXLOG_FILE, FILE_WRITE);
+        uint32_t zero = 0;
+        if(file) file.write((uint8_t*)&zero, sizeof(zero));
+        file.close();
+    }
+    
+    return SPIFFS.open(TXLOG_FILE, mode);
+}
+
+// Append a committed transaction; returns its record number
+uint32_t appendTxLog(File& file, const Transaction* tx) {
+    if(!file) return LOC_NONE;
+    
+    uint32_t record = txLogCount;
+    file.seek(sizeof(uint32_t) + (record % TX_LOG_SLOTS) * sizeof(Transaction));
+    if(file.write((uint8_t*)tx, sizeof(Transaction)) != sizeof(Transaction)) {
+        return LOC_NONE;
+    }
+    
+    ZoneMap* segment = &segmentZones[(record / ZONE_SEGMENT_RECORDS) % (TX_LOG_SLOTS / ZONE_SEGMENT_RECORDS)];
+    if(record % ZONE_SEGMENT_RECORDS == 0) {
+        segment->minTs = UINT32_MAX;
+        segment->maxTs = 0;
+        segment->sensorMask = 0;
+    }
+    zoneAddTransaction(segment, tx);
+    
+    txLogCount++;
+    file.seek(0);
+    file.write((uint8_t*)&txLogCount, sizeof(txLogCount));
+    return record;
+}
+
+// Read a committed transaction back; false once its slot has been reused
+bool readTxLog(File& file, uint32_t record, Transaction* out) {
+    if(!file || record >= txLogCount || txLogCount - record > TX_LOG_SLOTS) {
+        return false;
+    }
+    
+    file.seek(sizeof(uint32_t) + (record % TX_LOG_SLOTS) * sizeof(Transaction));
+    return file.read((uint8_t*)out, sizeof(Transaction)) == sizeof(Transaction);
+}
+
+// Save sensor ID registry
+bool saveSensorRegistry() {
+    if(!spiffsInitialized) return false;
+    
+    File file = SPIFFS.open(SENSORS_FILE, FILE_WRITE);
+    if(!file) {
+        Serial.println("✗ Failed to open sensor registry for writing");
+        return false;
+    }
+    
+    file.write((uint8_t*)&sensorIdCount, sizeof(sensorIdCount));
+    size_t written = file.write((uint8_t*)sensorIds, sensorIdCount * sizeof(SensorIdEntry));
+    file.close();
+    
+    sensorIdsDirty = false;
+    return (written == sensorIdCount * sizeof(SensorIdEntry));
+}
+
+// Load sensor ID registry
+bool loadSensorRegistry() {
+    if(!spiffsInitialized || !SPIFFS.exists(SENSORS_FILE)) return false;
+    
+    File file = SPIFFS.open(SENSORS_FILE, FILE_READ);
+    if(!file) return false;
+    
+    uint8_t savedCount = 0;
+    file.read((uint8_t*)&savedCount, sizeof(savedCount));
+    if(savedCount > MAX_SENSOR_IDS) savedCount = MAX_SENSOR_IDS;
+    
+    size_t bytesRead = file.read((uint8_t*)sensorIds, savedCount * sizeof(SensorIdEntry));
+    file.close();
+    
+    sensorIdCount = bytesRead / sizeof(SensorIdEntry);
+    Serial.printf("✓ Loaded %u sensor IDs\n", sensorIdCount);
+    return true;
+}
+
 // Periodic save task
 void periodicSaveTask() {
     unsigned long now = millis();
@@ -395,6 +1623,10 @@ void periodicSaveTask() {
             success = saveTxPool() && success;
         }
         
+        if(sensorIdsDirty) {
+            success = saveSensorRegistry() && success;
+        }
+        
         if(success) {
             Serial.println("✓ Periodic save completed\n");
         } else {
@@ -424,27 +1656,42 @@ void clearStorage() {
         Serial.println("  ✓ Metadata file removed");
     }
     
-    blockCount = 0;
-    totalBlocks = 0;
-    txPoolCount = 0;
+    if(SPIFFS.exists(SENSORS_FILE)) {
+        SPIFFS.remove(SENSORS_FILE);
+        Serial.println("  ✓ Sensor registry removed");
+    }
     
-    Serial.println("✓ Storage cleared\n");
-}
-
-// List all files in SPIFFS
-void listSPIFFSFiles() {
-    if(!spiffsInitialized) return;
+    if(SPIFFS.exists(TXLOG_FILE)) {
+        SPIFFS.remove(TXLOG_FILE);
+        Serial.println("  ✓ Transaction log removed");
+    }
     
-    Serial.println("\n📂 SPIFFS Files:");
+    if(SPIFFS.exists(ZONES_FILE)) {
+        SPIFFS.remove(ZONES_FILE);
+    }
+    memset(blockZones, 0, sizeof(blockZones));
     
-    File root = SPIFFS.open("/");
-    File file = root.openNextFile();
+    if(SPIFFS.exists(ROLLUPS_FILE)) {
+        SPIFFS.remove(ROLLUPS_FILE);
+    }
+    sensorRollupCount = 0;
+    rollupLateDrops = 0;
     
-    while(file) {
-        Serial.printf("  %s (%u bytes)\n", file.name(), file.size());
-        file = root.openNextFile();
+    if(SPIFFS.exists(QUANTILES_FILE)) {
+        SPIFFS.remove(QUANTILES_FILE);
     }
-    Serial.println();
+    sensorQuantilesCount = 0;
+    
+    blockCount = 0;
+    totalBlocks = 0;
+    chainBase = 0;
+    txPoolHead = 0;
+    txPoolCount = 0;
+    txLogCount = 0;
+    rebuildSeenTxSet();
+    rebuildTelemetryIndex();
+    
+    Serial.println("✓ Storage cleared\n");
 }
 
 // ==================== ROLE ASSIGNMENT ====================
@@ -522,56 +1769,6 @@ void assignNodeRole() {
     Serial.printf("✓ Role assigned: %s\n", roleName);
 }
 
-void checkRoleChangeCommand() {
-    if(Serial.available() > 0) {
-        char cmd = Serial.read();
-        
-        switch(cmd) {
-            case 'v':
-            case 'V':
-                MY_ROLE = VALIDATOR_NODE;
-                Serial.println("\n✓ Role changed to: VALIDATOR");
-                break;
-            case 's':
-            case 'S':
-                MY_ROLE = SENSOR_NODE;
-                Serial.println("\n✓ Role changed to: SENSOR");
-                break;
-            case 'a':
-            case 'A':
-                MY_ROLE = ARCHIVE_NODE;
-                Serial.println("\n✓ Role changed to: ARCHIVE");
-                break;
-            case 'c':
-            case 'C':
-                clearStorage();
-                break;
-            case 'l':
-            case 'L':
-                listSPIFFSFiles();
-                break;
-            case 'w':
-            case 'W':
-                Serial.println("\n💾 Manual save triggered");
-                saveBlockchain();
-                saveTxPool();
-                break;
-            case '?':
-                Serial.println("\n=== Commands ===");
-                Serial.println("V - Set as VALIDATOR");
-                Serial.println("S - Set as SENSOR");
-                Serial.println("A - Set as ARCHIVE");
-                Serial.println("C - Clear storage");
-                Serial.println("L - List SPIFFS files");
-                Serial.println("W - Write/save now");
-                Serial.println("? - Show this help");
-                break;
-        }
-        
-        while(Serial.available()) Serial.read();
-    }
-}
-
 // ==================== CRYPTOGRAPHIC FUNCTIONS ====================
 
 void calculateSHA256Binary(const uint8_t* data, size_t len, uint8_t* out32) {
@@ -592,14 +1789,20 @@ void bin2hex(const uint8_t* bin, size_t len, char* outHex) {
 }
 
 void calculateTxHash(Transaction* tx) {
-    char data[200];
-    int n = snprintf(data, sizeof(data), "%s|%.2f|%.2f|%.2f|%u",
-                     tx->data.sensorId,
-                     tx->data.temperature,
-                     tx->data.humidity,
-                     tx->data.pressure,
-                     tx->data.timestamp);
-    calculateSHA256Binary((const uint8_t*)data, n, tx->txHash);
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    mbedtls_md_starts(&ctx);
+    
+    // Hash the compact encoding: handle, tag, count and every used reading
+    uint8_t count = (tx->readingCount < TX_BATCH_MAX) ? tx->readingCount : TX_BATCH_MAX;
+    mbedtls_md_update(&ctx, (const uint8_t*)&tx->sensor, sizeof(tx->sensor));
+    mbedtls_md_update(&ctx, (const uint8_t*)&tx->sensorTag, sizeof(tx->sensorTag));
+    mbedtls_md_update(&ctx, &count, sizeof(count));
+    mbedtls_md_update(&ctx, (const uint8_t*)tx->readings, count * sizeof(CompactReading));
+    
+    mbedtls_md_finish(&ctx, tx->txHash);
+    mbedtls_md_free(&ctx);
 }
 
 void calculateBlockHash(Block* block) {
@@ -632,297 +1835,4559 @@ void signTransaction(Transaction* tx) {
     calculateSHA256Binary((uint8_t*)data, strlen(data), tx->signature);
 }
 
-// ==================== BLOCKCHAIN FUNCTIONS ====================
+// ==================== SENSOR REGISTRY ====================
 
-void createGenesisBlock() {
-    Block genesis = {0};
-    genesis.index = 0;
-    genesis.timestamp = millis() / 1000;
-    genesis.txCount = 0;
-    memset(genesis.previousHash, 0, 32);
-    strcpy(genesis.validator, myAddress);
-    genesis.nonce = 0;
+uint32_t sensorHash(const char* sensorId) {
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < 16 && sensorId[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)sensorId[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Preferred 16-bit handle for a sensorId (FNV-1a folded; 0 is reserved)
+uint16_t sensorHandleOf(const char* sensorId) {
+    uint32_t hash = sensorHash(sensorId);
+    uint16_t handle = (hash >> 16) ^ (hash & 0xFFFF);
+    return handle ? handle : 1;
+}
+
+// The other half of the hash: with the preferred handle it pins down all 32 bits
+uint16_t sensorTagOf(const char* sensorId) {
+    return sensorHash(sensorId) >> 16;
+}
+
+SensorIdEntry* findSensorId(uint16_t handle) {
+    for(uint8_t i = 0; i < sensorIdCount; i++) {
+        if(sensorIds[i].handle == handle) return &sensorIds[i];
+    }
+    return NULL;
+}
+
+SensorIdEntry* findSensorName(const char* sensorId) {
+    for(uint8_t i = 0; i < sensorIdCount; i++) {
+        if(strncmp(sensorIds[i].sensorId, sensorId, 16) == 0) return &sensorIds[i];
+    }
+    return NULL;
+}
+
+// Handle a sensorId goes by here: its registered one, else the preferred one
+uint16_t lookupSensorHandle(const char* sensorId) {
+    SensorIdEntry* entry = findSensorName(sensorId);
+    return (entry != NULL) ? entry->handle : sensorHandleOf(sensorId);
+}
+
+// False if the handle belongs to a different sensorId than the tag was made from
+bool sensorTagMatches(uint16_t handle, uint16_t tag) {
+    SensorIdEntry* entry = findSensorId(handle);
+    if(entry == NULL) return true;      // Owner not announced yet
     
-    calculateBlockHash(&genesis);
+    char name[17] = {0};
+    memcpy(name, entry->sensorId, 16);
+    return sensorTagOf(name) == tag;
+}
+
+// Record a handle -> sensorId mapping (from ourselves or a peer's announce)
+bool registerSensorId(uint16_t handle, const char* sensorId) {
+    SensorIdEntry* entry = findSensorId(handle);
     
-    blockchain[0] = genesis;
-    blockCount = 1;
-    totalBlocks = 1;
+    if(entry != NULL) {
+        if(strncmp(entry->sensorId, sensorId, 16) != 0) {
+            Serial.printf("⚠️  Sensor handle %04X collision: %.16s vs %.16s\n",
+                         handle, entry->sensorId, sensorId);
+        }
+        return false;
+    }
     
-    Serial.println("✓ Genesis block created");
-    char hex[65];
-    bin2hex(genesis.blockHash, 32, hex);
-    Serial.printf("  Hash: %s\n", hex);
+    if(sensorIdCount >= MAX_SENSOR_IDS) return false;
     
-    // Save genesis block immediately
-    saveBlockchain();
+    entry = &sensorIds[sensorIdCount++];
+    entry->handle = handle;
+    strncpy(entry->sensorId, sensorId, 16);
+    sensorIdsDirty = true;
+    return true;
 }
 
-bool validateBlock(Block* block) {
-    if(block->index != totalBlocks) {
-        Serial.printf("✗ Invalid block index: %u (expected %u)\n", 
-                     block->index, totalBlocks);
-        return false;
+// Intern a sensorId, returning its handle. If another sensorId already holds the
+// preferred handle, probe upward to the next free one (at most MAX_SENSOR_IDS are
+// taken); the owner announces whichever handle it ends up with.
+uint16_t internSensorId(const char* sensorId) {
+    SensorIdEntry* known = findSensorName(sensorId);
+    if(known != NULL) return known->handle;
+    
+    uint16_t handle = sensorHandleOf(sensorId);
+    while(findSensorId(handle) != NULL) {
+        handle = (handle == 0xFFFF) ? 1 : handle + 1;
+    }
+    if(handle != sensorHandleOf(sensorId)) {
+        Serial.printf("⚠️  Sensor handle %04X taken, %.16s rehashed to %04X\n",
+                      sensorHandleOf(sensorId), sensorId, handle);
+    }
+    registerSensorId(handle, sensorId);
+    return handle;
+}
+
+// Printable sensorId for a handle ("#ABCD" until its owner announces it)
+void sensorIdOf(uint16_t handle, char* out) {
+    SensorIdEntry* entry = findSensorId(handle);
+    if(entry != NULL) {
+        memcpy(out, entry->sensorId, 16);
+        out[16] = '\0';
+    } else {
+        snprintf(out, 17, "#%04X", handle);
+    }
+}
+
+// ==================== TELEMETRY INDEX ====================
+
+inline IndexEntry* indexAt(SensorIndex* idx, uint16_t i) {
+    return &idx->entries[(idx->head + i) % SENSOR_INDEX_DEPTH];
+}
+
+SensorIndex* findSensorIndex(uint16_t sensor, bool create) {
+    for(uint8_t i = 0; i < sensorIndexCount; i++) {
+        if(sensorIndex[i].sensor == sensor) return &sensorIndex[i];
     }
+    if(!create) return NULL;
     
-    if(blockCount > 0) {
-        Block* lastBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
-        if (memcmp(block->previousHash, lastBlock->blockHash, 32) != 0){
-            Serial.println("✗ Previous hash mismatch");
-            return false;
+    SensorIndex* idx;
+    if(sensorIndexCount < MAX_INDEXED_SENSORS) {
+        idx = &sensorIndex[sensorIndexCount++];
+    } else {
+        // Recycle the sensor that has been quiet the longest
+        idx = &sensorIndex[0];
+        for(uint8_t i = 1; i < MAX_INDEXED_SENSORS; i++) {
+            if(sensorIndex[i].lastUpdate < idx->lastUpdate) idx = &sensorIndex[i];
+        }
+    }
+    
+    idx->sensor = sensor;
+    idx->head = 0;
+    idx->count = 0;
+    idx->coveredFrom = UINT32_MAX;  // Set by the first insert
+    return idx;
+}
+
+// First position whose timestamp is >= ts (or > ts when after is set)
+uint16_t indexSearch(SensorIndex* idx, uint32_t ts, bool after) {
+    uint16_t lo = 0, hi = idx->count;
+    
+    while(lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        uint32_t t = indexAt(idx, mid)->timestamp;
+        if(t < ts || (after && t == ts)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Insert in timestamp order; in-order arrivals append in O(1)
+void indexInsert(uint16_t sensor, uint32_t ts, uint32_t loc) {
+    SensorIndex* idx = findSensorIndex(sensor, true);
+    idx->lastUpdate = millis();
+    
+    // A fresh slot may have missed older readings still in the log
+    if(idx->count == 0 && idx->coveredFrom == UINT32_MAX) {
+        idx->coveredFrom = ts;
+    }
+    
+    if(idx->count == SENSOR_INDEX_DEPTH) {
+        if(ts < indexAt(idx, 0)->timestamp) return;  // Older than anything we keep
+        uint32_t dropped = indexAt(idx, 0)->timestamp;
+        if(dropped + 1 > idx->coveredFrom) idx->coveredFrom = dropped + 1;
+        idx->head = (idx->head + 1) % SENSOR_INDEX_DEPTH;
+        idx->count--;
+    }
+    
+    uint16_t pos = idx->count;
+    if(pos > 0 && ts < indexAt(idx, pos - 1)->timestamp) {
+        pos = indexSearch(idx, ts, true);
+        for(uint16_t i = idx->count; i > pos; i--) {
+            *indexAt(idx, i) = *indexAt(idx, i - 1);
+        }
+    }
+    
+    indexAt(idx, pos)->timestamp = ts;
+    indexAt(idx, pos)->loc = loc;
+    idx->count++;
+}
+
+// Point an indexed reading at its new home (LOC_NONE once it is gone)
+void indexRelocate(uint16_t sensor, uint32_t ts, uint32_t oldLoc, uint32_t newLoc) {
+    SensorIndex* idx = findSensorIndex(sensor, false);
+    if(idx == NULL) return;
+    
+    for(uint16_t i = indexSearch(idx, ts, false); i < idx->count; i++) {
+        IndexEntry* e = indexAt(idx, i);
+        if(e->timestamp != ts) break;
+        if(e->loc == oldLoc) {
+            e->loc = newLoc;
+            return;
+        }
+    }
+}
+
+void indexTransaction(const Transaction* tx, bool inPool, uint32_t id) {
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        indexInsert(tx->sensor, tx->readings[r].timestamp, makeLoc(inPool, id, r));
+    }
+}
+
+void relocateTransaction(const Transaction* tx, uint32_t poolSeq, uint32_t record) {
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        uint32_t newLoc = (record == LOC_NONE) ? LOC_NONE : makeLoc(false, record, r);
+        indexRelocate(tx->sensor, tx->readings[r].timestamp, makeLoc(true, poolSeq, r), newLoc);
+    }
+}
+
+inline uint32_t sensorBit(uint16_t sensor) {
+    return 1u << (sensor & 31);
+}
+
+void zoneAddTransaction(ZoneMap* zone, const Transaction* tx) {
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        uint32_t ts = tx->readings[r].timestamp;
+        if(ts < zone->minTs) zone->minTs = ts;
+        if(ts > zone->maxTs) zone->maxTs = ts;
+    }
+    zone->sensorMask |= sensorBit(tx->sensor);
+}
+
+inline bool zoneMatches(const ZoneMap* zone, uint16_t sensor, uint32_t t0, uint32_t t1) {
+    return (zone->sensorMask & sensorBit(sensor)) && zone->minTs <= t1 && zone->maxTs >= t0;
+}
+
+// Rebuild index and segment zones from the transaction log and pool (after load or clear)
+void rebuildTelemetryIndex() {
+    sensorIndexCount = 0;
+    
+    for(uint16_t s = 0; s < TX_LOG_SLOTS / ZONE_SEGMENT_RECORDS; s++) {
+        segmentZones[s].minTs = UINT32_MAX;
+        segmentZones[s].maxTs = 0;
+        segmentZones[s].sensorMask = 0;
+    }
+    
+    File log = openTxLog(FILE_READ);
+    if(log && (log.size() - sizeof(uint32_t)) % sizeof(Transaction) != 0) {
+        // Written with another Transaction layout: its records can't be read back
+        Serial.println("⚠️  Transaction log has an old record layout, starting a new one");
+        log.close();
+        SPIFFS.remove(TXLOG_FILE);
+        log = openTxLog(FILE_READ);
+    }
+    if(log) {
+        log.read((uint8_t*)&txLogCount, sizeof(txLogCount));
+        
+        uint32_t first = (txLogCount > TX_LOG_SLOTS) ? txLogCount - TX_LOG_SLOTS : 0;
+        Transaction tx;
+        for(uint32_t record = first; record < txLogCount; record++) {
+            if(readTxLog(log, record, &tx)) {
+                indexTransaction(&tx, false, record);
+                zoneAddTransaction(&segmentZones[(record / ZONE_SEGMENT_RECORDS) %
+                                                 (TX_LOG_SLOTS / ZONE_SEGMENT_RECORDS)], &tx);
+            }
+        }
+        log.close();
+    }
+    
+    // The log was scanned from its oldest record, so those indexes are complete
+    for(uint8_t i = 0; i < sensorIndexCount; i++) {
+        if(sensorIndex[i].count < SENSOR_INDEX_DEPTH) sensorIndex[i].coveredFrom = 0;
+    }
+    
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        indexTransaction(txPoolAt(i), true, *txPoolSeqAt(i));
+    }
+}
+
+// ==================== DUPLICATE SUPPRESSION ====================
+
+// Tx hashes are SHA-256, so the first 8 bytes are a well-mixed key; 0 marks an empty slot
+inline uint64_t seenTxKey(const uint8_t* hash) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    return key ? key : 1;
+}
+
+// Slot holding the key, or the empty slot that ends its probe sequence
+uint16_t seenTxFind(uint64_t key) {
+    uint16_t i = key & (SEEN_TX_SLOTS - 1);
+    
+    while(seenTx[i] != 0 && seenTx[i] != key) {
+        i = (i + 1) & (SEEN_TX_SLOTS - 1);
+    }
+    return i;
+}
+
+bool seenTxContains(const uint8_t* hash) {
+    return seenTx[seenTxFind(seenTxKey(hash))] != 0;
+}
+
+// Returns false if the hash was already present (or the set is full)
+bool seenTxInsert(const uint8_t* hash) {
+    uint64_t key = seenTxKey(hash);
+    uint16_t i = seenTxFind(key);
+    
+    if(seenTx[i] == key) return false;
+    if(seenTxCount >= SEEN_TX_SLOTS - 1) return false;
+    
+    seenTx[i] = key;
+    seenTxCount++;
+    return true;
+}
+
+// Backward-shift deletion keeps probe sequences intact without tombstones
+void seenTxErase(const uint8_t* hash) {
+    uint16_t i = seenTxFind(seenTxKey(hash));
+    if(seenTx[i] == 0) return;
+    
+    uint16_t j = i;
+    while(true) {
+        j = (j + 1) & (SEEN_TX_SLOTS - 1);
+        if(seenTx[j] == 0) break;
+        
+        uint16_t home = seenTx[j] & (SEEN_TX_SLOTS - 1);
+        bool movable = (i <= j) ? (home <= i || home > j)
+                                : (home <= i && home > j);
+        if(movable) {
+            seenTx[i] = seenTx[j];
+            i = j;
+        }
+    }
+    
+    seenTx[i] = 0;
+    seenTxCount--;
+}
+
+// Short-ID lookup: keys with the same prefix share a home slot, so one probe run covers them
+bool seenTxContainsShortId(const uint8_t* id) {
+    uint32_t prefix;
+    memcpy(&prefix, id, sizeof(prefix));
+    uint16_t i = prefix & (SEEN_TX_SLOTS - 1);
+    
+    while(seenTx[i] != 0) {
+        if((uint32_t)seenTx[i] == prefix) return true;
+        i = (i + 1) & (SEEN_TX_SLOTS - 1);
+    }
+    return false;
+}
+
+// Repopulate from the pool and recent blocks (after load or clear)
+void rebuildSeenTxSet() {
+    memset(seenTx, 0, sizeof(seenTx));
+    seenTxCount = 0;
+    
+    uint32_t recent = (blockCount < SEEN_TX_BLOCKS) ? blockCount : SEEN_TX_BLOCKS;
+    for(uint32_t b = 0; b < recent; b++) {
+        Block* block = &blockchain[(blockCount - 1 - b) % MAX_BLOCKS];
+        for(int j = 0; j < block->txCount; j++) {
+            seenTxInsert(block->txHashes[j]);
+        }
+    }
+    
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        seenTxInsert(txPoolAt(i)->txHash);
+    }
+}
+
+// ==================== BLOCKCHAIN FUNCTIONS ====================
+
+// Every node builds the same genesis, so fresh nodes share a chain from block 0
+void createGenesisBlock() {
+    Block genesis = {0};
+    genesis.index = 0;
+    genesis.timestamp = 0;
+    genesis.txCount = 0;
+    memset(genesis.previousHash, 0, 32);
+    strcpy(genesis.validator, "GENESIS");
+    genesis.nonce = 0;
+    
+    calculateBlockHash(&genesis);
+    
+    blockchain[0] = genesis;
+    blockCount = 1;
+    totalBlocks = 1;
+    chainBase = 0;
+    
+    Serial.println("✓ Genesis block created");
+    char hex[65];
+    bin2hex(genesis.blockHash, 32, hex);
+    Serial.printf("  Hash: %s\n", hex);
+    
+    // Save genesis block immediately
+    saveBlockchain();
+}
+
+bool validateBlock(Block* block) {
+    if(block->index != totalBlocks) {
+        Serial.printf("✗ Invalid block index: %u (expected %u)\n", 
+                     block->index, totalBlocks);
+        return false;
+    }
+    
+    if(blockCount > 0) {
+        Block* lastBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
+        if (memcmp(block->previousHash, lastBlock->blockHash, 32) != 0){
+            Serial.println("✗ Previous hash mismatch");
+            return false;
+        }
+    }
+    
+    // The hash covers txHashes[0..txCount), so bound it before hashing
+    if(block->txCount > MAX_TX_PER_BLOCK) {
+        Serial.printf("✗ Block #%u claims %u txs (max %d)\n", block->index, block->txCount, MAX_TX_PER_BLOCK);
+        return false;
+    }
+    
+    Block tempBlock = *block;
+    calculateBlockHash(&tempBlock);
+    
+    if (memcmp(tempBlock.blockHash, block->blockHash, 32) != 0) {
+        Serial.println("✗ Block hash invalid");
+        return false;
+    }
+    
+    return true;
+}
+
+bool addBlock(Block* newBlock) {
+    if(!validateBlock(newBlock)) {
+        return false;
+    }
+    
+    // Block leaving the duplicate-check window
+    if(blockCount >= SEEN_TX_BLOCKS) {
+        Block* expired = &blockchain[(blockCount - SEEN_TX_BLOCKS) % MAX_BLOCKS];
+        for(int j = 0; j < expired->txCount; j++) {
+            seenTxErase(expired->txHashes[j]);
+        }
+    }
+    
+    uint32_t index = blockCount % MAX_BLOCKS;
+    blockchain[index] = *newBlock;
+    blockCount++;
+    totalBlocks++;
+    
+    // Drop only the transactions this block committed
+    removeCommittedTx(newBlock, &blockZones[index]);
+    
+    // Block txs we never saw in our pool still count as seen
+    for(int j = 0; j < newBlock->txCount; j++) {
+        seenTxInsert(newBlock->txHashes[j]);
+    }
+    
+    Serial.printf("✓ Block #%u added (%d tx, %u left in pool)\n", 
+                 newBlock->index, newBlock->txCount, txPoolCount);
+    
+    // Save to SPIFFS after adding block (once at the end while syncing)
+    if(!chainSync.active) saveBlockchain();
+    tipAnnounceDue = true;
+    
+    return true;
+}
+
+// A batch is only as good as its worst reading
+uint8_t txWorstQuality(const Transaction* tx) {
+    uint8_t worst = 255;
+    for(uint8_t r = 0; r < tx->readingCount && r < TX_BATCH_MAX; r++) {
+        if(tx->readings[r].dataQuality < worst) worst = tx->readings[r].dataQuality;
+    }
+    return worst;
+}
+
+// Selection key per pending tx (lower = picked first); low byte is pool position
+void computeSelectKeys(uint32_t* keys) {
+    uint16_t sensors[TX_POOL_SIZE];
+    uint8_t taken[TX_POOL_SIZE];
+    uint8_t sensorCount = 0;
+    
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        Transaction* tx = txPoolAt(i);
+        uint32_t priority = 0;
+        
+        switch(TX_SELECT_POLICY) {
+            case SELECT_OLDEST:
+                priority = 0;
+                break;
+                
+            case SELECT_QUALITY:
+                priority = 255 - txWorstQuality(tx);
+                break;
+                
+            case SELECT_ROUND_ROBIN: {
+                // Rank of this reading among its sensor's pending readings
+                uint8_t s = 0;
+                while(s < sensorCount && sensors[s] != tx->sensor) s++;
+                if(s == sensorCount) {
+                    sensors[sensorCount] = tx->sensor;
+                    taken[sensorCount++] = 0;
+                }
+                priority = taken[s]++;
+                break;
+            }
+        }
+        
+        keys[i] = (priority << 8) | i;
+    }
+}
+
+void txHeapSiftDown(uint8_t* heap, uint8_t n, uint8_t i, const uint32_t* keys) {
+    while(true) {
+        uint8_t smallest = i;
+        uint8_t left = 2 * i + 1;
+        uint8_t right = left + 1;
+        
+        if(left < n && keys[heap[left]] < keys[heap[smallest]]) smallest = left;
+        if(right < n && keys[heap[right]] < keys[heap[smallest]]) smallest = right;
+        if(smallest == i) return;
+        
+        uint8_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Pick up to maxCount pool positions by TX_SELECT_POLICY: O(n) heapify + O(k log n) pops
+uint8_t selectTxForBlock(uint8_t* selected, uint8_t maxCount) {
+    uint32_t keys[TX_POOL_SIZE];
+    uint8_t heap[TX_POOL_SIZE];
+    uint8_t n = txPoolCount;
+    
+    computeSelectKeys(keys);
+    
+    for(uint8_t i = 0; i < n; i++) heap[i] = i;
+    for(int i = n / 2 - 1; i >= 0; i--) {
+        txHeapSiftDown(heap, n, i, keys);
+    }
+    
+    uint8_t count = 0;
+    while(count < maxCount && n > 0) {
+        selected[count++] = heap[0];
+        heap[0] = heap[--n];
+        txHeapSiftDown(heap, n, 0, keys);
+    }
+    
+    return count;
+}
+
+// Encoded size of a block carrying txCount hashes
+inline uint16_t blockEncodedSize(uint8_t txCount) {
+    return BLOCK_HEADER_BYTES + txCount * sizeof(Hash32);
+}
+
+// Block size budget from pool depth: enough to drain the pool, clamped to the byte bounds
+uint16_t targetBlockBytes() {
+    uint16_t wanted = blockEncodedSize(txPoolCount);
+    
+    if(wanted < MIN_BLOCK_BYTES) return MIN_BLOCK_BYTES;
+    if(wanted > MAX_BLOCK_BYTES) return MAX_BLOCK_BYTES;
+    return wanted;
+}
+
+// Transactions that fit in a byte budget
+inline uint8_t blockTxCapacity(uint16_t budget) {
+    uint16_t capacity = (budget - BLOCK_HEADER_BYTES) / sizeof(Hash32);
+    return (capacity < MAX_TX_PER_BLOCK) ? capacity : MAX_TX_PER_BLOCK;
+}
+
+Block createBlock() {
+    Block newBlock = {0};
+    newBlock.index = totalBlocks;
+    newBlock.timestamp = millis() / 1000;
+    
+    uint8_t selected[MAX_TX_PER_BLOCK];
+    newBlock.txCount = selectTxForBlock(selected, blockTxCapacity(targetBlockBytes()));
+
+    for (int i = 0; i < newBlock.txCount; ++i) {
+        memcpy(newBlock.txHashes[i], txPoolAt(selected[i])->txHash, 32);
+    }
+
+    if(blockCount > 0) {
+        Block* prevBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
+        memcpy(newBlock.previousHash, prevBlock->blockHash, 32);
+    } else {
+        memset(newBlock.previousHash, 0, 32);
+    }
+    
+    strcpy(newBlock.validator, myAddress);
+    newBlock.nonce = random(0, 1000000);
+    
+    calculateBlockHash(&newBlock);
+    
+    return newBlock;
+}
+
+// ==================== SENSOR STATISTICS ====================
+
+SensorStats* findSensorStats(uint16_t sensor) {
+    for(uint8_t i = 0; i < sensorStatsCount; i++) {
+        if(sensorStats[i].sensor == sensor) return &sensorStats[i];
+    }
+    
+    SensorStats* st;
+    if(sensorStatsCount < MAX_TRACKED_SENSORS) {
+        st = &sensorStats[sensorStatsCount++];
+    } else {
+        // Recycle the sensor that has been quiet the longest
+        st = &sensorStats[0];
+        for(uint8_t i = 1; i < MAX_TRACKED_SENSORS; i++) {
+            if(sensorStats[i].lastUpdate < st->lastUpdate) st = &sensorStats[i];
+        }
+    }
+    
+    memset(st, 0, sizeof(SensorStats));
+    st->sensor = sensor;
+    return st;
+}
+
+inline float statStddev(const RunningStat* s) {
+    return (s->n > 1) ? sqrtf(s->m2 / (s->n - 1)) : 0.0f;
+}
+
+void raiseAlarm(SensorStats* st, uint8_t field, uint8_t kind, float value, uint32_t ts) {
+    RunningStat* s = &st->field[field];
+    if(s->alarmAt[kind] != 0 && ts - s->alarmAt[kind] < ALARM_HOLDOFF_S) return;
+    s->alarmAt[kind] = (ts != 0) ? ts : 1;
+    st->alarms++;
+    
+    char name[17];
+    sensorIdOf(st->sensor, name);
+    Serial.printf("⚠️  ALARM %s: %s %s (%.2f, mean %.2f ± %.2f)\n",
+                  name, STAT_NAMES[field], ALARM_NAMES[kind], value, s->mean, statStddev(s));
+    
+    // Only the node that took the reading reports it, so peers don't echo alarms
+    char own[20];
+    snprintf(own, sizeof(own), "ESP_%s", myAddress + 9);
+    if(strcmp(name, own) != 0) return;
+    
+    NetworkPacket packet;
+    SensorAlarm* alarm = (SensorAlarm*)packet.data;
+    memset(alarm, 0, sizeof(SensorAlarm));
+    alarm->sensor.handle = st->sensor;
+    memcpy(alarm->sensor.sensorId, name, sizeof(alarm->sensor.sensorId));
+    alarm->field = field;
+    alarm->kind = kind;
+    alarm->value = value;
+    alarm->mean = s->mean;
+    alarm->stddev = statStddev(s);
+    alarm->timestamp = ts;
+    packet.type = MSG_SENSOR_ALARM;
+    packet.dataLen = sizeof(SensorAlarm);
+    broadcastPacket(&packet);
+}
+
+// O(1) per reading: checks against the stats so far, then folds the reading in
+void updateStat(SensorStats* st, uint8_t field, float x, uint32_t ts) {
+    RunningStat* s = &st->field[field];
+    
+    if(x < STAT_MIN[field]) raiseAlarm(st, field, ALARM_LOW, x, ts);
+    if(x > STAT_MAX[field]) raiseAlarm(st, field, ALARM_HIGH, x, ts);
+    
+    float sd = statStddev(s);
+    if(s->n >= ALARM_MIN_SAMPLES && sd > 0.0f && fabsf(x - s->mean) > ALARM_ZSCORE * sd) {
+        raiseAlarm(st, field, ALARM_OUTLIER, x, ts);
+    }
+    
+    if(s->n > 0) {
+        s->repeats = (x == s->last) ? s->repeats + 1 : 0;
+        if(s->repeats + 1 >= ALARM_STUCK_READINGS) raiseAlarm(st, field, ALARM_STUCK, x, ts);
+        if(ts > s->lastTs) s->rate = (x - s->last) * 60.0f / (ts - s->lastTs);
+        s->ewma += STATS_EWMA_ALPHA * (x - s->ewma);
+    } else {
+        s->ewma = x;
+    }
+    
+    s->n++;
+    float delta = x - s->mean;
+    s->mean += delta / s->n;
+    s->m2 += delta * (x - s->mean);
+    s->last = x;
+    s->lastTs = ts;
+}
+
+// ---- Quantile sketches ----
+
+// Upper quantile a centroid starting at q0 may reach (k1 scale: asin-shaped, so
+// centroids near q = 0 and q = 1 stay small and the tails keep their precision)
+float digestQLimit(float q0) {
+    const float delta = DIGEST_CENTROIDS - 1;
+    float k = delta / (2.0f * PI) * asinf(2.0f * q0 - 1.0f) + 1.0f;
+    if(k >= delta / 4.0f) return 1.0f;
+    return (sinf(k * 2.0f * PI / delta) + 1.0f) / 2.0f;
+}
+
+// Rebuild the centroid set from n weighted items (sorted here, merged greedily)
+void sketchCompress(QuantileSketch* s, Centroid* items, uint16_t n) {
+    for(uint16_t i = 1; i < n; i++) {
+        Centroid c = items[i];
+        uint16_t j = i;
+        while(j > 0 && items[j - 1].mean > c.mean) {
+            items[j] = items[j - 1];
+            j--;
+        }
+        items[j] = c;
+    }
+    
+    s->centroidCount = 0;
+    if(n == 0) return;
+    
+    uint32_t total = 0;
+    for(uint16_t i = 0; i < n; i++) total += items[i].weight;
+    
+    Centroid cur = items[0];
+    uint32_t soFar = cur.weight;
+    float qLimit = digestQLimit(0.0f);
+    
+    for(uint16_t i = 1; i < n; i++) {
+        float q = (float)(soFar + items[i].weight) / total;
+        if(q <= qLimit || s->centroidCount == DIGEST_CENTROIDS - 1) {
+            cur.weight += items[i].weight;
+            cur.mean += (items[i].mean - cur.mean) * items[i].weight / cur.weight;
+        } else {
+            s->centroids[s->centroidCount++] = cur;
+            qLimit = digestQLimit((float)soFar / total);
+            cur = items[i];
+        }
+        soFar += items[i].weight;
+    }
+    s->centroids[s->centroidCount++] = cur;
+}
+
+void sketchFlush(QuantileSketch* s) {
+    if(s->bufferCount == 0) return;
+    
+    Centroid items[DIGEST_CENTROIDS + DIGEST_BUFFER];
+    uint16_t n = 0;
+    for(uint8_t i = 0; i < s->centroidCount; i++) items[n++] = s->centroids[i];
+    for(uint8_t i = 0; i < s->bufferCount; i++) items[n++] = {s->buffer[i], 1};
+    
+    s->bufferCount = 0;
+    sketchCompress(s, items, n);
+}
+
+void sketchAdd(QuantileSketch* s, float x) {
+    if(s->count == 0 || x < s->min) s->min = x;
+    if(s->count == 0 || x > s->max) s->max = x;
+    s->count++;
+    
+    s->buffer[s->bufferCount++] = x;
+    if(s->bufferCount == DIGEST_BUFFER) sketchFlush(s);
+}
+
+// Sketches are mergeable: the result summarizes both input streams
+void sketchMerge(QuantileSketch* into, QuantileSketch* from) {
+    sketchFlush(into);
+    sketchFlush(from);
+    if(from->count == 0) return;
+    
+    Centroid items[DIGEST_CENTROIDS * 2];
+    uint16_t n = 0;
+    for(uint8_t i = 0; i < into->centroidCount; i++) items[n++] = into->centroids[i];
+    for(uint8_t i = 0; i < from->centroidCount; i++) items[n++] = from->centroids[i];
+    
+    if(into->count == 0 || from->min < into->min) into->min = from->min;
+    if(into->count == 0 || from->max > into->max) into->max = from->max;
+    into->count += from->count;
+    sketchCompress(into, items, n);
+}
+
+// Interpolated quantile (q in 0..1); NAN when empty
+float sketchQuantile(QuantileSketch* s, float q) {
+    sketchFlush(s);
+    if(s->count == 0) return NAN;
+    if(s->centroidCount == 1) return s->centroids[0].mean;
+    
+    float target = q * s->count;
+    float cum = 0.0f;
+    float prevCenter = 0.0f;
+    float prevMean = s->min;
+    
+    for(uint8_t i = 0; i < s->centroidCount; i++) {
+        float center = cum + s->centroids[i].weight / 2.0f;
+        if(target < center) {
+            float span = center - prevCenter;
+            float t = (span > 0.0f) ? (target - prevCenter) / span : 0.0f;
+            return prevMean + t * (s->centroids[i].mean - prevMean);
+        }
+        cum += s->centroids[i].weight;
+        prevCenter = center;
+        prevMean = s->centroids[i].mean;
+    }
+    
+    float span = s->count - prevCenter;
+    float t = (span > 0.0f) ? (target - prevCenter) / span : 1.0f;
+    return prevMean + t * (s->max - prevMean);
+}
+
+SensorQuantiles* findSensorQuantiles(uint16_t sensor, bool create) {
+    for(uint8_t i = 0; i < sensorQuantilesCount; i++) {
+        if(sensorQuantiles[i].sensor == sensor) return &sensorQuantiles[i];
+    }
+    if(!create) return NULL;
+    
+    SensorQuantiles* sq;
+    if(sensorQuantilesCount < QUANTILE_SENSORS) {
+        sq = &sensorQuantiles[sensorQuantilesCount++];
+    } else {
+        // Recycle the sensor that has been quiet the longest
+        sq = &sensorQuantiles[0];
+        for(uint8_t i = 1; i < QUANTILE_SENSORS; i++) {
+            if(sensorQuantiles[i].lastUpdate < sq->lastUpdate) sq = &sensorQuantiles[i];
+        }
+    }
+    
+    memset(sq, 0, sizeof(SensorQuantiles));
+    sq->sensor = sensor;
+    return sq;
+}
+
+void printQuantiles(const char* name, QuantileSketch* sketch) {
+    Serial.printf("   %s: T p50 %.1f p95 %.1f p99 %.1f | H p50 %.1f p95 %.1f p99 %.1f\n", name,
+                  sketchQuantile(&sketch[STAT_TEMPERATURE], 0.50f),
+                  sketchQuantile(&sketch[STAT_TEMPERATURE], 0.95f),
+                  sketchQuantile(&sketch[STAT_TEMPERATURE], 0.99f),
+                  sketchQuantile(&sketch[STAT_HUMIDITY], 0.50f),
+                  sketchQuantile(&sketch[STAT_HUMIDITY], 0.95f),
+                  sketchQuantile(&sketch[STAT_HUMIDITY], 0.99f));
+}
+
+void updateSensorStats(const Transaction* tx) {
+    SensorStats* st = findSensorStats(tx->sensor);
+    st->lastUpdate = millis();
+    SensorQuantiles* sq = findSensorQuantiles(tx->sensor, true);
+    sq->lastUpdate = millis();
+    
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        const CompactReading* reading = &tx->readings[r];
+        float temperature = reading->temperature / 100.0f;
+        float humidity = reading->humidity / 10.0f;
+        
+        updateStat(st, STAT_TEMPERATURE, temperature, reading->timestamp);
+        updateStat(st, STAT_HUMIDITY, humidity, reading->timestamp);
+        updateStat(st, STAT_BATTERY, reading->batteryVoltage / 1000.0f, reading->timestamp);
+        sketchAdd(&sq->sketch[STAT_TEMPERATURE], temperature);
+        sketchAdd(&sq->sketch[STAT_HUMIDITY], humidity);
+    }
+}
+
+// Snapshot of one sensor's running stats, as sent upstream
+void fillStatsReport(const SensorStats* st, SensorStatsReport* out) {
+    memset(out, 0, sizeof(SensorStatsReport));
+    out->sensor.handle = st->sensor;
+    char name[17];
+    sensorIdOf(st->sensor, name);
+    memcpy(out->sensor.sensorId, name, sizeof(out->sensor.sensorId));
+    out->readings = st->field[STAT_TEMPERATURE].n;
+    out->alarms = st->alarms;
+    out->timestamp = st->field[STAT_TEMPERATURE].lastTs;
+    for(uint8_t f = 0; f < STAT_FIELDS; f++) {
+        out->mean[f] = st->field[f].mean;
+        out->stddev[f] = statStddev(&st->field[f]);
+        out->ewma[f] = st->field[f].ewma;
+        out->rate[f] = st->field[f].rate;
+    }
+}
+
+unsigned long lastStatsReport = 0;
+
+// Like alarms, only the node that took the readings reports them
+void sensorStatsReportTask() {
+    if(MY_ROLE != SENSOR_NODE && MY_ROLE != VALIDATOR_NODE) return;
+    if(millis() - lastStatsReport < STATS_REPORT_MS) return;
+    lastStatsReport = millis();
+    
+    char own[20];
+    snprintf(own, sizeof(own), "ESP_%s", myAddress + 9);
+    for(uint8_t i = 0; i < sensorStatsCount; i++) {
+        char name[17];
+        sensorIdOf(sensorStats[i].sensor, name);
+        if(strcmp(name, own) != 0) continue;
+        
+        NetworkPacket packet;
+        fillStatsReport(&sensorStats[i], (SensorStatsReport*)packet.data);
+        packet.type = MSG_SENSOR_STATS;
+        packet.dataLen = sizeof(SensorStatsReport);
+        broadcastPacket(&packet);
+        return;
+    }
+}
+
+// ==================== TELEMETRY FUNCTIONS ====================
+
+TelemetryData sampleTelemetry() {
+    TelemetryData data = {0};
+    
+    snprintf(data.sensorId, sizeof(data.sensorId), "ESP_%s", myAddress + 9);
+    data.temperature = 20.0 + random(-50, 150) / 10.0;
+    data.humidity = 40.0 + random(0, 400) / 10.0;
+    data.pressure = 1013.25 + random(-100, 100) / 10.0;
+    data.batteryVoltage = 3.3 + random(-3, 3) / 10.0;
+    data.timestamp = millis() / 1000;
+    data.rssi = WiFi.RSSI();
+    data.dataQuality = 95 + random(0, 5);
+    
+    return data;
+}
+
+void encodeReading(const TelemetryData* in, CompactReading* out) {
+    out->temperature = constrain(lroundf(in->temperature * 100), INT16_MIN, INT16_MAX);
+    out->humidity = constrain(lroundf(in->humidity * 10), 0, UINT16_MAX);
+    out->pressure = constrain(lroundf(in->pressure * 10), 0, UINT16_MAX);
+    out->batteryVoltage = constrain(lroundf(in->batteryVoltage * 1000), 0, UINT16_MAX);
+    out->timestamp = in->timestamp;
+    out->rssi = constrain(in->rssi, INT8_MIN, INT8_MAX);
+    out->dataQuality = in->dataQuality;
+}
+
+// Append a reading to a batch; false once the batch is full
+bool appendReading(Transaction* tx, const TelemetryData* reading) {
+    if(tx->readingCount >= TX_BATCH_MAX) return false;
+    
+    if(tx->readingCount == 0) {
+        tx->sensor = internSensorId(reading->sensorId);
+        tx->sensorTag = sensorTagOf(reading->sensorId);
+    }
+    
+    encodeReading(reading, &tx->readings[tx->readingCount++]);
+    return true;
+}
+
+// i-th reading of a transaction, decoded to a full TelemetryData
+void decodeReading(const CompactReading* r, TelemetryData* out) {
+    out->temperature = r->temperature / 100.0f;
+    out->humidity = r->humidity / 10.0f;
+    out->pressure = r->pressure / 10.0f;
+    out->batteryVoltage = r->batteryVoltage / 1000.0f;
+    out->timestamp = r->timestamp;
+    out->rssi = r->rssi;
+    out->dataQuality = r->dataQuality;
+}
+
+void txReading(const Transaction* tx, uint8_t i, TelemetryData* out) {
+    char name[17];
+    
+    sensorIdOf(tx->sensor, name);
+    memcpy(out->sensorId, name, sizeof(out->sensorId));
+    decodeReading(&tx->readings[(i < TX_BATCH_MAX) ? i : 0], out);
+}
+
+// Seal the accumulated readings into one hashed, signed transaction
+Transaction createTelemetryTransaction() {
+    Transaction tx = sensorBatch;
+    
+    calculateTxHash(&tx);
+    signTransaction(&tx);
+    
+    memset(&sensorBatch, 0, sizeof(sensorBatch));
+    return tx;
+}
+
+// Remove the pending transaction at position pos, keeping arrival order
+void txPoolRemoveAt(uint8_t pos) {
+    if(pos >= txPoolCount) return;
+    
+    if(pos == 0) {
+        txPoolHead = (txPoolHead + 1) % TX_POOL_SIZE;
+    } else {
+        for(uint8_t i = pos; i + 1 < txPoolCount; i++) {
+            *txPoolAt(i) = *txPoolAt(i + 1);
+            *txPoolSeqAt(i) = *txPoolSeqAt(i + 1);
+            *txPoolArrivalAt(i) = *txPoolArrivalAt(i + 1);
+        }
+    }
+    txPoolCount--;
+}
+
+// Track how long a sensor's tx waited in our pool before a block included it;
+// only local times are compared, since node clocks are not synchronized
+void recordInclusion(const Transaction* tx, uint32_t arrivedAt) {
+    SensorLatency* entry = NULL;
+    
+    for(uint8_t i = 0; i < sensorLatencyCount; i++) {
+        if(sensorLatency[i].sensor == tx->sensor) {
+            entry = &sensorLatency[i];
+            break;
+        }
+    }
+    
+    if(entry == NULL) {
+        if(sensorLatencyCount < MAX_TRACKED_SENSORS) {
+            entry = &sensorLatency[sensorLatencyCount++];
+        } else {
+            // Reuse the least-included slot
+            entry = &sensorLatency[0];
+            for(uint8_t i = 1; i < MAX_TRACKED_SENSORS; i++) {
+                if(sensorLatency[i].included < entry->included) {
+                    entry = &sensorLatency[i];
+                }
+            }
+        }
+        memset(entry, 0, sizeof(SensorLatency));
+        entry->sensor = tx->sensor;
+    }
+    
+    uint32_t now = millis() / 1000;
+    uint32_t delay = (now > arrivedAt) ? now - arrivedAt : 0;
+    entry->included++;
+    entry->totalDelay += delay;
+    if(delay > entry->maxDelay) entry->maxDelay = delay;
+}
+
+// Move the transactions included in a block to the tx log, compacting the rest in order
+uint8_t removeCommittedTx(const Block* block, BlockZone* zone) {
+    uint8_t kept = 0;
+    File log = openTxLog("r+");
+    
+    zone->firstRecord = txLogCount;
+    zone->recordCount = 0;
+    zone->zone.minTs = UINT32_MAX;
+    zone->zone.maxTs = 0;
+    zone->zone.sensorMask = 0;
+    
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        Transaction* tx = txPoolAt(i);
+        bool included = false;
+        
+        for(int j = 0; j < block->txCount; j++) {
+            if(memcmp(tx->txHash, block->txHashes[j], 32) == 0) {
+                included = true;
+                break;
+            }
+        }
+        
+        if(included) {
+            uint32_t record = appendTxLog(log, tx);
+            if(record != LOC_NONE) {
+                zone->recordCount++;
+                zoneAddTransaction(&zone->zone, tx);
+            }
+            rollupTransaction(tx);
+            relocateTransaction(tx, *txPoolSeqAt(i), record);
+            recordInclusion(tx, *txPoolArrivalAt(i));
+            mempoolStats.committed += tx->readingCount;
+            continue;
+        }
+        
+        if(kept != i) {
+            *txPoolAt(kept) = *tx;
+            *txPoolSeqAt(kept) = *txPoolSeqAt(i);
+            *txPoolArrivalAt(kept) = *txPoolArrivalAt(i);
+        }
+        kept++;
+    }
+    
+    if(log) log.close();
+    
+    uint8_t removed = txPoolCount - kept;
+    txPoolCount = kept;
+    
+    return removed;
+}
+
+// Make room for one reading according to TX_EVICT_POLICY
+bool evictFromTxPool() {
+    uint8_t victim = 0;
+    
+    switch(TX_EVICT_POLICY) {
+        case EVICT_OLDEST:
+            victim = 0;
+            break;
+            
+        case EVICT_LOWEST_QUALITY:
+            for(uint8_t i = 1; i < txPoolCount; i++) {
+                if(txWorstQuality(txPoolAt(i)) < txWorstQuality(txPoolAt(victim))) {
+                    victim = i;
+                }
+            }
+            break;
+            
+        case EVICT_REJECT_NEW:
+        default:
+            return false;
+    }
+    
+    Transaction* tx = txPoolAt(victim);
+    char name[17];
+    sensorIdOf(tx->sensor, name);
+    Serial.printf("⚠️  Pool full, evicted %s @%u (%u readings)\n", 
+                 name, tx->readings[0].timestamp, tx->readingCount);
+    
+    mempoolStats.evicted += tx->readingCount;
+    seenTxErase(tx->txHash);
+    relocateTransaction(tx, *txPoolSeqAt(victim), LOC_NONE);
+    txPoolRemoveAt(victim);
+    return true;
+}
+
+// Copy a transaction that may be a trimmed wire image: only its used readings
+// are read, the rest of the copy is zeroed
+void copyTransaction(Transaction* out, const Transaction* tx) {
+    size_t len = TX_WIRE_SIZE(tx->readingCount <= TX_BATCH_MAX ? tx->readingCount : TX_BATCH_MAX);
+    memcpy(out, tx, len);
+    memset((uint8_t*)out + len, 0, sizeof(Transaction) - len);
+}
+
+bool addToTxPool(const Transaction* tx) {
+    if(tx->readingCount == 0 || tx->readingCount > TX_BATCH_MAX) {
+        Serial.printf("✗ Invalid reading count: %u\n", tx->readingCount);
+        return false;
+    }
+    
+    if(seenTxContains(tx->txHash)) {
+        mempoolStats.duplicates++;
+        return false;
+    }
+    
+    if(txPoolCount >= TX_POOL_SIZE && !evictFromTxPool()) {
+        static unsigned long lastFullLog = 0;
+        mempoolStats.rejected += tx->readingCount;
+        if(millis() - lastFullLog >= 1000) {
+            Serial.println("✗ Transaction pool full");
+            lastFullLog = millis();
+        }
+        return false;
+    }
+    
+    uint32_t seq = txPoolNextSeq++;
+    *txPoolSeqAt(txPoolCount) = seq;
+    *txPoolArrivalAt(txPoolCount) = millis() / 1000;
+    Transaction* pooled = txPoolAt(txPoolCount++);
+    copyTransaction(pooled, tx);
+    seenTxInsert(pooled->txHash);
+    indexTransaction(pooled, true, seq);
+    mempoolStats.accepted += pooled->readingCount;
+    updateSensorStats(pooled);
+    
+    char name[17];
+    sensorIdOf(tx->sensor, name);
+    Serial.printf("✓ TX added to pool: %s (%.1f°C, %u readings)\n", 
+                 name, tx->readings[0].temperature / 100.0f, tx->readingCount);
+    
+    return true;
+}
+
+// Pool position of a transaction by arrival sequence (pool keeps arrival order)
+int txPoolFindSeq(uint32_t seq) {
+    int lo = 0, hi = txPoolCount - 1;
+    
+    while(lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint32_t s = *txPoolSeqAt(mid) & 0x0FFFFFFF;
+        if(s == seq) return mid;
+        if(s < seq) lo = mid + 1; else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Decode an indexed reading; the last transaction read from the log is cached
+bool resolveReading(uint32_t loc, File& log, Transaction* cache, uint32_t* cachedRecord,
+                    TelemetryData* out) {
+    if(loc == LOC_NONE) return false;
+    
+    uint32_t id = (loc & ~LOC_POOL) >> 3;
+    uint8_t r = loc & 0x07;
+    const Transaction* tx;
+    
+    if(loc & LOC_POOL) {
+        int pos = txPoolFindSeq(id);
+        if(pos < 0) return false;
+        tx = txPoolAt(pos);
+    } else {
+        if(*cachedRecord != id) {
+            if(!readTxLog(log, id, cache)) return false;
+            *cachedRecord = id;
+        }
+        tx = cache;
+    }
+    
+    if(r >= tx->readingCount) return false;
+    txReading(tx, r, out);
+    return true;
+}
+
+// Emit one transaction's readings for a sensor within [t0, t1]; false once the sink stops
+bool emitReadings(const Transaction* tx, uint16_t sensor, uint32_t t0, uint32_t t1,
+                  TelemetryCallback cb, void* ctx, uint32_t* count) {
+    if(tx->sensor != sensor) return true;
+    
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        uint32_t ts = tx->readings[r].timestamp;
+        if(ts < t0 || ts > t1) continue;
+        
+        TelemetryData reading;
+        txReading(tx, r, &reading);
+        (*count)++;
+        if(!cb(&reading, ctx)) return false;
+    }
+    return true;
+}
+
+// Scan a run of log records; false once the sink stops
+bool scanLogRecords(File& log, uint32_t first, uint32_t last, uint16_t sensor,
+                    uint32_t t0, uint32_t t1, TelemetryCallback cb, void* ctx, uint32_t* count) {
+    Transaction tx;
+    for(uint32_t record = first; record < last; record++) {
+        lastQueryStats.recordsRead++;
+        if(!readTxLog(log, record, &tx)) continue;
+        if(!emitReadings(&tx, sensor, t0, t1, cb, ctx, count)) return false;
+    }
+    return true;
+}
+
+// History older than the index window: block zones first, then log segments
+bool scanHistory(uint16_t sensor, uint32_t t0, uint32_t t1, bool withPool,
+                 TelemetryCallback cb, void* ctx, uint32_t* count) {
+    File log = openTxLog(FILE_READ);
+    if(!log) return true;
+    
+    uint32_t firstLive = (txLogCount > TX_LOG_SLOTS) ? txLogCount - TX_LOG_SLOTS : 0;
+    
+    // Walk back from the newest block while zones tile the log contiguously
+    uint32_t blocksHeld = (blockCount < MAX_BLOCKS) ? blockCount : MAX_BLOCKS;
+    uint32_t zoned = 0;
+    uint32_t covered = txLogCount;
+    for(; zoned < blocksHeld; zoned++) {
+        uint32_t index = (blockCount - 1 - zoned) % MAX_BLOCKS;
+        BlockZone* bz = &blockZones[index];
+        if(bz->recordCount == 0) {
+            if(blockchain[index].txCount == 0) continue;
+            break;
+        }
+        if(bz->firstRecord < firstLive || bz->firstRecord + bz->recordCount != covered) break;
+        covered = bz->firstRecord;
+    }
+    
+    // Records older than any zoned block, one segment at a time
+    bool more = true;
+    uint32_t record = firstLive;
+    while(more && record < covered) {
+        uint32_t segEnd = (record / ZONE_SEGMENT_RECORDS + 1) * ZONE_SEGMENT_RECORDS;
+        if(segEnd > covered) segEnd = covered;
+        
+        // A segment partly overwritten by newer records has a zone that no longer describes it
+        bool partial = (record % ZONE_SEGMENT_RECORDS) != 0;
+        ZoneMap* zone = &segmentZones[(record / ZONE_SEGMENT_RECORDS) % (TX_LOG_SLOTS / ZONE_SEGMENT_RECORDS)];
+        if(!partial && !zoneMatches(zone, sensor, t0, t1)) {
+            lastQueryStats.segmentsSkipped++;
+        } else {
+            more = scanLogRecords(log, record, segEnd, sensor, t0, t1, cb, ctx, count);
+        }
+        record = segEnd;
+    }
+    
+    // Zoned blocks, oldest first
+    for(uint32_t back = zoned; more && back-- > 0;) {
+        BlockZone* bz = &blockZones[(blockCount - 1 - back) % MAX_BLOCKS];
+        if(bz->recordCount == 0) continue;
+        if(!zoneMatches(&bz->zone, sensor, t0, t1)) {
+            lastQueryStats.blocksSkipped++;
+            continue;
+        }
+        more = scanLogRecords(log, bz->firstRecord, bz->firstRecord + bz->recordCount,
+                              sensor, t0, t1, cb, ctx, count);
+    }
+    
+    log.close();
+    
+    // Pool readings the index has already aged out
+    for(uint8_t i = 0; more && withPool && i < txPoolCount; i++) {
+        more = emitReadings(txPoolAt(i), sensor, t0, t1, cb, ctx, count);
+    }
+    return more;
+}
+
+// Stream a sensor's readings in [startTime, endTime] to cb; returns readings delivered.
+// The index serves its window in O(log n + results); older history is scanned with zone maps.
+// withPool adds readings still waiting for a block to the committed ones.
+uint32_t queryTelemetryData(const char* sensorId, uint32_t startTime, uint32_t endTime, bool withPool,
+                            TelemetryCallback cb, void* ctx) {
+    memset(&lastQueryStats, 0, sizeof(lastQueryStats));
+    uint32_t count = 0;
+    if(startTime > endTime) return 0;
+    
+    uint16_t sensor = lookupSensorHandle(sensorId);
+    SensorIndex* idx = findSensorIndex(sensor, false);
+    uint32_t coveredFrom = (idx != NULL) ? idx->coveredFrom : UINT32_MAX;
+    
+    if(startTime < coveredFrom) {
+        uint32_t historyEnd = (endTime < coveredFrom) ? endTime : coveredFrom - 1;
+        if(!scanHistory(sensor, startTime, historyEnd, withPool, cb, ctx, &count)) return count;
+    }
+    
+    if(idx == NULL || endTime < coveredFrom) return count;
+    
+    File log = openTxLog(FILE_READ);
+    Transaction cache;
+    uint32_t cachedRecord = LOC_NONE;
+    uint32_t from = (startTime > coveredFrom) ? startTime : coveredFrom;
+    
+    for(uint16_t i = indexSearch(idx, from, false); i < idx->count; i++) {
+        IndexEntry* e = indexAt(idx, i);
+        if(e->timestamp > endTime) break;
+        if(!withPool && (e->loc & LOC_POOL)) continue;
+        
+        TelemetryData reading;
+        if(!resolveReading(e->loc, log, &cache, &cachedRecord, &reading)) continue;
+        
+        count++;
+        if(!cb(&reading, ctx)) break;
+    }
+    
+    if(log) log.close();
+    return count;
+}
+
+bool printReading(const TelemetryData* reading, void*) {
+    Serial.printf(" Temp: %.1f°C | Humidity: %.1f%% | Time: %u\n",
+                  reading->temperature,
+                  reading->humidity,
+                  reading->timestamp);
+    return true;
+}
+
+// ==================== ROLLUPS ====================
+
+void rollupStatAdd(RollupStat* stat, int16_t value, bool first) {
+    if(first) {
+        stat->sum = value;
+        stat->min = value;
+        stat->max = value;
+        return;
+    }
+    stat->sum += value;
+    if(value < stat->min) stat->min = value;
+    if(value > stat->max) stat->max = value;
+}
+
+void rollupBucketAdd(RollupBucket* b, const CompactReading* r) {
+    bool first = (b->count == 0);
+    rollupStatAdd(&b->temperature, r->temperature, first);
+    rollupStatAdd(&b->humidity, (int16_t)r->humidity, first);
+    
+    if(first || r->timestamp >= b->lastTs) {
+        b->lastTs = r->timestamp;
+        b->temperature.last = r->temperature;
+        b->humidity.last = (int16_t)r->humidity;
+    }
+    if(b->count < UINT16_MAX) b->count++;
+}
+
+// Fold one bucket (or partial aggregate) into another
+void rollupMerge(RollupBucket* into, const RollupBucket* from) {
+    if(from->count == 0) return;
+    
+    if(into->count == 0) {
+        uint32_t start = into->start;
+        *into = *from;
+        into->start = start;
+        return;
+    }
+    
+    into->temperature.sum += from->temperature.sum;
+    into->humidity.sum += from->humidity.sum;
+    if(from->temperature.min < into->temperature.min) into->temperature.min = from->temperature.min;
+    if(from->temperature.max > into->temperature.max) into->temperature.max = from->temperature.max;
+    if(from->humidity.min < into->humidity.min) into->humidity.min = from->humidity.min;
+    if(from->humidity.max > into->humidity.max) into->humidity.max = from->humidity.max;
+    if(from->lastTs >= into->lastTs) {
+        into->lastTs = from->lastTs;
+        into->temperature.last = from->temperature.last;
+        into->humidity.last = from->humidity.last;
+    }
+    into->count = (into->count + from->count > UINT16_MAX) ? UINT16_MAX : into->count + from->count;
+}
+
+SensorRollup* findSensorRollup(uint16_t sensor, bool create) {
+    for(uint8_t i = 0; i < sensorRollupCount; i++) {
+        if(sensorRollups[i].sensor == sensor) return &sensorRollups[i];
+    }
+    if(!create) return NULL;
+    
+    SensorRollup* roll;
+    if(sensorRollupCount < ROLLUP_SENSORS) {
+        roll = &sensorRollups[sensorRollupCount++];
+    } else {
+        // Recycle the sensor that has been quiet the longest
+        roll = &sensorRollups[0];
+        for(uint8_t i = 1; i < ROLLUP_SENSORS; i++) {
+            if(sensorRollups[i].lastUpdate < roll->lastUpdate) roll = &sensorRollups[i];
+        }
+    }
+    
+    memset(roll, 0, sizeof(SensorRollup));
+    roll->sensor = sensor;
+    return roll;
+}
+
+// Bucket for a level's bucket number, or NULL if it has left the ring
+RollupBucket* rollupBucketAt(SensorRollup* roll, uint8_t level, uint32_t bucketNo) {
+    uint32_t newest = roll->newest[level];
+    if(bucketNo > newest || bucketNo + ROLLUP_DEPTH[level] <= newest) return NULL;
+    
+    return &roll->buckets[ROLLUP_OFFSET[level] + bucketNo % ROLLUP_DEPTH[level]];
+}
+
+inline bool rollupDirty(const SensorRollup* roll, uint16_t slot) {
+    return roll->dirty[slot / 8] & (1 << (slot % 8));
+}
+
+// Called as each committed transaction leaves the pool
+void rollupTransaction(const Transaction* tx) {
+    SensorRollup* roll = findSensorRollup(tx->sensor, true);
+    roll->lastUpdate = millis();
+    
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        const CompactReading* reading = &tx->readings[r];
+        
+        for(uint8_t level = 0; level < ROLLUP_LEVELS; level++) {
+            uint32_t bucketNo = reading->timestamp / ROLLUP_SECONDS[level];
+            uint32_t start = bucketNo * ROLLUP_SECONDS[level];
+            RollupBucket* b = &roll->buckets[ROLLUP_OFFSET[level] + bucketNo % ROLLUP_DEPTH[level]];
+            
+            if(bucketNo > roll->newest[level]) {
+                roll->newest[level] = bucketNo;
+            } else if(bucketNo + ROLLUP_DEPTH[level] <= roll->newest[level]) {
+                if(level == ROLLUP_DAY) rollupLateDrops++;
+                continue;
+            }
+            
+            if(b->start != start) {
+                memset(b, 0, sizeof(RollupBucket));
+                b->start = start;
+                uint16_t slot = b - roll->buckets;
+                roll->dirty[slot / 8] &= ~(1 << (slot % 8));
+            }
+            rollupBucketAdd(b, reading);
+        }
+    }
+}
+
+// A rolled-back reading can't be taken out of a bucket's min/max: flag the
+// buckets that hold it so aggregates read raw readings for them until they recycle
+void rollupUnwind(const Transaction* tx) {
+    SensorRollup* roll = findSensorRollup(tx->sensor, false);
+    if(roll == NULL) return;
+    
+    for(uint8_t r = 0; r < tx->readingCount; r++) {
+        for(uint8_t level = 0; level < ROLLUP_LEVELS; level++) {
+            uint32_t bucketNo = tx->readings[r].timestamp / ROLLUP_SECONDS[level];
+            RollupBucket* b = rollupBucketAt(roll, level, bucketNo);
+            if(b == NULL || b->start != bucketNo * ROLLUP_SECONDS[level]) continue;
+            
+            uint16_t slot = b - roll->buckets;
+            roll->dirty[slot / 8] |= 1 << (slot % 8);
+        }
+    }
+}
+
+bool rollupRawReading(const TelemetryData* reading, void* ctx) {
+    CompactReading compact;
+    encodeReading(reading, &compact);
+    rollupBucketAdd((RollupBucket*)ctx, &compact);
+    return true;
+}
+
+// Aggregate committed readings in [startTime, endTime] from the coarsest buckets
+// that fit, scanning raw readings only for the edges and anything outside the
+// retained rollups. Returns the number of rollup buckets used.
+uint16_t aggregateTelemetry(const char* sensorId, uint32_t startTime, uint32_t endTime,
+                            RollupBucket* out) {
+    memset(out, 0, sizeof(RollupBucket));
+    out->start = startTime;
+    if(startTime > endTime) return 0;
+    
+    SensorRollup* roll = findSensorRollup(lookupSensorHandle(sensorId), false);
+    uint16_t used = 0;
+    uint64_t t = startTime;
+    
+    while(t <= endTime) {
+        // Coarsest retained bucket starting at t that ends within the range
+        int8_t chosen = -1;
+        for(int8_t level = ROLLUP_LEVELS - 1; roll != NULL && level >= 0; level--) {
+            uint32_t len = ROLLUP_SECONDS[level];
+            if(t % len != 0 || t + len - 1 > endTime) continue;
+            RollupBucket* b = rollupBucketAt(roll, level, t / len);
+            if(b != NULL && !rollupDirty(roll, b - roll->buckets)) {
+                chosen = level;
+                break;
+            }
+        }
+        
+        if(chosen >= 0) {
+            uint32_t bucketNo = t / ROLLUP_SECONDS[chosen];
+            RollupBucket* b = rollupBucketAt(roll, chosen, bucketNo);
+            if(b->start == bucketNo * ROLLUP_SECONDS[chosen]) rollupMerge(out, b);
+            used++;
+            t += ROLLUP_SECONDS[chosen];
+            continue;
+        }
+        
+        // Raw readings up to the next boundary where some retained bucket begins
+        uint64_t next = (uint64_t)endTime + 1;
+        for(uint8_t level = 0; roll != NULL && level < ROLLUP_LEVELS; level++) {
+            uint32_t len = ROLLUP_SECONDS[level];
+            uint64_t oldest = (roll->newest[level] + 1 > ROLLUP_DEPTH[level]) ?
+                              (uint64_t)(roll->newest[level] + 1 - ROLLUP_DEPTH[level]) * len : 0;
+            uint64_t boundary = (t / len + 1) * len;
+            if(boundary < oldest) boundary = oldest;
+            if(boundary <= (uint64_t)roll->newest[level] * len && boundary < next) next = boundary;
+        }
+        
+        // Committed readings only: the buckets never hold pool readings either
+        queryTelemetryData(sensorId, (uint32_t)t, (uint32_t)(next - 1), false, rollupRawReading, out);
+        t = next;
+    }
+    
+    return used;
+}
+
+void printAggregate(const char* sensorId, uint32_t startTime, uint32_t endTime) {
+    RollupBucket agg;
+    uint16_t used = aggregateTelemetry(sensorId, startTime, endTime, &agg);
+    
+    Serial.printf("\n=== Telemetry Aggregate: %s [%u-%u] ===\n", sensorId, startTime, endTime);
+    if(agg.count == 0) {
+        Serial.printf("No readings (%u rollup buckets)\n\n", used);
+        return;
+    }
+    
+    Serial.printf(" Temp: avg %.2f°C | min %.2f | max %.2f | last %.2f\n",
+                  agg.temperature.sum / 100.0f / agg.count,
+                  agg.temperature.min / 100.0f, agg.temperature.max / 100.0f,
+                  agg.temperature.last / 100.0f);
+    Serial.printf(" Humidity: avg %.1f%% | min %.1f | max %.1f | last %.1f\n",
+                  agg.humidity.sum / 10.0f / agg.count,
+                  agg.humidity.min / 10.0f, agg.humidity.max / 10.0f,
+                  agg.humidity.last / 10.0f);
+    Serial.printf("%u readings from %u rollup buckets\n\n", agg.count, used);
+}
+
+// ==================== SERIAL COMMANDS ====================
+
+void sendFrame(uint8_t type, const uint8_t* payload, uint16_t len) {
+    uint8_t head[4] = {FRAME_START, type, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)};
+    uint8_t check = head[1] ^ head[2] ^ head[3];
+    for(uint16_t i = 0; i < len; i++) check ^= payload[i];
+    
+    Serial.write(head, sizeof(head));
+    Serial.write(payload, len);
+    Serial.write(check);
+}
+
+void commandError(const char* msg) {
+    if(binaryFraming) {
+        sendFrame(FRAME_ERROR, (const uint8_t*)msg, strlen(msg));
+    } else {
+        Serial.printf("✗ %s\n", msg);
+    }
+}
+
+void streamEnd() {
+    if(binaryFraming) {
+        sendFrame(FRAME_END, (const uint8_t*)&streamJob.sent, sizeof(streamJob.sent));
+    } else if(streamJob.kind == STREAM_FILES) {
+        Serial.println();
+    } else {
+        Serial.printf("Found %u %s\n\n", streamJob.sent,
+                      (streamJob.kind == STREAM_READINGS) ? "readings" : "aggregates");
+    }
+    if(streamJob.dir) streamJob.dir.close();
+    streamJob.kind = STREAM_IDLE;
+}
+
+// Keep the capacity earliest readings of a scan, in timestamp order
+bool collectEarliest(const TelemetryData* reading, void* ctx) {
+    ReadingCollector* c = (ReadingCollector*)ctx;
+    if(c->skip > 0 && reading->timestamp == c->skipTs) {
+        c->skip--;
+        return true;
+    }
+    uint8_t n = c->count;
+    
+    if(n == c->capacity) {
+        if(reading->timestamp >= c->buf[n - 1].timestamp) return true;
+        n--;
+    }
+    
+    uint8_t pos = n;
+    while(pos > 0 && c->buf[pos - 1].timestamp > reading->timestamp) {
+        c->buf[pos] = c->buf[pos - 1];
+        pos--;
+    }
+    c->buf[pos] = *reading;
+    c->count = n + 1;
+    return true;
+}
+
+// Gather the earliest readings at or after (cursor, skip) and return the next cursor.
+// Readings sharing a second keep their scan order, which a commit between chunks
+// leaves alone (index entries are relocated in place). *skip counts those at the
+// returned second already collected, so a second holding more than a chunk is
+// resumed rather than cut short.
+uint32_t collectChunk(const char* sensorId, uint32_t cursor, uint16_t* skip, uint32_t endTime,
+                      TelemetryData* buf, uint8_t capacity, uint8_t* count, bool* last) {
+    ReadingCollector c = {buf, capacity, 0, cursor, *skip};
+    queryTelemetryData(sensorId, cursor, endTime, true, collectEarliest, &c);
+    *count = c.count;
+    *last = false;
+    
+    if(c.count < capacity) {
+        *last = true;
+        *skip = 0;
+        return endTime;
+    }
+    
+    uint32_t lastTs = buf[capacity - 1].timestamp;
+    uint16_t atLast = (lastTs == cursor) ? *skip : 0;
+    for(uint8_t i = 0; i < capacity; i++) {
+        if(buf[i].timestamp == lastTs) atLast++;
+    }
+    *skip = atLast;
+    return lastTs;
+}
+
+void refillReadings() {
+    streamJob.pendingPos = 0;
+    streamJob.cursor = collectChunk(streamJob.sensorId, streamJob.cursor, &streamJob.cursorSkip,
+                                    streamJob.endTime, streamJob.pending, STREAM_CHUNK,
+                                    &streamJob.pendingCount, &streamJob.lastChunk);
+}
+
+void emitReading(const TelemetryData* reading) {
+    if(binaryFraming) {
+        CompactReading compact;
+        encodeReading(reading, &compact);
+        sendFrame(FRAME_READING, (const uint8_t*)&compact, sizeof(compact));
+    } else {
+        printReading(reading, NULL);
+    }
+}
+
+void emitAggregate(const RollupBucket* agg, uint32_t endTime) {
+    if(binaryFraming) {
+        sendFrame(FRAME_AGGREGATE, (const uint8_t*)agg, sizeof(RollupBucket));
+        return;
+    }
+    Serial.printf(" [%u-%u] n=%u | Temp avg %.2f min %.2f max %.2f | Hum avg %.1f min %.1f max %.1f\n",
+                  agg->start, endTime, agg->count,
+                  agg->temperature.sum / 100.0f / agg->count,
+                  agg->temperature.min / 100.0f, agg->temperature.max / 100.0f,
+                  agg->humidity.sum / 10.0f / agg->count,
+                  agg->humidity.min / 10.0f, agg->humidity.max / 10.0f);
+}
+
+// Emit what the UART can take right now; called every loop()
+void streamTask() {
+    if(streamJob.kind == STREAM_IDLE || streamJob.paused) return;
+    
+    while(Serial.availableForWrite() >= STREAM_MIN_WRITE) {
+        switch(streamJob.kind) {
+            case STREAM_READINGS:
+                if(streamJob.pendingPos == streamJob.pendingCount) {
+                    if(streamJob.lastChunk) {
+                        streamEnd();
+                        return;
+                    }
+                    refillReadings();
+                    continue;
+                }
+                emitReading(&streamJob.pending[streamJob.pendingPos++]);
+                streamJob.sent++;
+                break;
+                
+            case STREAM_AGGREGATES: {
+                uint32_t bucketEnd = streamJob.endTime;
+                if(streamJob.step > 0 && streamJob.cursor + (uint64_t)streamJob.step - 1 < bucketEnd) {
+                    bucketEnd = streamJob.cursor + streamJob.step - 1;
+                }
+                
+                RollupBucket agg;
+                aggregateTelemetry(streamJob.sensorId, streamJob.cursor, bucketEnd, &agg);
+                if(agg.count > 0) {
+                    emitAggregate(&agg, bucketEnd);
+                    streamJob.sent++;
+                }
+                
+                if(bucketEnd >= streamJob.endTime) {
+                    streamEnd();
+                    return;
+                }
+                streamJob.cursor = bucketEnd + 1;
+                if(agg.count == 0) return;  // Empty spans: one per pass
+                break;
+            }
+                
+            case STREAM_FILES: {
+                File file = streamJob.dir.openNextFile();
+                if(!file) {
+                    streamEnd();
+                    return;
+                }
+                Serial.printf("  %s (%u bytes)\n", file.name(), file.size());
+                streamJob.sent++;
+                break;
+            }
+                
+            default:
+                return;
+        }
+    }
+}
+
+// query <sensor|self> <t0> <t1> [minute|hour|day|total]
+void startQuery(char* args) {
+    char* sensor = strtok(args, " ");
+    char* t0 = strtok(NULL, " ");
+    char* t1 = strtok(NULL, " ");
+    char* agg = strtok(NULL, " ");
+    
+    if(sensor == NULL) {
+        commandError("usage: query <sensor|self> [t0] [t1] [minute|hour|day|total]");
+        return;
+    }
+    
+    memset(&streamJob.sensorId, 0, sizeof(streamJob.sensorId));
+    if(strcmp(sensor, "self") == 0) {
+        snprintf(streamJob.sensorId, sizeof(streamJob.sensorId), "ESP_%s", myAddress + 9);
+    } else {
+        strncpy(streamJob.sensorId, sensor, sizeof(streamJob.sensorId) - 1);
+    }
+    
+    streamJob.cursor = t0 ? strtoul(t0, NULL, 10) : 0;
+    streamJob.cursorSkip = 0;
+    streamJob.endTime = t1 ? strtoul(t1, NULL, 10) : UINT32_MAX;
+    if(streamJob.cursor > streamJob.endTime) {
+        commandError("t0 is after t1");
+        return;
+    }
+    
+    streamJob.kind = STREAM_READINGS;
+    if(agg != NULL) {
+        streamJob.kind = STREAM_AGGREGATES;
+        if(strcmp(agg, "minute") == 0) streamJob.step = ROLLUP_SECONDS[ROLLUP_MINUTE];
+        else if(strcmp(agg, "hour") == 0) streamJob.step = ROLLUP_SECONDS[ROLLUP_HOUR];
+        else if(strcmp(agg, "day") == 0) streamJob.step = ROLLUP_SECONDS[ROLLUP_DAY];
+        else if(strcmp(agg, "total") == 0) streamJob.step = 0;
+        else {
+            commandError("aggregate must be minute, hour, day or total");
+            streamJob.kind = STREAM_IDLE;
+            return;
+        }
+        
+        // Bucketed output stops at the present and starts on a bucket boundary
+        uint32_t now = millis() / 1000;
+        if(streamJob.step > 0) {
+            if(streamJob.endTime > now) streamJob.endTime = now;
+            streamJob.cursor -= streamJob.cursor % streamJob.step;
+        }
+    }
+    
+    streamJob.paused = false;
+    streamJob.lastChunk = false;
+    streamJob.sent = 0;
+    streamJob.pendingCount = 0;
+    streamJob.pendingPos = 0;
+    
+    if(!binaryFraming) {
+        Serial.printf("\n=== Telemetry Query: %s [%u-%u] ===\n",
+                      streamJob.sensorId, streamJob.cursor, streamJob.endTime);
+    }
+}
+
+// block <height>
+void printBlockAt(char* args) {
+    char* arg = strtok(args, " ");
+    if(arg == NULL) {
+        commandError("usage: block <height>");
+        return;
+    }
+    
+    uint32_t height = strtoul(arg, NULL, 10);
+    if(height >= blockCount || blockCount - height > MAX_BLOCKS || height < chainBase) {
+        commandError("block not held in memory");
+        return;
+    }
+    
+    Block* block = &blockchain[height % MAX_BLOCKS];
+    if(binaryFraming) {
+        sendFrame(FRAME_BLOCK, (const uint8_t*)block, sizeof(Block));
+        return;
+    }
+    
+    char hex[65];
+    Serial.printf("\n=== Block #%u ===\n", block->index);
+    Serial.printf(" Time: %u | Validator: %s | TX: %u\n",
+                  block->timestamp, block->validator, block->txCount);
+    bin2hex(block->blockHash, 32, hex);
+    Serial.printf(" Hash: %s\n", hex);
+    bin2hex(block->previousHash, 32, hex);
+    Serial.printf(" Prev: %s\n", hex);
+    for(uint8_t i = 0; i < block->txCount && i < MAX_TX_PER_BLOCK; i++) {
+        bin2hex(block->txHashes[i], 32, hex);
+        Serial.printf("  tx %2u: %s\n", i, hex);
+    }
+    Serial.println();
+}
+
+void printCommandHelp() {
+    Serial.println("\n=== Commands ===");
+    Serial.println("query <sensor|self> [t0] [t1] [minute|hour|day|total] - Stream readings or aggregates");
+    Serial.println("rquery <sensor|self> [t0] [t1] - Ask an archive/validator over ESP-NOW");
+    Serial.println("quantiles <sensor|self> - Pull neighbors' quantile sketches for a sensor");
+    Serial.println("block <height>  - Show a block");
+    Serial.println("stats           - Node status");
+    Serial.println("peers           - Known peers (RSSI, last seen, traffic)");
+    Serial.println("files           - List SPIFFS files");
+    Serial.println("binary on|off   - Framed binary output for queries");
+    Serial.println("stop            - Abort the running stream (XOFF/XON pause and resume)");
+    Serial.println("role validator|sensor|archive - Change role");
+    Serial.println("save            - Write/save now");
+    Serial.println("clear           - Clear storage");
+    Serial.println("? / help        - Show this help");
+    Serial.println("Single letters V S A C L W still work");
+}
+
+void executeCommand(char* line) {
+    char* args = line;
+    while(*args && *args != ' ') args++;
+    if(*args) *args++ = '\0';
+    while(*args == ' ') args++;
+    
+    const char* cmd = line;
+    const char* role = args;
+    
+    // Single-letter shortcuts from the original console
+    if(line[0] != '\0' && line[1] == '\0') {
+        switch(line[0]) {
+            case 'v': case 'V': cmd = "role"; role = "validator"; break;
+            case 's': case 'S': cmd = "role"; role = "sensor"; break;
+            case 'a': case 'A': cmd = "role"; role = "archive"; break;
+            case 'c': case 'C': cmd = "clear"; break;
+            case 'l': case 'L': cmd = "files"; break;
+            case 'w': case 'W': cmd = "save"; break;
+        }
+    }
+    
+    // A new command supersedes any stream still running
+    if(streamJob.kind != STREAM_IDLE) streamEnd();
+    if(strcmp(cmd, "stop") == 0) return;
+    
+    if(strcmp(cmd, "query") == 0) {
+        startQuery(args);
+    } else if(strcmp(cmd, "rquery") == 0) {
+        char* sensor = strtok(args, " ");
+        char* t0 = strtok(NULL, " ");
+        char* t1 = strtok(NULL, " ");
+        if(sensor == NULL) {
+            commandError("usage: rquery <sensor|self> [t0] [t1]");
+            return;
+        }
+        
+        char sensorId[20];
+        if(strcmp(sensor, "self") == 0) {
+            snprintf(sensorId, sizeof(sensorId), "ESP_%s", myAddress + 9);
+        } else {
+            snprintf(sensorId, sizeof(sensorId), "%s", sensor);
+        }
+        startRemoteQuery(sensorId, t0 ? strtoul(t0, NULL, 10) : 0,
+                         t1 ? strtoul(t1, NULL, 10) : UINT32_MAX);
+    } else if(strcmp(cmd, "quantiles") == 0) {
+        char* sensor = strtok(args, " ");
+        if(sensor == NULL) {
+            commandError("usage: quantiles <sensor|self>");
+            return;
+        }
+        
+        char sensorId[20];
+        if(strcmp(sensor, "self") == 0) {
+            snprintf(sensorId, sizeof(sensorId), "ESP_%s", myAddress + 9);
+        } else {
+            snprintf(sensorId, sizeof(sensorId), "%s", sensor);
+        }
+        startSketchQuery(sensorId);
+    } else if(strcmp(cmd, "block") == 0) {
+        printBlockAt(args);
+    } else if(strcmp(cmd, "stats") == 0) {
+        printStatus();
+    } else if(strcmp(cmd, "peers") == 0) {
+        printPeers();
+    } else if(strcmp(cmd, "files") == 0) {
+        if(!spiffsInitialized) return;
+        Serial.println("\n📂 SPIFFS Files:");
+        streamJob.dir = SPIFFS.open("/");
+        streamJob.kind = STREAM_FILES;
+        streamJob.paused = false;
+        streamJob.sent = 0;
+    } else if(strcmp(cmd, "binary") == 0) {
+        binaryFraming = (strcmp(args, "on") == 0);
+        Serial.printf("✓ Binary framing %s\n", binaryFraming ? "on" : "off");
+    } else if(strcmp(cmd, "role") == 0) {
+        if(strcmp(role, "validator") == 0) {
+            MY_ROLE = VALIDATOR_NODE;
+            Serial.println("\n✓ Role changed to: VALIDATOR");
+        } else if(strcmp(role, "sensor") == 0) {
+            MY_ROLE = SENSOR_NODE;
+            Serial.println("\n✓ Role changed to: SENSOR");
+        } else if(strcmp(role, "archive") == 0) {
+            MY_ROLE = ARCHIVE_NODE;
+            Serial.println("\n✓ Role changed to: ARCHIVE");
+        } else {
+            commandError("usage: role validator|sensor|archive");
+        }
+    } else if(strcmp(cmd, "save") == 0) {
+        Serial.println("\n💾 Manual save triggered");
+        saveBlockchain();
+        saveTxPool();
+        saveSensorRegistry();
+    } else if(strcmp(cmd, "clear") == 0) {
+        clearStorage();
+    } else if(strcmp(cmd, "?") == 0 || strcmp(cmd, "help") == 0) {
+        printCommandHelp();
+    } else if(cmd[0] != '\0') {
+        commandError("unknown command, ? for help");
+    }
+}
+
+// Non-blocking: consume whatever has arrived and run each complete line
+void serialCommandTask() {
+    while(Serial.available() > 0) {
+        char c = Serial.read();
+        
+        if(c == 0x13) {             // XOFF
+            streamJob.paused = true;
+        } else if(c == 0x11) {      // XON
+            streamJob.paused = false;
+        } else if(c == '\n' || c == '\r') {
+            if(cmdLineOverflow) {
+                commandError("command line too long");
+            } else if(cmdLineLen > 0) {
+                cmdLine[cmdLineLen] = '\0';
+                executeCommand(cmdLine);
+            }
+            cmdLineLen = 0;
+            cmdLineOverflow = false;
+        } else if(cmdLineLen < CMD_LINE_MAX - 1) {
+            cmdLine[cmdLineLen++] = c;
+        } else {
+            cmdLineOverflow = true;
+        }
+    }
+    
+    streamTask();
+}
+
+// ==================== RADIO ====================
+// The link layer under the transport. Backends hand received frames to
+// onDataReceived() and report each send through radioSendDone().
+// Both may run in the WiFi task, so they only queue; loop() does the rest.
+// Polled backends already run in loop() and pass frames to handleFrame().
+
+struct RadioOps {
+    const char* name;
+    bool (*begin)();            // Called once myMac is known
+    esp_err_t (*send)(const uint8_t* mac, const uint8_t* data, size_t len);
+    esp_err_t (*addPeer)(const uint8_t* mac);
+    void (*removePeer)(const uint8_t* mac);
+    void (*poll)();             // Receive pending frames; NULL if the radio calls us
+};
+
+// May run in the WiFi task: only record the result, transportTask() acts on it
+void radioSendDone(const uint8_t* mac, bool ok) {
+    uint8_t next = (txDoneHead + 1) % 8;
+    if(next == txDoneTail) return;      // Lost; the frame times out instead
+    memcpy(txDone[txDoneHead].mac, mac, 6);
+    txDone[txDoneHead].ok = ok;
+    __sync_synchronize();
+    txDoneHead = next;
+}
+
+// May run in the WiFi task: copy the frame out, receiveTask() handles it
+void onDataReceived(const uint8_t* mac, const uint8_t* data, int len, int8_t rssi) {
+    if(len <= 0 || len > ESPNOW_MAX_FRAME) return;
+    
+    uint8_t next = (rxHead + 1) % RX_QUEUE_DEPTH;
+    if(next == rxTail) {
+        admissionStats.rxOverflow++;
+        return;
+    }
+    RxFrame* frame = &rxQueue[rxHead];
+    memcpy(frame->mac, mac, 6);
+    frame->rssi = rssi;
+    frame->len = len;
+    memcpy(frame->data, data, len);
+    __sync_synchronize();       // Frame contents land before loop() can see the slot
+    rxHead = next;
+}
+
+#if RADIO_BACKEND == RADIO_ESPNOW
+
+// IDF 5.5 passes the send info; before that only the destination MAC
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 5, 0)
+void onEspNowSent(const esp_now_send_info_t* info, esp_now_send_status_t status) {
+    radioSendDone(info->des_addr, status == ESP_NOW_SEND_SUCCESS);
+}
+#else
+void onEspNowSent(const uint8_t* mac, esp_now_send_status_t status) {
+    radioSendDone(mac, status == ESP_NOW_SEND_SUCCESS);
+}
+#endif
+
+// Arduino-ESP32 3.x passes the receive info (sender and RSSI); 2.x only the MAC
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+void onEspNowReceive(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+    onDataReceived(info->src_addr, data, len, info->rx_ctrl ? info->rx_ctrl->rssi : 0);
+}
+#else
+void onEspNowReceive(const uint8_t* mac, const uint8_t* data, int len) {
+    onDataReceived(mac, data, len, 0);
+}
+#endif
+
+bool espNowBegin() {
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    if(esp_now_init() != ESP_OK) return false;
+    
+    esp_now_register_recv_cb(onEspNowReceive);
+    esp_now_register_send_cb(onEspNowSent);
+    return true;
+}
+
+esp_err_t espNowAddPeer(const uint8_t* mac) {
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, mac, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    
+    esp_err_t result = esp_now_add_peer(&peerInfo);
+    return (result == ESP_ERR_ESPNOW_EXIST) ? ESP_OK : result;
+}
+
+void espNowRemovePeer(const uint8_t* mac) {
+    esp_now_del_peer(mac);
+}
+
+const RadioOps radio = {"ESP-NOW", espNowBegin, esp_now_send, espNowAddPeer, espNowRemovePeer, NULL};
+
+#elif RADIO_BACKEND == RADIO_SIM
+
+// The medium (range, loss, latency) lives in the host program, which runs many
+// nodes in one process; see sim_air.h
+extern "C" {
+    bool simAirAttach(const uint8_t* mac, void (*rx)(const uint8_t*, const uint8_t*, int, int8_t),
+                      void (*done)(const uint8_t*, bool));
+    int simAirSend(const uint8_t* from, const uint8_t* to, const uint8_t* data, size_t len,
+                   unsigned long now);
+    void simAirPoll(const uint8_t* mac, unsigned long now);
+}
+
+bool simRadioBegin() {
+    return simAirAttach(myMac, handleFrame, radioSendDone);
+}
+
+esp_err_t simRadioSend(const uint8_t* mac, const uint8_t* data, size_t len) {
+    return (simAirSend(myMac, mac, data, len, millis()) == 0) ? ESP_OK : ESP_ERR_ESPNOW_NO_MEM;
+}
+
+esp_err_t simRadioAddPeer(const uint8_t*) {
+    return ESP_OK;
+}
+
+void simRadioRemovePeer(const uint8_t*) {
+}
+
+void simRadioPoll() {
+    simAirPoll(myMac, millis());
+}
+
+const RadioOps radio = {"simulated air", simRadioBegin, simRadioSend, simRadioAddPeer, simRadioRemovePeer, simRadioPoll};
+
+#elif RADIO_BACKEND == RADIO_UDP
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Datagram: destination MAC, source MAC, then the frame as ESP-NOW would carry
+// it. Every node joins one group and keeps what is broadcast or addressed to it.
+int udpRadioSocket = -1;
+struct sockaddr_in udpRadioGroup;
+
+bool udpRadioBegin() {
+    udpRadioSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(udpRadioSocket < 0) return false;
+    
+    int on = 1;
+    setsockopt(udpRadioSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(udpRadioSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+    
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(UDP_RADIO_PORT);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(udpRadioSocket, (struct sockaddr*)&local, sizeof(local)) < 0) return false;
+    
+    struct ip_mreq group = {};
+    group.imr_multiaddr.s_addr = inet_addr(UDP_RADIO_GROUP);
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    if(setsockopt(udpRadioSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) return false;
+    
+    uint8_t loop = 1;           // Nodes on the same host hear each other
+    setsockopt(udpRadioSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    fcntl(udpRadioSocket, F_SETFL, fcntl(udpRadioSocket, F_GETFL, 0) | O_NONBLOCK);
+    
+    udpRadioGroup = {};
+    udpRadioGroup.sin_family = AF_INET;
+    udpRadioGroup.sin_port = htons(UDP_RADIO_PORT);
+    udpRadioGroup.sin_addr.s_addr = inet_addr(UDP_RADIO_GROUP);
+    return true;
+}
+
+// UDP has no link-layer acknowledgement: a frame that left the socket counts as delivered
+esp_err_t udpRadioSend(const uint8_t* mac, const uint8_t* data, size_t len) {
+    if(len > ESPNOW_MAX_FRAME) return ESP_FAIL;
+    
+    uint8_t datagram[12 + ESPNOW_MAX_FRAME];
+    memcpy(datagram, mac, 6);
+    memcpy(datagram + 6, myMac, 6);
+    memcpy(datagram + 12, data, len);
+    if(sendto(udpRadioSocket, datagram, 12 + len, 0,
+              (struct sockaddr*)&udpRadioGroup, sizeof(udpRadioGroup)) < 0) {
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+    radioSendDone(mac, true);
+    return ESP_OK;
+}
+
+esp_err_t udpRadioAddPeer(const uint8_t*) {
+    return ESP_OK;
+}
+
+void udpRadioRemovePeer(const uint8_t*) {
+}
+
+void udpRadioPoll() {
+    uint8_t datagram[12 + ESPNOW_MAX_FRAME];
+    
+    while(true) {
+        ssize_t n = recv(udpRadioSocket, datagram, sizeof(datagram), 0);
+        if(n < 0) break;
+        if(n < 12 || memcmp(datagram + 6, myMac, 6) == 0) continue;
+        if(!(datagram[0] & 0x01) && memcmp(datagram, myMac, 6) != 0) continue;
+        handleFrame(datagram + 6, datagram + 12, n - 12, 0);
+    }
+}
+
+const RadioOps radio = {"UDP multicast", udpRadioBegin, udpRadioSend, udpRadioAddPeer, udpRadioRemovePeer, udpRadioPoll};
+
+#endif
+
+// ==================== PEER TABLE ====================
+
+uint16_t peerHome(const uint8_t* mac) {
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < 6; i++) {
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+    return hash & (PEER_TABLE_SLOTS - 1);
+}
+
+// Slot holding the MAC, or the empty slot that ends its probe sequence
+uint16_t peerSlot(const uint8_t* mac) {
+    uint16_t i = peerHome(mac);
+    
+    while(peerTable[i].used && memcmp(peerTable[i].mac, mac, 6) != 0) {
+        i = (i + 1) & (PEER_TABLE_SLOTS - 1);
+    }
+    return i;
+}
+
+void unregisterPeer(PeerEntry* peer) {
+    if(!peer->registered) return;
+    radio.removePeer(peer->mac);
+    peer->registered = false;
+    espNowPeerCount--;
+}
+
+// Backward-shift deletion, as in seenTxErase
+void erasePeerSlot(uint16_t i) {
+    unregisterPeer(&peerTable[i]);
+    
+    uint16_t j = i;
+    while(true) {
+        j = (j + 1) & (PEER_TABLE_SLOTS - 1);
+        if(!peerTable[j].used) break;
+        
+        uint16_t home = peerHome(peerTable[j].mac);
+        bool movable = (i <= j) ? (home <= i || home > j)
+                                : (home <= i && home > j);
+        if(movable) {
+            peerTable[i] = peerTable[j];
+            i = j;
+        }
+    }
+    
+    memset(&peerTable[i], 0, sizeof(PeerEntry));
+    peerCount--;
+}
+
+// Look up a peer; with create, add it (evicting the least recently seen when full)
+PeerEntry* findPeer(const uint8_t* mac, bool create) {
+    uint16_t i = peerSlot(mac);
+    if(peerTable[i].used) return &peerTable[i];
+    if(!create) return NULL;
+    
+    if(peerCount >= PEER_TABLE_MAX) {
+        uint16_t oldest = 0;
+        unsigned long now = millis();
+        for(uint16_t s = 0; s < PEER_TABLE_SLOTS; s++) {
+            if(peerTable[s].used &&
+               (!peerTable[oldest].used || now - peerTable[s].lastSeen > now - peerTable[oldest].lastSeen)) {
+                oldest = s;
+            }
+        }
+        erasePeerSlot(oldest);
+        peersEvicted++;
+        i = peerSlot(mac);
+    }
+    
+    PeerEntry* peer = &peerTable[i];
+    memset(peer, 0, sizeof(PeerEntry));
+    memcpy(peer->mac, mac, 6);
+    peer->used = true;
+    peer->firstSeen = millis();
+    peer->lastSeen = peer->firstSeen;
+    peer->frameTokens = RX_FRAME_BURST * 1000UL;
+    peer->txTokens = RX_TX_BURST * 1000UL;
+    peer->lastRefill = peer->firstSeen;
+    peerCount++;
+    return peer;
+}
+
+// Record a received frame
+void touchPeer(PeerEntry* peer, int len, int8_t rssi) {
+    peer->lastSeen = millis();
+    peer->rxFrames++;
+    peer->rxBytes += len;
+    
+    if(rssi != 0) {
+        peer->rssiAvg = (peer->rssi == 0) ? rssi : peer->rssiAvg + (rssi - peer->rssiAvg) / 8;
+        peer->rssi = rssi;
+    }
+}
+
+// ==================== ADMISSION CONTROL ====================
+// Runs on every received frame before it is decoded, so it only touches the
+// peer entry: no copies, no hashing beyond the MAC lookup.
+
+bool peerBanned(const PeerEntry* peer) {
+    return peer->bannedUntil != 0 && (long)(millis() - peer->bannedUntil) < 0;
+}
+
+void misbehave(PeerEntry* peer, uint8_t points, const char* why) {
+    if(peer == NULL || peerBanned(peer)) return;
+    
+    peer->misbehavior = (peer->misbehavior + points > 255) ? 255 : peer->misbehavior + points;
+    if(peer->misbehavior < BAN_SCORE) return;
+    
+    peer->bannedUntil = millis() + BAN_MS;
+    if(peer->bannedUntil == 0) peer->bannedUntil = 1;
+    peer->misbehavior = 0;
+    admissionStats.bans++;
+    Serial.printf("⚠️  Ignoring %02X:%02X:%02X:%02X:%02X:%02X for %us (%s)\n",
+                 peer->mac[0], peer->mac[1], peer->mac[2], peer->mac[3], peer->mac[4], peer->mac[5],
+                 BAN_MS / 1000, why);
+}
+
+void refillTokens(PeerEntry* peer) {
+    unsigned long now = millis();
+    unsigned long elapsed = now - peer->lastRefill;
+    if(elapsed == 0) return;
+    peer->lastRefill = now;
+    
+    // A token per second per unit of rate = rate tokens per ms in 1/1000 units
+    if(elapsed > 60000) elapsed = 60000;
+    uint32_t frames = peer->frameTokens + elapsed * RX_FRAME_RATE;
+    uint32_t txs = peer->txTokens + elapsed * RX_TX_RATE;
+    peer->frameTokens = (frames < RX_FRAME_BURST * 1000UL) ? frames : RX_FRAME_BURST * 1000UL;
+    peer->txTokens = (txs < RX_TX_BURST * 1000UL) ? txs : RX_TX_BURST * 1000UL;
+}
+
+// Whole-frame check: banned senders and frame floods stop here
+bool admitFrame(PeerEntry* peer) {
+    if(peerBanned(peer)) {
+        peer->rxRefused++;
+        admissionStats.ignored++;
+        return false;
+    }
+    
+    refillTokens(peer);
+    if(peer->frameTokens < 1000) {
+        peer->rxRefused++;
+        admissionStats.rateLimited++;
+        misbehave(peer, 1, "frame flood");
+        return false;
+    }
+    peer->frameTokens -= 1000;
+    return true;
+}
+
+// Per-record check, from the type byte alone
+bool admitRecord(PeerEntry* peer, uint8_t type) {
+    if(type >= MSG_TYPES || type == MSG_BUNDLE) {
+        admissionStats.malformed++;
+        misbehave(peer, 10, "unknown message type");
+        return false;
+    }
+    if(type != MSG_NEW_TELEMETRY) return true;
+    
+    if(peer->txTokens < 1000) {
+        peer->rxRefused++;
+        admissionStats.rateLimited++;
+        misbehave(peer, 5, "telemetry flood");
+        return false;
+    }
+    peer->txTokens -= 1000;
+    return true;
+}
+
+// One sensor may not crowd everyone else out of the pool
+bool overPoolShare(uint16_t sensor) {
+    uint8_t held = 0;
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        if(txPoolAt(i)->sensor == sensor && ++held >= POOL_SENSOR_SHARE) return true;
+    }
+    return false;
+}
+
+// Add to the radio's unicast list, dropping the least recently used peer at the limit
+bool registerPeer(PeerEntry* peer) {
+    if(peer->registered) return true;
+    
+    if(espNowPeerCount >= ESPNOW_PEER_LIMIT) {
+        PeerEntry* idle = NULL;
+        unsigned long now = millis();
+        for(uint16_t s = 0; s < PEER_TABLE_SLOTS; s++) {
+            PeerEntry* p = &peerTable[s];
+            if(p->used && p->registered &&
+               (idle == NULL || now - p->lastUnicast > now - idle->lastUnicast)) {
+                idle = p;
+            }
+        }
+        if(idle) unregisterPeer(idle);
+    }
+    
+    esp_err_t result = radio.addPeer(peer->mac);
+    if(result != ESP_OK) {
+        Serial.printf("✗ Failed to add peer: %d\n", result);
+        return false;
+    }
+    peer->registered = true;
+    espNowPeerCount++;
+    return true;
+}
+
+// Forget peers that have gone quiet so consensus only counts live nodes
+void peerMaintenanceTask() {
+    unsigned long now = millis();
+    if(now - lastPeerMaintenance < PEER_MAINTENANCE_MS) return;
+    lastPeerMaintenance = now;
+    
+    uint16_t s = 0;
+    while(s < PEER_TABLE_SLOTS) {
+        // Erasing shifts a later entry into this slot, so check it again
+        if(peerTable[s].used && now - peerTable[s].lastSeen > PEER_EXPIRY_MS) {
+            const uint8_t* mac = peerTable[s].mac;
+            Serial.printf("⚠️  Peer expired: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            erasePeerSlot(s);
+            peersExpired++;
+        } else {
+            PeerEntry* p = &peerTable[s];
+            if(p->used) {
+                uint8_t decay = PEER_MAINTENANCE_MS / 1000;
+                p->misbehavior = (p->misbehavior > decay) ? p->misbehavior - decay : 0;
+                if(p->bannedUntil != 0 && !peerBanned(p)) p->bannedUntil = 0;
+            }
+            s++;
+        }
+    }
+}
+
+void printPeers() {
+    unsigned long now = millis();
+    Serial.printf("\n=== Peers: %u live, %u registered ===\n", peerCount, espNowPeerCount);
+    Serial.println("MAC                RSSI  avg   seen   rx frames/bytes   tx  fail  refused score");
+    for(uint16_t s = 0; s < PEER_TABLE_SLOTS; s++) {
+        PeerEntry* p = &peerTable[s];
+        if(!p->used) continue;
+        Serial.printf("%02X:%02X:%02X:%02X:%02X:%02X %4d %4d %5lus ago %6u/%-8u %5u %5u %8u %5u%s%s\n",
+                     p->mac[0], p->mac[1], p->mac[2], p->mac[3], p->mac[4], p->mac[5],
+                     p->rssi, p->rssiAvg, (now - p->lastSeen) / 1000,
+                     p->rxFrames, p->rxBytes, p->txFrames, p->txFailures,
+                     p->rxRefused, p->misbehavior,
+                     p->registered ? " *" : "", peerBanned(p) ? " banned" : "");
+    }
+}
+
+// ==================== TRANSPORT ====================
+
+uint8_t txPriorityOf(uint8_t type) {
+    switch(type) {
+        case MSG_NEW_BLOCK:
+        case MSG_REQUEST_CHAIN:
+        case MSG_CHAIN_DATA:
+        case MSG_GET_BLOCK_TXN:
+        case MSG_BLOCK_TXN:
+            return PRIO_CHAIN;
+        case MSG_PEER_ANNOUNCE:
+        case MSG_VALIDATOR_HEARTBEAT:
+            return PRIO_ANNOUNCE;
+        default:
+            return PRIO_DATA;
+    }
+}
+
+uint8_t txQueueFree() {
+    return TX_QUEUE_DEPTH - txQueueCount;
+}
+
+// Bulk senders stop short of a full queue so other traffic still gets in
+bool txQueueHasRoom() {
+    return txQueueFree() > TX_QUEUE_RESERVE;
+}
+
+void txRelease(TxFrame* frame) {
+    frame->state = TX_FREE;
+    txQueueCount--;
+}
+
+// Queue a frame; when full, a lower-priority waiting frame makes room
+esp_err_t txEnqueue(const uint8_t* mac, const uint8_t* data, size_t len, uint8_t priority) {
+    if(len > ESPNOW_MAX_FRAME) return ESP_ERR_INVALID_ARG;
+    
+    TxFrame* slot = NULL;
+    if(txQueueCount < TX_QUEUE_DEPTH) {
+        for(uint8_t i = 0; i < TX_QUEUE_DEPTH && slot == NULL; i++) {
+            if(txQueue[i].state == TX_FREE) slot = &txQueue[i];
+        }
+    } else {
+        // Newest frame of the lowest priority below ours
+        for(uint8_t i = 0; i < TX_QUEUE_DEPTH; i++) {
+            TxFrame* f = &txQueue[i];
+            if(f->state != TX_QUEUED || f->priority <= priority) continue;
+            if(slot == NULL || f->priority > slot->priority ||
+               (f->priority == slot->priority && f->seq > slot->seq)) {
+                slot = f;
+            }
+        }
+        transportStats.dropped++;
+        if(slot == NULL) return ESP_ERR_ESPNOW_NO_MEM;
+        txRelease(slot);
+    }
+    
+    slot->state = TX_QUEUED;
+    slot->priority = priority;
+    slot->attempts = 0;
+    slot->len = len;
+    slot->seq = txSeq++;
+    memcpy(slot->mac, mac, 6);
+    memcpy(slot->data, data, len);
+    txQueueCount++;
+    transportStats.queued++;
+    if(txQueueCount > transportStats.peakDepth) transportStats.peakDepth = txQueueCount;
+    return ESP_OK;
+}
+
+// Oldest frame handed to the radio for this destination
+TxFrame* txOldestSent(const uint8_t* mac) {
+    TxFrame* oldest = NULL;
+    for(uint8_t i = 0; i < TX_QUEUE_DEPTH; i++) {
+        TxFrame* f = &txQueue[i];
+        if(f->state != TX_SENT || memcmp(f->mac, mac, 6) != 0) continue;
+        if(oldest == NULL || f->seq - oldest->seq > 0x80000000u) oldest = f;
+    }
+    return oldest;
+}
+
+void txFinish(TxFrame* frame, bool ok) {
+    txInFlight--;
+    
+    // Broadcasts are never acknowledged; the completion only frees the radio
+    if(frame->mac[0] & 0x01) {
+        txRelease(frame);
+        return;
+    }
+    
+    PeerEntry* peer = findPeer(frame->mac, false);
+    if(ok) {
+        transportStats.acked++;
+        if(peer) peer->txFailStreak = 0;
+        txRelease(frame);
+        return;
+    }
+    
+    if(peer) {
+        peer->txFailures++;
+        if(peer->txFailStreak < 8) peer->txFailStreak++;
+        unsigned long hold = (unsigned long)TX_BACKOFF_MS << (peer->txFailStreak - 1);
+        peer->txHoldUntil = millis() + (hold < TX_BACKOFF_MAX_MS ? hold : TX_BACKOFF_MAX_MS);
+    }
+    
+    if(frame->attempts > TX_RETRIES) {
+        transportStats.failed++;
+        txRelease(frame);
+    } else {
+        transportStats.retries++;
+        frame->state = TX_QUEUED;
+    }
+}
+
+// Next frame to send: highest priority, then oldest, skipping peers in backoff
+TxFrame* txNextReady(unsigned long now) {
+    TxFrame* best = NULL;
+    for(uint8_t i = 0; i < TX_QUEUE_DEPTH; i++) {
+        TxFrame* f = &txQueue[i];
+        if(f->state != TX_QUEUED) continue;
+        if(best && (f->priority > best->priority ||
+                    (f->priority == best->priority && f->seq - best->seq < 0x80000000u))) continue;
+        
+        if(!(f->mac[0] & 0x01)) {
+            PeerEntry* peer = findPeer(f->mac, false);
+            if(peer && peer->txFailStreak > 0 && (long)(peer->txHoldUntil - now) > 0) continue;
+        }
+        best = f;
+    }
+    return best;
+}
+
+// Apply send completions, then keep up to TX_WINDOW frames with the radio
+void transportTask() {
+    unsigned long now = millis();
+    
+    // A result with no frame to that destination is late, for one already timed out
+    while(txDoneTail != txDoneHead) {
+        __sync_synchronize();
+        TxDone done = txDone[txDoneTail];
+        txDoneTail = (txDoneTail + 1) % 8;
+        TxFrame* frame = txOldestSent(done.mac);
+        if(frame) txFinish(frame, done.ok);
+        else transportStats.late++;
+    }
+    
+    for(uint8_t i = 0; i < TX_QUEUE_DEPTH; i++) {
+        if(txQueue[i].state == TX_SENT && now - txQueue[i].sentAt >= TX_COMPLETION_TIMEOUT_MS) {
+            transportStats.timeouts++;
+            txFinish(&txQueue[i], false);
+        }
+    }
+    
+    while(txInFlight < TX_WINDOW) {
+        TxFrame* frame = txNextReady(now);
+        if(frame == NULL) break;
+        
+        bool unicast = !(frame->mac[0] & 0x01);
+        if(unicast) {
+            PeerEntry* peer = findPeer(frame->mac, true);
+            if(!registerPeer(peer)) {
+                transportStats.failed++;
+                txRelease(frame);
+                continue;
+            }
+            peer->lastUnicast = now;
+            peer->txFrames++;
+        }
+        
+        // Counted before the call: the completion may arrive before it returns
+        frame->state = TX_SENT;
+        frame->sentAt = now;
+        frame->attempts++;
+        txInFlight++;
+        
+        esp_err_t result = radio.send(frame->mac, frame->data, frame->len);
+        if(result == ESP_OK) {
+            transportStats.sent++;
+            wireStats.airFrames++;
+            wireStats.airBytes += frame->len;
+            continue;
+        }
+        
+        txInFlight--;
+        if(result == ESP_ERR_ESPNOW_NO_MEM) {
+            frame->state = TX_QUEUED;   // Radio queue full; try again next pass
+            frame->attempts--;
+            break;
+        }
+        if(result != ESP_ERR_ESPNOW_NOT_FOUND) {
+            Serial.printf("✗ %s error: %d\n", unicast ? "Send" : "Broadcast", result);
+        }
+        transportStats.failed++;
+        txRelease(frame);
+    }
+}
+
+// Wait out the rest of a loop pass, handling frames as they arrive and
+// feeding the radio as sends complete
+void transportIdle(unsigned long ms) {
+    unsigned long start = millis();
+    while(millis() - start < ms) {
+        delay(1);
+        receiveTask();
+        transportTask();
+    }
+}
+
+// ==================== NETWORK FUNCTIONS ====================
+
+void setupBroadcastPeer() {
+    if(broadcastPeerAdded) return;
+    
+    uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    esp_err_t result = radio.addPeer(broadcastAddr);
+    if(result == ESP_OK) {
+        broadcastPeerAdded = true;
+        Serial.println("✓ Broadcast peer added");
+    } else {
+        Serial.printf("✗ Failed to add broadcast peer: %d\n", result);
+    }
+}
+
+// Record header: type then length as a 1-2 byte varint; returns bytes written
+size_t putHeader(uint8_t* out, uint8_t type, uint16_t len) {
+    out[0] = type;
+    if(len < 0x80) {
+        out[1] = len;
+        return 2;
+    }
+    out[1] = 0x80 | (len & 0x7F);
+    out[2] = len >> 7;
+    return 3;
+}
+
+// Parse a record header; returns its size, or -1 if truncated
+int getHeader(const uint8_t* data, int len, uint8_t* type, uint16_t* dataLen) {
+    if(len < 2) return -1;
+    *type = data[0];
+    *dataLen = data[1] & 0x7F;
+    if(!(data[1] & 0x80)) return 2;
+    if(len < 3) return -1;
+    *dataLen |= (uint16_t)data[2] << 7;
+    return 3;
+}
+
+// Messages flooded across hops; everything else reaches direct neighbors only
+inline bool isGossipType(uint8_t type) {
+    return type == MSG_NEW_BLOCK || type == MSG_SENSOR_ALARM || type == MSG_SENSOR_STATS ||
+           type == MSG_VALIDATOR_HEARTBEAT;
+}
+
+// Record payload: gossip header (flooded types) then data; returns its length
+size_t putPayload(uint8_t* out, const NetworkPacket* packet) {
+    uint16_t len = (packet->dataLen <= sizeof(packet->data)) ? packet->dataLen : sizeof(packet->data);
+    size_t pos = 0;
+    if(isGossipType(packet->type)) {
+        memcpy(out, &packet->gossipId, sizeof(packet->gossipId));
+        out[4] = packet->ttl;
+        pos = GOSSIP_HEADER;
+    }
+    memcpy(out + pos, packet->data, len);
+    return pos + len;
+}
+
+inline uint16_t payloadSize(const NetworkPacket* packet) {
+    uint16_t len = (packet->dataLen <= sizeof(packet->data)) ? packet->dataLen : sizeof(packet->data);
+    return len + (isGossipType(packet->type) ? GOSSIP_HEADER : 0);
+}
+
+// Frame a packet for the air; returns the frame length
+size_t encodePacket(const NetworkPacket* packet, uint8_t* out) {
+    size_t pos = putHeader(out, packet->type, payloadSize(packet));
+    memcpy(out + pos, myMac, 6);
+    pos += 6;
+    return pos + putPayload(out + pos, packet);
+}
+
+// View one record in place; false if its type or length is invalid
+bool decodeMessage(uint8_t type, const uint8_t* senderMac, const uint8_t* payload,
+                   uint16_t len, PacketView* out) {
+    if(type >= MSG_TYPES || type == MSG_BUNDLE) return false;
+    
+    out->gossipId = 0;
+    out->ttl = 0;
+    if(isGossipType(type)) {
+        if(len < GOSSIP_HEADER) return false;
+        memcpy(&out->gossipId, payload, sizeof(out->gossipId));
+        out->ttl = payload[4];
+        payload += GOSSIP_HEADER;
+        len -= GOSSIP_HEADER;
+    }
+    if(len > sizeof(NetworkPacket::data)) return false;
+    
+    out->type = (MessageType)type;
+    out->data = payload;
+    out->dataLen = len;
+    out->senderMac = senderMac;
+    return true;
+}
+
+// Copy a received message out, for keeping past the receive callback
+void packetFromView(const PacketView* view, NetworkPacket* out) {
+    memset(out, 0, sizeof(NetworkPacket));
+    out->type = view->type;
+    out->dataLen = view->dataLen;
+    out->gossipId = view->gossipId;
+    out->ttl = view->ttl;
+    memcpy(out->data, view->data, view->dataLen);
+}
+
+void countSent(const NetworkPacket* packet, size_t bytes) {
+    if(packet->type < MSG_TYPES) {
+        wireStats.frames[packet->type]++;
+        wireStats.bytes[packet->type] += bytes;
+    }
+    wireStats.messages++;
+}
+
+// Send one packet in a frame of its own
+esp_err_t sendPacket(const uint8_t* mac, NetworkPacket* packet) {
+    strcpy(packet->sender, myAddress);
+    
+    uint8_t frame[WIRE_HEADER_MAX + GOSSIP_HEADER + sizeof(packet->data)];
+    size_t len = encodePacket(packet, frame);
+    
+    countSent(packet, len);
+    return txEnqueue(mac, frame, len, txPriorityOf(packet->type));
+}
+
+// Send whatever broadcasts are waiting; a lone record goes out as a plain frame
+void flushCoalesced() {
+    if(coalesceCount == 0) return;
+    
+    uint8_t frame[ESPNOW_MAX_FRAME];
+    size_t len;
+    
+    if(coalesceCount == 1) {
+        uint8_t type;
+        uint16_t dataLen;
+        int head = getHeader(coalesceBuf, coalesceLen, &type, &dataLen);
+        memcpy(frame, coalesceBuf, head);
+        memcpy(frame + head, myMac, 6);
+        memcpy(frame + head + 6, coalesceBuf + head, dataLen);
+        len = head + 6 + dataLen;
+    } else {
+        len = putHeader(frame, MSG_BUNDLE, coalesceLen);
+        memcpy(frame + len, myMac, 6);
+        memcpy(frame + len + 6, coalesceBuf, coalesceLen);
+        len += 6 + coalesceLen;
+    }
+    
+    coalesceCount = 0;
+    coalesceLen = 0;
+    
+    uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    esp_err_t result = txEnqueue(broadcastAddr, frame, len, coalescePriority);
+    
+    if(result != ESP_OK) {
+        Serial.printf("✗ Broadcast error: %d\n", result);
+    }
+}
+
+// Flush once the oldest waiting broadcast has waited out the window
+void coalesceTask() {
+    if(coalesceCount > 0 && millis() - coalesceStart >= COALESCE_WINDOW_MS) {
+        flushCoalesced();
+    }
+}
+
+// Handle one decoded message
+void dispatchPacket(const uint8_t* mac, const PacketView* packet) {
+    switch(packet->type) {
+        case MSG_NEW_TELEMETRY: {
+            const Transaction* tx = viewAs<Transaction>(packet, TX_WIRE_SIZE(0));
+            if(tx == NULL || tx->readingCount == 0 || tx->readingCount > TX_BATCH_MAX ||
+               packet->dataLen < TX_WIRE_SIZE(tx->readingCount)) {
+                admissionStats.invalidTx++;
+                misbehave(findPeer(mac, false), 20, "invalid transaction");
+                break;
+            }
+            if(overPoolShare(tx->sensor) && !seenTxContains(tx->txHash)) {
+                admissionStats.overShare++;
+                break;
+            }
+            // Two sensorIds behind one handle: refuse rather than mix their readings
+            if(!sensorTagMatches(tx->sensor, tx->sensorTag)) {
+                admissionStats.handleClash++;
+                break;
+            }
+            if(addToTxPool(tx)) announceTransaction(tx, txHolders(tx));
+            else heardTransaction(tx->txHash);
+            break;
+        }
+        
+        case MSG_INV:
+            handleInventory(mac, packet);
+            break;
+        
+        case MSG_GET_TX:
+            handleTxRequest(mac, packet);
+            break;
+        
+        case MSG_NEW_BLOCK:
+            handleCompactBlock(mac, packet);
+            break;
+        
+        case MSG_GET_BLOCK_TXN:
+            handleGetBlockTxn(mac, packet);
+            break;
+        
+        case MSG_BLOCK_TXN:
+            handleBlockTxn(mac, packet);
+            break;
+        
+        case MSG_REQUEST_CHAIN:
+            handleChainRequest(mac, packet);
+            break;
+        
+        case MSG_CHAIN_DATA:
+            handleChainData(mac, packet);
+            break;
+        
+        case MSG_QUERY_REQUEST:
+            handleQueryRequest(mac, packet);
+            break;
+        
+        case MSG_QUERY_PAGE:
+            handleQueryPage(mac, packet);
+            break;
+        
+        case MSG_GET_SKETCH:
+            handleSketchRequest(mac, packet);
+            break;
+        
+        case MSG_SKETCH:
+            handleSketch(mac, packet);
+            break;
+        
+        case MSG_VALIDATOR_HEARTBEAT:
+            handleHeartbeat(packet);
+            break;
+        
+        case MSG_SENSOR_ALARM: {
+            const SensorAlarm* alarm = viewAs<SensorAlarm>(packet);
+            if(alarm == NULL || alarm->field >= STAT_FIELDS || alarm->kind >= ALARM_KINDS) break;
+            
+            char name[17] = {0};
+            memcpy(name, alarm->sensor.sensorId, 16);
+            Serial.printf("⚠️  Remote alarm %s: %s %s (%.2f, mean %.2f ± %.2f)\n",
+                          name, STAT_NAMES[alarm->field], ALARM_NAMES[alarm->kind],
+                          alarm->value, alarm->mean, alarm->stddev);
+            break;
+        }
+        
+        case MSG_SENSOR_STATS: {
+            const SensorStatsReport* report = viewAs<SensorStatsReport>(packet);
+            if(report == NULL) break;
+            
+            char name[17] = {0};
+            memcpy(name, report->sensor.sensorId, 16);
+            Serial.printf("Remote stats %s: T %.1f±%.1f°C H %.1f±%.1f%% V %.2f, %u readings, %u alarms\n",
+                          name, report->mean[STAT_TEMPERATURE], report->stddev[STAT_TEMPERATURE],
+                          report->mean[STAT_HUMIDITY], report->stddev[STAT_HUMIDITY],
+                          report->ewma[STAT_BATTERY], report->readings, report->alarms);
+            break;
+        }
+        
+        case MSG_PEER_ANNOUNCE: {
+            const uint8_t* from = packet->senderMac;
+            Serial.printf("Peer announced: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                         from[0], from[1], from[2], from[3], from[4], from[5]);
+            
+            // Announcements carry the sender's interned sensorId
+            const SensorIdEntry* entry = viewAs<SensorIdEntry>(packet);
+            if(entry != NULL) {
+                char name[17] = {0};
+                memcpy(name, entry->sensorId, 16);
+                if(entry->handle != 0 && registerSensorId(entry->handle, name)) {
+                    Serial.printf("✓ Sensor %s registered as %04X\n", name, entry->handle);
+                }
+            }
+            
+            // ...and its chain height: catch up, or tell a laggard how far we are
+            const PeerAnnounce* announce = viewAs<PeerAnnounce>(packet);
+            if(announce != NULL) {
+                uint32_t height = announce->height;
+                if(height > totalBlocks) {
+                    startChainSync(mac, height);
+                } else if(height < totalBlocks) {
+                    NetworkPacket reply;
+                    buildPeerAnnounce(&reply);
+                    sendToPeer(mac, &reply);
+                } else if(blockCount > 0) {
+                    // Same height, other tip: the lower hash wins, so the winner re-floods its tip
+                    Block* tip = &blockchain[(blockCount - 1) % MAX_BLOCKS];
+                    if(memcmp(tip->blockHash, announce->tipId, SHORT_ID_BYTES) < 0) broadcastBlock(tip);
+                }
+            }
+            break;
+        }
+        
+        default:
+            break;      // MSG_BUNDLE is unpacked before dispatch
+    }
+}
+
+// Handle one received frame; runs in loop(), never in the WiFi task
+void handleFrame(const uint8_t* mac, const uint8_t* data, int len, int8_t rssi) {
+    uint8_t type;
+    uint16_t dataLen;
+    PeerEntry* peer = findPeer(mac, true);
+    if(!admitFrame(peer)) return;
+    
+    int head = getHeader(data, len, &type, &dataLen);
+    if(head < 0 || head + 6 + dataLen != len) {
+        admissionStats.malformed++;
+        misbehave(peer, 10, "malformed frame");
+        return;
+    }
+    
+    const uint8_t* sender = data + head;
+    const uint8_t* payload = sender + 6;
+    
+    if(peer->rxFrames == 0) {
+        Serial.printf("✓ New peer added: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    touchPeer(peer, len, rssi);
+    
+    PacketView packet;
+    if(type != MSG_BUNDLE) {
+        if(!admitRecord(peer, type)) return;
+        if(!decodeMessage(type, sender, payload, dataLen, &packet)) {
+            admissionStats.malformed++;
+            misbehave(peer, 10, "malformed message");
+        } else if(gossipAccept(&packet)) {
+            dispatchPacket(mac, &packet);
+        }
+        return;
+    }
+    
+    // Unpack a coalesced frame record by record
+    uint16_t pos = 0;
+    while(pos < dataLen) {
+        uint8_t recType;
+        uint16_t recLen;
+        int recHead = getHeader(payload + pos, dataLen - pos, &recType, &recLen);
+        if(recHead < 0 || pos + recHead + recLen > dataLen) {
+            admissionStats.malformed++;
+            misbehave(findPeer(mac, true), 10, "malformed bundle");
+            break;
+        }
+        
+        // Handlers may add peers, which can move entries: look ours up again
+        peer = findPeer(mac, true);
+        if(peerBanned(peer)) break;
+        if(admitRecord(peer, recType)) {
+            if(!decodeMessage(recType, sender, payload + pos + recHead, recLen, &packet)) {
+                admissionStats.malformed++;
+                misbehave(peer, 10, "malformed message");
+            } else if(gossipAccept(&packet)) {
+                dispatchPacket(mac, &packet);
+            }
+        }
+        pos += recHead + recLen;
+    }
+}
+
+// Drain the frames the radio queued, polling first where the radio needs it
+void receiveTask() {
+    if(radio.poll) radio.poll();
+    
+    while(rxTail != rxHead) {
+        __sync_synchronize();   // Read the frame only after seeing the slot filled
+        RxFrame* frame = &rxQueue[rxTail];
+        handleFrame(frame->mac, frame->data, frame->len, frame->rssi);
+        __sync_synchronize();
+        rxTail = (rxTail + 1) % RX_QUEUE_DEPTH;
+    }
+}
+
+// Broadcasts are coalesced: records queue for up to COALESCE_WINDOW_MS and
+// share a frame while they fit
+void queueBroadcast(NetworkPacket* packet) {
+    setupBroadcastPeer();
+    strcpy(packet->sender, myAddress);
+    
+    uint16_t len = payloadSize(packet);
+    uint8_t head[3];
+    size_t headLen = putHeader(head, packet->type, len);
+    
+    if(coalesceCount > 0 && coalesceLen + headLen + len > sizeof(coalesceBuf)) {
+        flushCoalesced();
+    }
+    if(coalesceCount == 0) {
+        coalesceStart = millis();
+        coalescePriority = PRIO_ANNOUNCE;
+    }
+    if(txPriorityOf(packet->type) < coalescePriority) coalescePriority = txPriorityOf(packet->type);
+    
+    memcpy(coalesceBuf + coalesceLen, head, headLen);
+    putPayload(coalesceBuf + coalesceLen + headLen, packet);
+    coalesceLen += headLen + len;
+    coalesceCount++;
+    countSent(packet, headLen + len);
+    
+    if(COALESCE_WINDOW_MS == 0) flushCoalesced();
+}
+
+// Originate a broadcast; flooded types get a fresh message ID and full TTL
+void broadcastPacket(NetworkPacket* packet) {
+    if(isGossipType(packet->type)) {
+        do {
+            packet->gossipId = esp_random();
+        } while(packet->gossipId == 0);     // 0 marks an empty seen-cache slot
+        packet->ttl = GOSSIP_TTL;
+        gossipRemember(packet->gossipId);
+        gossipStats.originated++;
+    }
+    queueBroadcast(packet);
+}
+
+void sendToPeer(const uint8_t* mac, NetworkPacket* packet) {
+    esp_err_t result = sendPacket(mac, packet);
+    if(result != ESP_OK) {
+        Serial.printf("✗ Send error: %d\n", result);
+    }
+}
+
+void broadcastBlock(Block* block) {
+    NetworkPacket packet;
+    packet.type = MSG_NEW_BLOCK;
+    
+    CompactBlock* compact = (CompactBlock*)packet.data;
+    compact->index = block->index;
+    compact->timestamp = block->timestamp;
+    compact->txCount = block->txCount;
+    memcpy(compact->previousHash, block->previousHash, 32);
+    memcpy(compact->blockHash, block->blockHash, 32);
+    memcpy(compact->validator, block->validator, sizeof(compact->validator));
+    compact->nonce = block->nonce;
+    for(uint8_t i = 0; i < block->txCount; i++) {
+        memcpy(compact->shortIds[i], block->txHashes[i], SHORT_ID_BYTES);
+    }
+    packet.dataLen = offsetof(CompactBlock, shortIds) + SHORT_ID_BYTES * block->txCount;
+    
+    broadcastPacket(&packet);
+    
+    Serial.printf("✓ Compact block broadcast (%u bytes)\n", packet.dataLen);
+}
+
+// ==================== GOSSIP ====================
+
+bool gossipSeenContains(uint32_t id) {
+    for(uint8_t i = 0; i < GOSSIP_SEEN_SLOTS; i++) {
+        if(gossipSeen[i] == id) return true;
+    }
+    return false;
+}
+
+// Oldest ID is overwritten once the cache is full
+void gossipRemember(uint32_t id) {
+    gossipSeen[gossipSeenNext] = id;
+    gossipSeenNext = (gossipSeenNext + 1) % GOSSIP_SEEN_SLOTS;
+}
+
+// Drop duplicates, and schedule a relay of anything new that has hops left
+bool gossipAccept(const PacketView* packet) {
+    if(!isGossipType(packet->type)) return true;
+    
+    if(packet->gossipId == 0 || gossipSeenContains(packet->gossipId)) {
+        gossipStats.duplicates++;
+        
+        // Enough neighbors already re-broadcast it; ours would add nothing
+        for(uint8_t i = 0; i < GOSSIP_QUEUE; i++) {
+            GossipRelay* relay = &gossipQueue[i];
+            if(relay->active && relay->packet.gossipId == packet->gossipId &&
+               GOSSIP_SUPPRESS > 0 && ++relay->copies >= GOSSIP_SUPPRESS) {
+                relay->active = false;
+                gossipStats.suppressed++;
+            }
+        }
+        return false;
+    }
+    
+    gossipRemember(packet->gossipId);
+    gossipStats.received++;
+    
+    if(packet->ttl > 1) {
+        GossipRelay* slot = NULL;
+        for(uint8_t i = 0; i < GOSSIP_QUEUE && slot == NULL; i++) {
+            if(!gossipQueue[i].active) slot = &gossipQueue[i];
+        }
+        if(slot == NULL) {
+            gossipStats.dropped++;
+        } else {
+            packetFromView(packet, &slot->packet);
+            slot->packet.ttl--;
+            slot->copies = 0;
+            slot->due = millis() + random(0, GOSSIP_JITTER_MS + 1);
+            slot->active = true;
+        }
+    }
+    return true;
+}
+
+// Re-broadcast relays whose jitter has elapsed
+void gossipTask() {
+    unsigned long now = millis();
+    for(uint8_t i = 0; i < GOSSIP_QUEUE; i++) {
+        GossipRelay* relay = &gossipQueue[i];
+        if(relay->active && (long)(now - relay->due) >= 0) {
+            relay->active = false;
+            queueBroadcast(&relay->packet);
+            gossipStats.relayed++;
+        }
+    }
+}
+
+// ==================== INVENTORY ====================
+
+Transaction* findPoolTxByShortId(const uint8_t* id) {
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        if(memcmp(txPoolAt(i)->txHash, id, SHORT_ID_BYTES) == 0) return txPoolAt(i);
+    }
+    return NULL;
+}
+
+int8_t findInvPending(const uint8_t* id) {
+    for(uint8_t i = 0; i < invPendingCount; i++) {
+        if(memcmp(invPending[i], id, SHORT_ID_BYTES) == 0) return i;
+    }
+    return -1;
+}
+
+InvRequest* findInvRequest(const uint8_t* id) {
+    for(uint8_t i = 0; i < INV_REQUESTS; i++) {
+        if(invRequests[i].active && memcmp(invRequests[i].id, id, SHORT_ID_BYTES) == 0) return &invRequests[i];
+    }
+    return NULL;
+}
+
+// Queue a newly accepted tx for our next inventory. 'holders' counts neighbors
+// known to have it (0 for our own); relayed txs wait a random part of the
+// batch window so neighbors don't all announce at once.
+void announceTransaction(const Transaction* tx, uint8_t holders) {
+    if(invPendingCount >= INV_MAX_IDS) sendInventory();
+    if(invPendingCount == 0) {
+        invPendingDue = millis() + (holders > 0 ? random(INV_BATCH_MS / 2, INV_BATCH_MS * 3 / 2) : INV_BATCH_MS);
+    }
+    memcpy(invPending[invPendingCount], tx->txHash, SHORT_ID_BYTES);
+    invPendingHeard[invPendingCount] = 0;
+    invPendingHolders[invPendingCount++] = holders;
+}
+
+// A neighbor announced or re-sent a tx we hold; enough of that and we needn't
+void heardTransaction(const uint8_t* id) {
+    int8_t pending = findInvPending(id);
+    if(pending < 0 || invPendingHeard[pending] == 255) return;
+    invPendingHeard[pending]++;
+    invPendingHolders[pending]++;
+}
+
+// Neighbors known to hold a tx that just arrived: its sender plus what we heard meanwhile
+uint8_t txHolders(const Transaction* tx) {
+    InvRequest* req = findInvRequest(tx->txHash);
+    return req ? req->holders : 1;
+}
+
+// Broadcast our height and pending IDs. IDs enough neighbors already announced are
+// dropped, and a tx that at most INV_PUSH_MAX neighbors could lack is pushed
+// whole: announce, request and answer would cost three frames instead of one.
+void sendInventory() {
+    NetworkPacket packet;
+    InvAnnounce* inv = (InvAnnounce*)packet.data;
+    inv->height = totalBlocks;
+    inv->count = 0;
+    for(uint8_t i = 0; i < invPendingCount; i++) {
+        if(invPendingHeard[i] >= INV_SUPPRESS || invPendingHolders[i] >= peerCount) {
+            invStats.suppressed++;
+            continue;
+        }
+        
+        Transaction* tx = findPoolTxByShortId(invPending[i]);
+        if(tx != NULL && peerCount - invPendingHolders[i] <= INV_PUSH_MAX) {
+            NetworkPacket full;
+            full.type = MSG_NEW_TELEMETRY;
+            memcpy(full.data, tx, TX_WIRE_SIZE(tx->readingCount));
+            full.dataLen = TX_WIRE_SIZE(tx->readingCount);
+            broadcastPacket(&full);
+            invStats.pushed++;
+            continue;
+        }
+        memcpy(inv->ids[inv->count++], invPending[i], SHORT_ID_BYTES);
+    }
+    invPendingCount = 0;
+    if(inv->count == 0) return;
+    
+    packet.type = MSG_INV;
+    packet.dataLen = offsetof(InvAnnounce, ids) + inv->count * SHORT_ID_BYTES;
+    broadcastPacket(&packet);
+    invStats.announced += inv->count;
+}
+
+// Pull the txs we lack after a random delay (a neighbor's request may cover
+// them first); a peer well ahead of us also gets us syncing
+void handleInventory(const uint8_t* mac, const PacketView* packet) {
+    const InvAnnounce* inv = viewAs<InvAnnounce>(packet, offsetof(InvAnnounce, ids));
+    if(inv == NULL || inv->count > INV_MAX_IDS ||
+       packet->dataLen < offsetof(InvAnnounce, ids) + inv->count * SHORT_ID_BYTES) return;
+    
+    // One block behind is normal while a compact block is in flight
+    if(inv->height > totalBlocks + 1) startChainSync(mac, inv->height);
+    
+    unsigned long now = millis();
+    uint8_t slot = 0;
+    
+    for(uint8_t i = 0; i < inv->count; i++) {
+        const uint8_t* id = inv->ids[i];
+        if(seenTxContainsShortId(id)) {
+            heardTransaction(id);
+            continue;
+        }
+        InvRequest* known = findInvRequest(id);
+        if(known) {
+            if(known->holders < 255) known->holders++;
+            continue;
+        }
+        
+        while(slot < INV_REQUESTS && invRequests[slot].active) slot++;
+        if(slot == INV_REQUESTS) break;
+        
+        InvRequest* req = &invRequests[slot];
+        req->active = true;
+        req->sent = false;
+        memcpy(req->id, id, SHORT_ID_BYTES);
+        memcpy(req->peer, mac, 6);
+        req->holders = 1;
+        req->tries = 0;
+        req->due = now + random(0, INV_REQUEST_JITTER_MS + 1);
+    }
+}
+
+// Requests are broadcast: the named peer answers, everyone else holds back
+// their own request for the same txs and takes the (broadcast) answer too
+void handleTxRequest(const uint8_t*, const PacketView* packet) {
+    const TxRequest* req = viewAs<TxRequest>(packet, offsetof(TxRequest, ids));
+    if(req == NULL || req->count > INV_MAX_IDS ||
+       packet->dataLen < offsetof(TxRequest, ids) + req->count * SHORT_ID_BYTES) return;
+    
+    bool forUs = memcmp(req->target, myMac, 6) == 0;
+    unsigned long now = millis();
+    
+    for(uint8_t i = 0; i < req->count; i++) {
+        const uint8_t* id = req->ids[i];
+        
+        // The requester will have it too
+        if(!forUs) {
+            InvRequest* mine = findInvRequest(id);
+            int8_t pending = findInvPending(id);
+            if(pending >= 0 && invPendingHolders[pending] < 255) invPendingHolders[pending]++;
+            if(mine == NULL) continue;
+            if(mine->holders < 255) mine->holders++;
+            if(!mine->sent) {
+                mine->sent = true;
+                mine->sentAt = now;
+                invStats.covered++;
+            }
+            continue;
+        }
+        
+        if(findPoolTxByShortId(id) == NULL) continue;
+        
+        InvServe* empty = NULL;
+        bool queued = false;
+        for(uint8_t s = 0; s < INV_SERVE_SLOTS && !queued; s++) {
+            if(!invServe[s].active) {
+                if(empty == NULL) empty = &invServe[s];
+            } else if(memcmp(invServe[s].id, id, SHORT_ID_BYTES) == 0) {
+                queued = true;
+            }
+        }
+        if(!queued && empty) {
+            empty->active = true;
+            empty->sent = false;
+            memcpy(empty->id, id, SHORT_ID_BYTES);
+        }
+    }
+}
+
+// One request frame for every due ID announced by the same peer
+void sendDueRequests(unsigned long now) {
+    for(uint8_t i = 0; i < INV_REQUESTS; i++) {
+        InvRequest* first = &invRequests[i];
+        if(!first->active || first->sent || (long)(now - first->due) < 0) continue;
+        
+        NetworkPacket packet;
+        TxRequest* req = (TxRequest*)packet.data;
+        memcpy(req->target, first->peer, 6);
+        req->count = 0;
+        
+        for(uint8_t j = i; j < INV_REQUESTS && req->count < INV_MAX_IDS; j++) {
+            InvRequest* r = &invRequests[j];
+            if(!r->active || r->sent || (long)(now - r->due) < 0 ||
+               memcmp(r->peer, first->peer, 6) != 0) continue;
+            
+            memcpy(req->ids[req->count++], r->id, SHORT_ID_BYTES);
+            if(r->tries > 0) invStats.rerequested++;
+            else invStats.requested++;
+            r->sent = true;
+            r->sentAt = now;
+        }
+        
+        packet.type = MSG_GET_TX;
+        packet.dataLen = offsetof(TxRequest, ids) + req->count * SHORT_ID_BYTES;
+        broadcastPacket(&packet);
+    }
+}
+
+void inventoryTask() {
+    unsigned long now = millis();
+    
+    if(invPendingCount > 0 && (long)(now - invPendingDue) >= 0) {
+        sendInventory();
+    }
+    
+    // Requested txs go out as broadcasts, so every neighbor missing them benefits
+    for(uint8_t s = 0; s < INV_SERVE_SLOTS; s++) {
+        InvServe* serve = &invServe[s];
+        if(!serve->active) continue;
+        if(serve->sent) {
+            if(now - serve->sentAt >= INV_SERVE_HOLD_MS) serve->active = false;
+            continue;
+        }
+        
+        Transaction* tx = findPoolTxByShortId(serve->id);
+        if(tx == NULL) {
+            serve->active = false;  // Mined since; the block carries it
+            continue;
+        }
+        serve->sent = true;
+        serve->sentAt = now;
+        
+        NetworkPacket packet;
+        packet.type = MSG_NEW_TELEMETRY;
+        memcpy(packet.data, tx, TX_WIRE_SIZE(tx->readingCount));
+        packet.dataLen = TX_WIRE_SIZE(tx->readingCount);
+        broadcastPacket(&packet);
+        invStats.served++;
+    }
+    
+    for(uint8_t i = 0; i < INV_REQUESTS; i++) {
+        InvRequest* req = &invRequests[i];
+        if(!req->active) continue;
+        
+        if(seenTxContainsShortId(req->id)) {
+            req->active = false;
+        } else if(req->sent && now - req->sentAt >= INV_REQUEST_TIMEOUT_MS) {
+            // Gave up: if it was mined, compact block relay fetches it
+            if(req->tries >= INV_REQUEST_RETRIES) {
+                req->active = false;
+            } else {
+                req->tries++;
+                req->sent = false;
+                req->due = now;
+            }
+        }
+    }
+    
+    sendDueRequests(now);
+}
+
+// ==================== REMOTE QUERY ====================
+
+void handleQueryRequest(const uint8_t* mac, const PacketView* packet) {
+    if(MY_ROLE != ARCHIVE_NODE && MY_ROLE != VALIDATOR_NODE) return;
+    const QueryRequest* req = viewAs<QueryRequest>(packet);
+    if(req == NULL) return;
+    
+    bool sameClient = queryServe.active && memcmp(queryServe.mac, mac, 6) == 0 &&
+                      queryServe.request.queryId == req->queryId;
+    
+    // One client at a time; others are told to retry
+    if(queryServe.active && !sameClient &&
+       millis() - queryServe.lastSend < QUERY_TIMEOUT_MS) {
+        NetworkPacket reply;
+        QueryPage busy = {0};
+        busy.queryId = req->queryId;
+        busy.seq = req->seq;
+        busy.flags = QUERY_BUSY;
+        reply.type = MSG_QUERY_PAGE;
+        memcpy(reply.data, &busy, sizeof(busy));
+        reply.dataLen = sizeof(busy);
+        sendToPeer(mac, &reply);
+        return;
+    }
+    
+    memcpy(queryServe.mac, mac, 6);
+    queryServe.request = *req;
+    queryServe.request.sensorId[sizeof(req->sensorId) - 1] = '\0';
+    if(queryServe.request.window == 0 || queryServe.request.window > QUERY_WINDOW) {
+        queryServe.request.window = QUERY_WINDOW;
+    }
+    queryServe.page = 0;
+    queryServe.lastSend = 0;
+    queryServe.active = true;
+}
+
+// Requester side: print the page and advance the cursor
+void handleQueryPage(const uint8_t* mac, const PacketView* packet) {
+    const QueryPage* page = viewAs<QueryPage>(packet);
+    if(!remoteQuery.active || page == NULL) return;
+    
+    if(page->queryId != remoteQuery.request.queryId || page->seq != remoteQuery.request.seq) return;
+    if(remoteQuery.locked && memcmp(remoteQuery.target, mac, 6) != 0) return;
+    
+    if(page->flags & QUERY_BUSY) {
+        remoteQuery.lastActivity = millis();  // Retry after the timeout
+        return;
+    }
+    
+    // Go-back-N: a gap means a lost page; the timeout re-requests from the cursor
+    if(page->page != remoteQuery.expectPage) return;
+    
+    if(!remoteQuery.locked) {
+        memcpy(remoteQuery.target, mac, 6);
+        remoteQuery.locked = true;
+    }
+    
+    for(uint8_t i = 0; i < page->count && i < QUERY_PAGE_READINGS; i++) {
+        TelemetryData reading;
+        memcpy(reading.sensorId, remoteQuery.request.sensorId, sizeof(reading.sensorId) - 1);
+        reading.sensorId[sizeof(reading.sensorId) - 1] = '\0';
+        decodeReading(&page->readings[i], &reading);
+        emitReading(&reading);
+    }
+    
+    remoteQuery.received += page->count;
+    remoteQuery.request.cursor = page->nextCursor;
+    remoteQuery.request.cursorSkip = page->nextSkip;
+    remoteQuery.expectPage++;
+    remoteQuery.retries = 0;
+    remoteQuery.lastActivity = millis();
+    
+    if(page->flags & QUERY_LAST) {
+        Serial.printf("Found %u remote readings\n\n", remoteQuery.received);
+        remoteQuery.active = false;
+    } else if(page->flags & QUERY_WINDOW_END) {
+        remoteQuery.requestDue = true;
+    }
+}
+
+void sendQueryRequest() {
+    NetworkPacket packet;
+    packet.type = MSG_QUERY_REQUEST;
+    memcpy(packet.data, &remoteQuery.request, sizeof(QueryRequest));
+    packet.dataLen = sizeof(QueryRequest);
+    
+    if(remoteQuery.locked) {
+        sendToPeer(remoteQuery.target, &packet);
+    } else {
+        broadcastPacket(&packet);
+    }
+    remoteQuery.lastActivity = millis();
+}
+
+// Ask archives/validators for a sensor's readings in [startTime, endTime]
+void startRemoteQuery(const char* sensorId, uint32_t startTime, uint32_t endTime) {
+    memset(&remoteQuery, 0, sizeof(remoteQuery));
+    remoteQuery.request.queryId = nextQueryId++;
+    remoteQuery.request.window = QUERY_WINDOW;
+    strncpy(remoteQuery.request.sensorId, sensorId, sizeof(remoteQuery.request.sensorId) - 1);
+    remoteQuery.request.startTime = startTime;
+    remoteQuery.request.endTime = endTime;
+    remoteQuery.request.cursor = startTime;
+    remoteQuery.active = true;
+    
+    Serial.printf("\n=== Remote Query: %s [%u-%u] ===\n", remoteQuery.request.sensorId,
+                  startTime, endTime);
+    sendQueryRequest();
+}
+
+// Serve one page per pass, and drive our own request's retries
+void remoteQueryTask() {
+    unsigned long now = millis();
+    
+    if(queryServe.active && queryServe.page < queryServe.request.window &&
+       now - queryServe.lastSend >= QUERY_PAGE_GAP_MS && txQueueHasRoom()) {
+        TelemetryData readings[QUERY_PAGE_READINGS];
+        uint8_t count;
+        bool last;
+        QueryRequest* req = &queryServe.request;
+        
+        NetworkPacket packet;
+        QueryPage* page = (QueryPage*)packet.data;
+        memset(page, 0, sizeof(QueryPage));
+        page->queryId = req->queryId;
+        page->seq = req->seq;
+        page->page = queryServe.page++;
+        uint16_t skip = req->cursorSkip;
+        page->nextCursor = collectChunk(req->sensorId, req->cursor, &skip, req->endTime,
+                                        readings, QUERY_PAGE_READINGS, &count, &last);
+        page->nextSkip = skip;
+        page->count = count;
+        for(uint8_t i = 0; i < count; i++) {
+            encodeReading(&readings[i], &page->readings[i]);
+        }
+        
+        req->cursor = page->nextCursor;
+        req->cursorSkip = page->nextSkip;
+        if(last) page->flags |= QUERY_LAST;
+        else if(queryServe.page == req->window) page->flags |= QUERY_WINDOW_END;
+        
+        packet.type = MSG_QUERY_PAGE;
+        packet.dataLen = sizeof(QueryPage);
+        sendToPeer(queryServe.mac, &packet);
+        queryServe.lastSend = now;
+        
+        // Wait for the next request (or nothing, if this was the last page)
+        if(last) queryServe.active = false;
+    }
+    
+    if(remoteQuery.active) {
+        if(remoteQuery.requestDue) {
+            remoteQuery.requestDue = false;
+            remoteQuery.request.seq++;
+            remoteQuery.expectPage = 0;
+            sendQueryRequest();
+        } else if(now - remoteQuery.lastActivity >= QUERY_TIMEOUT_MS) {
+            if(remoteQuery.retries++ >= QUERY_RETRIES) {
+                Serial.printf("✗ Remote query timed out (%u readings received)\n\n",
+                              remoteQuery.received);
+                remoteQuery.active = false;
+            } else {
+                remoteQuery.request.seq++;
+                remoteQuery.expectPage = 0;
+                sendQueryRequest();
+            }
+        }
+    }
+    
+    if(sketchQuery.active && now - sketchQuery.sentAt >= QUERY_TIMEOUT_MS) {
+        Serial.printf("%u sketch replies for %s\n\n", sketchQuery.replies, sketchQuery.sensorId);
+        sketchQuery.active = false;
+    }
+}
+
+// ---- Quantile sketches ----
+
+// CompactReading scale per sketched field (StatField order)
+const float SKETCH_SCALE[QUANTILE_FIELDS] = {100.0f, 10.0f};
+
+// Answer with our sketches of the named sensor; we never start one for it here
+void handleSketchRequest(const uint8_t* mac, const PacketView* packet) {
+    const SketchRequest* req = viewAs<SketchRequest>(packet);
+    if(req == NULL) return;
+    
+    char sensorId[17] = {0};
+    memcpy(sensorId, req->sensorId, 16);
+    SensorQuantiles* sq = findSensorQuantiles(lookupSensorHandle(sensorId), false);
+    if(sq == NULL) return;
+    
+    for(uint8_t f = 0; f < QUANTILE_FIELDS; f++) {
+        QuantileSketch* sketch = &sq->sketch[f];
+        sketchFlush(sketch);
+        if(sketch->count == 0) continue;
+        
+        NetworkPacket reply;
+        SketchMessage* msg = (SketchMessage*)reply.data;
+        memset(msg, 0, sizeof(SketchMessage));
+        memcpy(msg->sensorId, req->sensorId, 16);
+        msg->field = f;
+        msg->count = sketch->count;
+        msg->min = lroundf(sketch->min * SKETCH_SCALE[f]);
+        msg->max = lroundf(sketch->max * SKETCH_SCALE[f]);
+        msg->centroidCount = sketch->centroidCount;
+        for(uint8_t i = 0; i < sketch->centroidCount; i++) {
+            msg->centroids[i].mean = lroundf(sketch->centroids[i].mean * SKETCH_SCALE[f]);
+            msg->centroids[i].weight = sketch->centroids[i].weight;
+        }
+        
+        reply.type = MSG_SKETCH;
+        reply.dataLen = SKETCH_WIRE_SIZE(msg->centroidCount);
+        sendToPeer(mac, &reply);
+    }
+}
+
+// Print a neighbor's sketch and keep it if it has seen more readings than ours.
+// Neighbors sketch the same gossiped readings, so their sketches overlap: the
+// larger one replaces ours rather than being merged into it (that would count
+// shared readings twice).
+void handleSketch(const uint8_t* mac, const PacketView* packet) {
+    const SketchMessage* msg = viewAs<SketchMessage>(packet, SKETCH_WIRE_SIZE(0));
+    if(!sketchQuery.active || msg == NULL) return;
+    if(msg->field >= QUANTILE_FIELDS || msg->centroidCount == 0 || msg->centroidCount > DIGEST_CENTROIDS ||
+       packet->dataLen < SKETCH_WIRE_SIZE(msg->centroidCount)) {
+        return;
+    }
+    if(strncmp(msg->sensorId, sketchQuery.sensorId, 16) != 0) return;
+    
+    QuantileSketch remote;
+    memset(&remote, 0, sizeof(remote));
+    float scale = SKETCH_SCALE[msg->field];
+    remote.count = msg->count;
+    remote.min = msg->min / scale;
+    remote.max = msg->max / scale;
+    remote.centroidCount = msg->centroidCount;
+    for(uint8_t i = 0; i < msg->centroidCount; i++) {
+        remote.centroids[i].mean = msg->centroids[i].mean / scale;
+        remote.centroids[i].weight = msg->centroids[i].weight;
+    }
+    
+    uint16_t handle = lookupSensorHandle(sketchQuery.sensorId);
+    SensorQuantiles* sq = findSensorQuantiles(handle, false);
+    bool adopt = (sq == NULL || sq->sketch[msg->field].count < remote.count);
+    
+    Serial.printf("   %02X:%02X:%02X:%02X:%02X:%02X %s: n=%u p50 %.1f p95 %.1f p99 %.1f%s\n",
+                  mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], STAT_NAMES[msg->field], remote.count,
+                  sketchQuantile(&remote, 0.50f), sketchQuantile(&remote, 0.95f),
+                  sketchQuantile(&remote, 0.99f), adopt ? " (kept)" : "");
+    sketchQuery.replies++;
+    
+    if(adopt) {
+        sq = findSensorQuantiles(handle, true);
+        sq->sketch[msg->field] = remote;
+        sq->lastUpdate = millis();
+    }
+}
+
+// Ask neighbors for their sketches of one sensor
+void startSketchQuery(const char* sensorId) {
+    memset(&sketchQuery, 0, sizeof(sketchQuery));
+    strncpy(sketchQuery.sensorId, sensorId, 16);
+    sketchQuery.active = true;
+    sketchQuery.sentAt = millis();
+    
+    Serial.printf("\n=== Quantiles: %s ===\n", sketchQuery.sensorId);
+    SensorQuantiles* sq = findSensorQuantiles(lookupSensorHandle(sketchQuery.sensorId), false);
+    if(sq != NULL) printQuantiles("local", sq->sketch);
+    
+    NetworkPacket packet;
+    SketchRequest* req = (SketchRequest*)packet.data;
+    memset(req, 0, sizeof(SketchRequest));
+    memcpy(req->sensorId, sketchQuery.sensorId, strlen(sketchQuery.sensorId));
+    packet.type = MSG_GET_SKETCH;
+    packet.dataLen = sizeof(SketchRequest);
+    broadcastPacket(&packet);
+}
+
+// ==================== CHAIN SYNC ====================
+
+// Oldest height whose block we still hold
+inline uint32_t heldBase() {
+    uint32_t ring = (totalBlocks > MAX_BLOCKS) ? totalBlocks - MAX_BLOCKS : 0;
+    return (chainBase > ring) ? chainBase : ring;
+}
+
+// Wire form of a block: fixed fields, then only the txCount hashes in use
+uint16_t encodeBlock(const Block* block, uint8_t* out) {
+    size_t head = offsetof(Block, txHashes);
+    memcpy(out, block, head);
+    memcpy(out + head, &block->txCount, BLOCK_HEADER_BYTES - head);
+    memcpy(out + BLOCK_HEADER_BYTES, block->txHashes, sizeof(Hash32) * block->txCount);
+    return blockEncodedSize(block->txCount);
+}
+
+bool decodeBlock(const uint8_t* data, uint16_t len, Block* out) {
+    if(len < BLOCK_HEADER_BYTES) return false;
+    
+    size_t head = offsetof(Block, txHashes);
+    memset(out, 0, sizeof(Block));
+    memcpy(out, data, head);
+    memcpy(&out->txCount, data + head, BLOCK_HEADER_BYTES - head);
+    if(out->txCount > MAX_TX_PER_BLOCK || len != blockEncodedSize(out->txCount)) return false;
+    
+    memcpy(out->txHashes, data + BLOCK_HEADER_BYTES, sizeof(Hash32) * out->txCount);
+    out->validator[sizeof(out->validator) - 1] = '\0';
+    return true;
+}
+
+// Undo what committing the blocks from height up did: their log records go
+// back to the pool, where the winning chain can include them again
+void unwindCommitted(uint32_t height) {
+    // The dropped blocks' records are the log's tail while their zones tile it
+    uint32_t cut = txLogCount;
+    for(uint32_t h = totalBlocks; h > height; h--) {
+        BlockZone* zone = &blockZones[(h - 1) % MAX_BLOCKS];
+        if(zone->recordCount == 0) continue;
+        if(zone->firstRecord + zone->recordCount != cut) break;
+        cut = zone->firstRecord;
+    }
+    if(cut == txLogCount) return;
+    
+    File log = openTxLog("r+");
+    if(!log) return;
+    
+    Transaction tx;
+    uint8_t repooled = 0;
+    uint8_t lost = 0;
+    for(uint32_t record = cut; record < txLogCount; record++) {
+        if(!readTxLog(log, record, &tx)) continue;
+        mempoolStats.committed -= tx.readingCount;
+        rollupUnwind(&tx);
+        
+        uint32_t seq = LOC_NONE;
+        if(txPoolCount < TX_POOL_SIZE) {
+            seq = txPoolNextSeq++;
+            *txPoolSeqAt(txPoolCount) = seq;
+            *txPoolArrivalAt(txPoolCount) = millis() / 1000;
+            *txPoolAt(txPoolCount++) = tx;
+            repooled++;
+        } else {
+            lost++;
+        }
+        for(uint8_t r = 0; r < tx.readingCount; r++) {
+            uint32_t newLoc = (seq == LOC_NONE) ? LOC_NONE : makeLoc(true, seq, r);
+            indexRelocate(tx.sensor, tx.readings[r].timestamp, makeLoc(false, record, r), newLoc);
+        }
+    }
+    
+    txLogCount = cut;
+    log.seek(0);
+    log.write((uint8_t*)&txLogCount, sizeof(txLogCount));
+    log.close();
+    
+    Serial.printf("⚠️  %u txs from dropped blocks back in the pool", repooled);
+    if(lost > 0) Serial.printf(", %u lost (pool full)", lost);
+    Serial.println();
+}
+
+// Drop blocks from height on (the losing side of a fork)
+void truncateChain(uint32_t height) {
+    unwindCommitted(height);
+    chainBase = heldBase();     // Ring slots below the cut now hold dropped blocks
+    for(uint32_t h = height; h < totalBlocks; h++) {
+        memset(&blockZones[h % MAX_BLOCKS], 0, sizeof(BlockZone));
+    }
+    blockCount -= totalBlocks - height;
+    totalBlocks = height;
+    if(chainBase > totalBlocks) chainBase = totalBlocks;
+    rebuildSeenTxSet();
+    
+    Serial.printf("⚠️  Chain rolled back to #%u (fork)\n", height);
+}
+
+// Restart our chain just below height; the next block links to prevHash
+void fastForwardChain(uint32_t height, const uint8_t* prevHash) {
+    memset(blockchain, 0, sizeof(blockchain));
+    memset(blockZones, 0, sizeof(blockZones));
+    
+    Block* anchor = &blockchain[(height - 1) % MAX_BLOCKS];
+    memset(anchor, 0, sizeof(Block));
+    anchor->index = height - 1;
+    memcpy(anchor->blockHash, prevHash, 32);
+    
+    blockCount = height;
+    totalBlocks = height;
+    chainBase = height;
+    rebuildSeenTxSet();
+    
+    Serial.printf("⚠️  Chain fast-forwarded to #%u\n", height);
+}
+
+void sendChainRequest(uint8_t kind, uint32_t from, uint16_t count, uint8_t flags) {
+    ChainRequest req;
+    req.session = chainSync.session;
+    req.kind = kind;
+    req.flags = flags;
+    req.from = from;
+    req.count = count;
+    
+    NetworkPacket packet;
+    packet.type = MSG_REQUEST_CHAIN;
+    memcpy(packet.data, &req, sizeof(req));
+    packet.dataLen = sizeof(req);
+    sendToPeer(chainSync.peer, &packet);
+    
+    if(kind == SYNC_BODIES) chainSync.acked = from;
+    chainSync.lastActivity = millis();
+}
+
+// Catch up with a peer whose chain is longer than ours
+void startChainSync(const uint8_t* mac, uint32_t peerHeight) {
+    if(peerHeight <= totalBlocks) return;
+    if(chainSync.active) {
+        if(memcmp(chainSync.peer, mac, 6) == 0 && peerHeight > chainSync.peerHeight) {
+            chainSync.peerHeight = peerHeight;
+        }
+        return;
+    }
+    
+    memset(&chainSync, 0, sizeof(chainSync));
+    if(pendingBlock.synced) pendingBlock.active = false;   // Left over from an earlier sync
+    chainSync.active = true;
+    chainSync.kind = SYNC_HEADERS;
+    memcpy(chainSync.peer, mac, 6);
+    chainSync.session = (uint16_t)esp_random();
+    chainSync.from = (totalBlocks > SYNC_OVERLAP) ? totalBlocks - SYNC_OVERLAP : 0;
+    chainSync.peerHeight = peerHeight;
+    chainSync.startedAt = millis();
+    
+    Serial.printf("🔄 Chain sync #%u -> #%u from %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  totalBlocks, peerHeight, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    sendChainRequest(SYNC_HEADERS, chainSync.from, MAX_BLOCKS, SYNC_RESTART);
+}
+
+void finishChainSync(bool ok) {
+    chainSync.active = false;
+    if(ok) {
+        Serial.printf("✓ Chain synced to #%u in %lu ms\n", totalBlocks, millis() - chainSync.startedAt);
+    } else {
+        Serial.printf("✗ Chain sync stalled at #%u\n", totalBlocks);
+    }
+    saveBlockchain();
+    
+    // The peer may have moved on, or held more than one download covers
+    if(ok && chainSync.peerHeight > totalBlocks) {
+        startChainSync(chainSync.peer, chainSync.peerHeight);
+    }
+}
+
+// Headers are in: find where our chain and the peer's part, then fetch bodies
+void beginBodyDownload() {
+    uint32_t held = heldBase();
+    uint32_t first = (chainSync.from > held) ? chainSync.from : held;
+    uint32_t start = totalBlocks;
+    
+    if(chainSync.from > totalBlocks) {
+        // Peer no longer holds the blocks after our tip
+        start = chainSync.from;
+        chainSync.fastForward = true;
+    } else {
+        for(uint32_t h = first; h < totalBlocks && h < chainSync.tip; h++) {
+            if(memcmp(blockchain[h % MAX_BLOCKS].blockHash, chainSync.hashes[h - chainSync.from], 32) != 0) {
+                start = h;
+                break;
+            }
+        }
+        
+        if(start == first && start < totalBlocks) {
+            if(first > held) {
+                // Fork is older than the overlap we checked; look further back
+                memset(chainSync.headerSeen, 0, sizeof(chainSync.headerSeen));
+                chainSync.headersReceived = 0;
+                chainSync.tip = 0;
+                chainSync.from = held;
+                chainSync.retries = 0;
+                sendChainRequest(SYNC_HEADERS, held, MAX_BLOCKS, SYNC_RESTART);
+                return;
+            }
+            // Nothing we hold is on the peer's chain: take its chain instead
+            start = chainSync.from;
+            if(start > 0) chainSync.fastForward = true;
+        }
+        if(!chainSync.fastForward && start < totalBlocks) truncateChain(start);
+    }
+    
+    chainSync.kind = SYNC_BODIES;
+    chainSync.nextApply = start;
+    chainSync.retries = 0;
+    if(start >= chainSync.tip) {
+        finishChainSync(true);
+        return;
+    }
+    sendChainRequest(SYNC_BODIES, start, SYNC_WINDOW, SYNC_RESTART);
+}
+
+// Bodies carry only tx hashes: ask the sync peer for the txs our pool lacks,
+// so the block is logged and indexed like a relayed one. False if none are missing.
+bool fetchSyncedTxs(const Block* block) {
+    uint32_t missing = 0;
+    for(uint8_t i = 0; i < block->txCount; i++) {
+        bool found = false;
+        for(uint8_t p = 0; p < txPoolCount && !found; p++) {
+            found = memcmp(txPoolAt(p)->txHash, block->txHashes[i], 32) == 0;
+        }
+        if(!found) missing |= 1UL << i;
+    }
+    if(missing == 0) return false;
+    
+    memset(&pendingBlock, 0, sizeof(pendingBlock));
+    pendingBlock.block = *block;
+    pendingBlock.missing = missing;
+    pendingBlock.synced = true;
+    memcpy(pendingBlock.peer, chainSync.peer, 6);
+    pendingBlock.active = true;
+    requestBlockTxn();
+    return true;
+}
+
+// Add the next synced block; false once the sync is over
+bool applySyncedBlock(Block* block) {
+    if(!addBlock(block)) {
+        finishChainSync(false);
+        return false;
+    }
+    
+    chainSync.nextApply++;
+    chainSync.retries = 0;
+    chainSync.lastActivity = millis();
+    if(chainSync.nextApply >= chainSync.tip) {
+        finishChainSync(true);
+        return false;
+    }
+    return true;
+}
+
+// Add every complete block at the front of the window, then slide it
+void applySyncedBlocks() {
+    while(chainSync.active) {
+        if(pendingBlock.active && pendingBlock.synced) return;     // Still fetching its txs
+        
+        SyncSlot* slot = &chainSync.slots[chainSync.nextApply % SYNC_WINDOW];
+        if(slot->parts == 0 || slot->height != chainSync.nextApply ||
+           slot->received != (1 << slot->parts) - 1) break;
+        
+        Block block;
+        bool intact = decodeBlock(slot->data, slot->len, &block) &&
+                      block.index == chainSync.nextApply &&
+                      memcmp(block.blockHash, chainSync.hashes[block.index - chainSync.from], 32) == 0;
+        slot->parts = 0;
+        if(!intact) {
+            sendChainRequest(SYNC_BODIES, chainSync.nextApply, SYNC_WINDOW, SYNC_RESTART);
+            return;
+        }
+        
+        if(chainSync.fastForward) {
+            fastForwardChain(block.index, block.previousHash);
+            chainSync.fastForward = false;
+        }
+        if(fetchSyncedTxs(&block)) return;      // completePendingBlock() picks up from here
+        if(!applySyncedBlock(&block)) return;
+    }
+    
+    // Acknowledge half a window at a time so the stream never drains
+    if(chainSync.active && chainSync.nextApply >= chainSync.acked + SYNC_WINDOW / 2) {
+        sendChainRequest(SYNC_BODIES, chainSync.nextApply, SYNC_WINDOW, 0);
+    }
+}
+
+void handleChainRequest(const uint8_t* mac, const PacketView* packet) {
+    const ChainRequest* req = viewAs<ChainRequest>(packet);
+    if(req == NULL) return;
+    
+    if(req->kind > SYNC_BODIES) return;
+    bool sameClient = chainServe.active && memcmp(chainServe.mac, mac, 6) == 0 &&
+                      chainServe.session == req->session;
+    
+    // One client at a time; others retry after their timeout
+    if(chainServe.active && !sameClient && millis() - chainServe.lastRequest < SYNC_TIMEOUT_MS) return;
+    
+    uint32_t base = heldBase();
+    uint32_t from = (req->from > base) ? req->from : base;
+    uint32_t end = (from + req->count < totalBlocks) ? from + req->count : totalBlocks;
+    
+    // An acknowledgement only slides the window; the stream continues where it is
+    if(!sameClient || req->kind != chainServe.kind || (req->flags & SYNC_RESTART) ||
+       chainServe.next < from) {
+        chainServe.next = from;
+        chainServe.part = 0;
+    }
+    memcpy(chainServe.mac, mac, 6);
+    chainServe.session = req->session;
+    chainServe.kind = req->kind;
+    chainServe.end = end;
+    chainServe.lastRequest = millis();
+    chainServe.active = true;
+}
+
+void handleChainHeaders(const ChainHeaders* frame, uint16_t len) {
+    if(len < offsetof(ChainHeaders, hashes) || frame->count > SYNC_HEADERS_PER_FRAME ||
+       len < offsetof(ChainHeaders, hashes) + sizeof(Hash32) * frame->count) return;
+    
+    if(chainSync.tip == 0) {
+        if(frame->tip <= totalBlocks) {
+            // Peer isn't ahead after all
+            chainSync.active = false;
+            return;
+        }
+        if(frame->base > chainSync.from) chainSync.from = frame->base;
+        chainSync.tip = frame->tip;
+        if(chainSync.tip - chainSync.from > MAX_BLOCKS) chainSync.tip = chainSync.from + MAX_BLOCKS;
+    }
+    
+    for(uint8_t i = 0; i < frame->count; i++) {
+        uint32_t h = frame->from + i;
+        if(h < chainSync.from || h >= chainSync.tip) continue;
+        
+        uint32_t slot = h - chainSync.from;
+        if(chainSync.headerSeen[slot / 8] & (1 << (slot % 8))) continue;
+        chainSync.headerSeen[slot / 8] |= 1 << (slot % 8);
+        memcpy(chainSync.hashes[slot], frame->hashes[i], 32);
+        chainSync.headersReceived++;
+    }
+    chainSync.retries = 0;
+    chainSync.lastActivity = millis();
+    
+    if(chainSync.headersReceived == chainSync.tip - chainSync.from) beginBodyDownload();
+}
+
+void handleChainBody(const ChainBody* frame, uint16_t len) {
+    if(len <= offsetof(ChainBody, data)) return;
+    uint16_t n = len - offsetof(ChainBody, data);
+    
+    uint32_t h = frame->height;
+    if(h < chainSync.nextApply || h >= chainSync.nextApply + SYNC_WINDOW || h >= chainSync.tip) return;
+    if(frame->parts == 0 || frame->part >= frame->parts ||
+       frame->parts > (sizeof(Block) + SYNC_CHUNK - 1) / SYNC_CHUNK ||
+       (uint32_t)frame->part * SYNC_CHUNK + n > sizeof(Block) ||
+       (frame->part + 1 < frame->parts && n != SYNC_CHUNK)) return;
+    
+    SyncSlot* slot = &chainSync.slots[h % SYNC_WINDOW];
+    if(slot->parts == 0 || slot->height != h) {
+        slot->height = h;
+        slot->parts = frame->parts;
+        slot->received = 0;
+        slot->len = 0;
+    }
+    if(frame->parts != slot->parts || (slot->received & (1 << frame->part))) return;
+    
+    memcpy(slot->data + frame->part * SYNC_CHUNK, frame->data, n);
+    slot->received |= 1 << frame->part;
+    slot->len += n;
+    
+    applySyncedBlocks();
+    
+    // The window's last frame arrived but its front is still missing a part:
+    // restart there now rather than waiting out the timeout
+    if(chainSync.active && chainSync.kind == SYNC_BODIES && h > chainSync.nextApply &&
+       h + 1 == chainSync.acked + SYNC_WINDOW && frame->part + 1 == frame->parts) {
+        sendChainRequest(SYNC_BODIES, chainSync.nextApply, SYNC_WINDOW, SYNC_RESTART);
+    }
+}
+
+void handleChainData(const uint8_t* mac, const PacketView* packet) {
+    if(!chainSync.active || memcmp(chainSync.peer, mac, 6) != 0) return;
+    const ChainRequest* head = viewAs<ChainRequest>(packet, 3);   // session + kind
+    if(head == NULL || head->session != chainSync.session) return;
+    
+    uint8_t kind = head->kind;
+    if(kind != chainSync.kind) return;
+    if(kind == SYNC_HEADERS) {
+        handleChainHeaders((const ChainHeaders*)packet->data, packet->dataLen);
+    } else {
+        handleChainBody((const ChainBody*)packet->data, packet->dataLen);
+    }
+}
+
+// Stream frames for the client we serve, and retransmit our own stalled requests
+void chainSyncTask() {
+    unsigned long now = millis();
+    
+    if(chainServe.active && now - chainServe.lastRequest >= SYNC_TIMEOUT_MS * SYNC_RETRIES) {
+        chainServe.active = false;
+    }
+    
+    for(uint8_t sent = 0; chainServe.active && sent < SYNC_FRAMES_PER_PASS &&
+                          chainServe.next < chainServe.end && txQueueHasRoom(); sent++) {
+        // A fork or our own mining can move the range we hold
+        if(chainServe.next < heldBase() || chainServe.end > totalBlocks) {
+            chainServe.end = chainServe.next;
+            break;
+        }
+        
+        NetworkPacket packet;
+        packet.type = MSG_CHAIN_DATA;
+        
+        if(chainServe.kind == SYNC_HEADERS) {
+            ChainHeaders* frame = (ChainHeaders*)packet.data;
+            uint32_t left = chainServe.end - chainServe.next;
+            frame->session = chainServe.session;
+            frame->kind = SYNC_HEADERS;
+            frame->count = (left < SYNC_HEADERS_PER_FRAME) ? left : SYNC_HEADERS_PER_FRAME;
+            frame->base = heldBase();
+            frame->tip = chainServe.end;
+            frame->from = chainServe.next;
+            for(uint8_t i = 0; i < frame->count; i++) {
+                memcpy(frame->hashes[i], blockchain[(chainServe.next + i) % MAX_BLOCKS].blockHash, 32);
+            }
+            packet.dataLen = offsetof(ChainHeaders, hashes) + sizeof(Hash32) * frame->count;
+            chainServe.next += frame->count;
+        } else {
+            uint8_t encoded[sizeof(Block)];
+            uint16_t len = encodeBlock(&blockchain[chainServe.next % MAX_BLOCKS], encoded);
+            uint16_t offset = chainServe.part * SYNC_CHUNK;
+            uint16_t n = (len - offset < SYNC_CHUNK) ? len - offset : SYNC_CHUNK;
+            
+            ChainBody* frame = (ChainBody*)packet.data;
+            frame->session = chainServe.session;
+            frame->kind = SYNC_BODIES;
+            frame->part = chainServe.part;
+            frame->parts = (len + SYNC_CHUNK - 1) / SYNC_CHUNK;
+            frame->height = chainServe.next;
+            memcpy(frame->data, encoded + offset, n);
+            packet.dataLen = offsetof(ChainBody, data) + n;
+            
+            if(++chainServe.part == frame->parts) {
+                chainServe.part = 0;
+                chainServe.next++;
+            }
+        }
+        sendToPeer(chainServe.mac, &packet);
+    }
+    
+    // A body waiting on its txs times out through compactBlockTask() instead
+    bool fetchingTxs = pendingBlock.active && pendingBlock.synced;
+    if(chainSync.active && !fetchingTxs && now - chainSync.lastActivity >= SYNC_TIMEOUT_MS) {
+        if(chainSync.retries++ >= SYNC_RETRIES) {
+            finishChainSync(false);
+        } else if(chainSync.kind == SYNC_HEADERS) {
+            // Ask again from the first hash still missing
+            uint32_t missing = 0;
+            while(missing < MAX_BLOCKS && (chainSync.headerSeen[missing / 8] & (1 << (missing % 8)))) missing++;
+            uint16_t count = chainSync.tip ? chainSync.tip - chainSync.from - missing : MAX_BLOCKS;
+            sendChainRequest(SYNC_HEADERS, chainSync.from + missing, count, SYNC_RESTART);
+        } else {
+            sendChainRequest(SYNC_BODIES, chainSync.nextApply, SYNC_WINDOW, SYNC_RESTART);
+        }
+    }
+}
+
+// ==================== COMPACT BLOCKS ====================
+
+// A committed tx by hash: still in our pool, or among the block's tx log records
+bool findBlockTx(uint32_t height, const uint8_t* hash, File& log, Transaction* out) {
+    for(uint8_t i = 0; i < txPoolCount; i++) {
+        if(memcmp(txPoolAt(i)->txHash, hash, 32) == 0) {
+            *out = *txPoolAt(i);
+            return true;
+        }
+    }
+    
+    BlockZone* zone = &blockZones[height % MAX_BLOCKS];
+    for(uint32_t r = zone->firstRecord; r < zone->firstRecord + zone->recordCount; r++) {
+        if(readTxLog(log, r, out) && memcmp(out->txHash, hash, 32) == 0) return true;
+    }
+    return false;
+}
+
+void requestBlockTxn() {
+    BlockTxnRequest req;
+    req.height = pendingBlock.block.index;
+    memcpy(req.blockId, pendingBlock.block.blockHash, SHORT_ID_BYTES);
+    req.missing = pendingBlock.missing;
+    
+    NetworkPacket packet;
+    packet.type = MSG_GET_BLOCK_TXN;
+    memcpy(packet.data, &req, sizeof(req));
+    packet.dataLen = sizeof(req);
+    sendToPeer(pendingBlock.peer, &packet);
+    
+    relayStats.compactBytes += sizeof(req);
+    pendingBlock.requestedAt = millis();
+}
+
+// Every tx hash is in place: check the rebuilt block, then commit it
+void completePendingBlock() {
+    Block* block = &pendingBlock.block;
+    Block check = *block;
+    calculateBlockHash(&check);
+    
+    if(memcmp(check.blockHash, block->blockHash, 32) != 0) {
+        if(!pendingBlock.fullRefetch && block->txCount > 0) {
+            pendingBlock.fullRefetch = true;
+            pendingBlock.missing = (1UL << block->txCount) - 1;
+            pendingBlock.txBytes = 0;
+            pendingBlock.retries = 0;
+            requestBlockTxn();
+            return;
+        }
+        Serial.printf("✗ Compact block #%u does not match its hash\n", block->index);
+        pendingBlock.active = false;
+        return;
+    }
+    
+    pendingBlock.active = false;
+    if(pendingBlock.synced) {
+        if(chainSync.active && block->index == chainSync.nextApply && applySyncedBlock(block)) {
+            applySyncedBlocks();
         }
+        return;
     }
+    if(block->index != totalBlocks) return;     // Chain moved on while we waited
     
-    Block tempBlock = *block;
-    calculateBlockHash(&tempBlock);
-    
-    if (memcmp(tempBlock.blockHash, block->blockHash, 32) != 0) {
-        Serial.println("✗ Block hash invalid");
-        return false;
+    if(addBlock(block)) {
+        lastBlockTime = millis();
+        relayStats.blocks++;
+        relayStats.fullBytes += blockEncodedSize(block->txCount) + pendingBlock.txBytes;
     }
-    
-    return true;
 }
 
-bool addBlock(Block* newBlock) {
-    if(!validateBlock(newBlock)) {
-        return false;
+void handleCompactBlock(const uint8_t* mac, const PacketView* packet) {
+    const CompactBlock* compact = viewAs<CompactBlock>(packet, offsetof(CompactBlock, shortIds));
+    if(compact == NULL || compact->txCount > MAX_TX_PER_BLOCK ||
+       packet->dataLen < offsetof(CompactBlock, shortIds) + SHORT_ID_BYTES * compact->txCount) return;
+    
+    Serial.printf("✓ Compact block received: #%u (%u tx)\n", compact->index, compact->txCount);
+    if(compact->index + 1 < totalBlocks) return;
+    
+    // A gap: let chain sync fetch what lies between
+    if(chainSync.active || compact->index > totalBlocks || blockCount == 0) {
+        startChainSync(mac, compact->index + 1);
+        return;
     }
     
-    uint32_t index = blockCount % MAX_BLOCKS;
-    blockchain[index] = *newBlock;
-    blockCount++;
-    totalBlocks++;
+    // Live blocks must come from this epoch's schedule; a chain the network
+    // builds on anyway still arrives through chain sync
+    if(!inValidatorSet(compact->validator)) {
+        Serial.printf("✗ Block #%u mined by %s, not a scheduled validator\n", compact->index, compact->validator);
+        return;
+    }
     
-    txPoolCount = 0;
+    // Same-height fork: the lower block hash wins on every node
+    Block* tip = &blockchain[(blockCount - 1) % MAX_BLOCKS];
+    if(compact->index + 1 == totalBlocks) {
+        if(compact->index < heldBase() || memcmp(compact->previousHash, tip->previousHash, 32) != 0 ||
+           memcmp(compact->blockHash, tip->blockHash, 32) >= 0) return;
+        Serial.printf("⚠️  Fork at #%u: the other block's hash is lower, switching\n", compact->index);
+        truncateChain(compact->index);
+        tip = &blockchain[(blockCount - 1) % MAX_BLOCKS];
+    }
     
-    Serial.printf("✓ Block #%u added (%d tx)\n", 
-                 newBlock->index, newBlock->txCount);
+    // Not on our tip: let chain sync sort out the fork
+    if(memcmp(compact->previousHash, tip->blockHash, 32) != 0) {
+        startChainSync(mac, compact->index + 1);
+        return;
+    }
+    if(pendingBlock.active && pendingBlock.block.index == compact->index) return;
+    
+    memset(&pendingBlock, 0, sizeof(pendingBlock));
+    Block* block = &pendingBlock.block;
+    block->index = compact->index;
+    block->timestamp = compact->timestamp;
+    block->txCount = compact->txCount;
+    memcpy(block->previousHash, compact->previousHash, 32);
+    memcpy(block->blockHash, compact->blockHash, 32);
+    memcpy(block->validator, compact->validator, sizeof(block->validator));
+    block->validator[sizeof(block->validator) - 1] = '\0';
+    block->nonce = compact->nonce;
+    
+    for(uint8_t i = 0; i < compact->txCount; i++) {
+        bool found = false;
+        for(uint8_t p = 0; p < txPoolCount && !found; p++) {
+            Transaction* tx = txPoolAt(p);
+            if(memcmp(tx->txHash, compact->shortIds[i], SHORT_ID_BYTES) == 0) {
+                memcpy(block->txHashes[i], tx->txHash, 32);
+                pendingBlock.txBytes += TX_WIRE_SIZE(tx->readingCount);
+                found = true;
+            }
+        }
+        if(found) relayStats.txRebuilt++;
+        else pendingBlock.missing |= 1UL << i;
+    }
     
-    // Save to SPIFFS after adding block
-    saveBlockchain();
+    memcpy(pendingBlock.peer, mac, 6);
+    pendingBlock.active = true;
+    relayStats.compactBytes += packet->dataLen;
     
-    return true;
+    if(pendingBlock.missing) requestBlockTxn();
+    else completePendingBlock();
 }
 
-Block createBlock() {
-    Block newBlock = {0};
-    newBlock.index = totalBlocks;
-    newBlock.timestamp = millis() / 1000;
+void handleGetBlockTxn(const uint8_t* mac, const PacketView* packet) {
+    const BlockTxnRequest* req = viewAs<BlockTxnRequest>(packet);
+    if(req == NULL) return;
     
-    newBlock.txCount = (txPoolCount < MAX_TX_PER_BLOCK) ? txPoolCount : MAX_TX_PER_BLOCK;
-
-    for (int i = 0; i < newBlock.txCount; ++i) {
-        memcpy(newBlock.txHashes[i], txPool[i].txHash, 32);
-    }
-
-    if(blockCount > 0) {
-        Block* prevBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
-        memcpy(newBlock.previousHash, prevBlock->blockHash, 32);
-    } else {
-        memset(newBlock.previousHash, 0, 32);
-    }
+    if(req->height >= totalBlocks || req->height < heldBase()) return;
     
-    strcpy(newBlock.validator, myAddress);
-    newBlock.nonce = random(0, 1000000);
+    Block* block = &blockchain[req->height % MAX_BLOCKS];
+    if(memcmp(block->blockHash, req->blockId, SHORT_ID_BYTES) != 0) return;
     
-    calculateBlockHash(&newBlock);
+    uint32_t missing = req->missing & ((1UL << block->txCount) - 1);
     
-    return newBlock;
+    // Neighbors that missed the same txs ask together: answer them all with broadcasts
+    if(blockTxnServe.active && blockTxnServe.height == req->height &&
+       memcmp(blockTxnServe.mac, mac, 6) != 0) {
+        memset(blockTxnServe.mac, 0xFF, 6);
+        blockTxnServe.missing |= missing;
+        return;
+    }
+    
+    // Otherwise one requester at a time, like the other servers; the rest re-request
+    memcpy(blockTxnServe.mac, mac, 6);
+    blockTxnServe.height = req->height;
+    blockTxnServe.missing = missing;
+    blockTxnServe.active = true;
 }
 
-// ==================== TELEMETRY FUNCTIONS ====================
-
-Transaction createTelemetryTransaction() {
-    Transaction tx = {0};
+void handleBlockTxn(const uint8_t* mac, const PacketView* packet) {
+    if(!pendingBlock.active || memcmp(pendingBlock.peer, mac, 6) != 0) return;
+    const BlockTxn* msg = viewAs<BlockTxn>(packet, offsetof(BlockTxn, tx) + TX_WIRE_SIZE(1));
+    if(msg == NULL) return;
     
-    snprintf(tx.data.sensorId, sizeof(tx.data.sensorId), "ESP_%s", myAddress + 9);
-    tx.data.temperature = 20.0 + random(-50, 150) / 10.0;
-    tx.data.humidity = 40.0 + random(0, 400) / 10.0;
-    tx.data.pressure = 1013.25 + random(-100, 100) / 10.0;
-    tx.data.batteryVoltage = 3.3 + random(-3, 3) / 10.0;
-    tx.data.timestamp = millis() / 1000;
-    tx.data.rssi = WiFi.RSSI();
-    tx.data.dataQuality = 95 + random(0, 5);
+    if(msg->height != pendingBlock.block.index || msg->position >= pendingBlock.block.txCount) return;
+    uint32_t bit = 1UL << msg->position;
+    if(!(pendingBlock.missing & bit)) return;
+    if(msg->tx.readingCount == 0 || msg->tx.readingCount > TX_BATCH_MAX ||
+       packet->dataLen < offsetof(BlockTxn, tx) + TX_WIRE_SIZE(msg->tx.readingCount)) return;
     
+    Transaction tx;
+    copyTransaction(&tx, &msg->tx);
     calculateTxHash(&tx);
-    signTransaction(&tx);
-    tx.verified = false;
+    if(memcmp(tx.txHash, msg->tx.txHash, 32) != 0) return;
+    
+    pendingBlock.missing &= ~bit;
+    pendingBlock.retries = 0;
+    if(pendingBlock.synced) {
+        // The body already named this tx's hash
+        if(memcmp(tx.txHash, pendingBlock.block.txHashes[msg->position], 32) != 0) {
+            pendingBlock.missing |= bit;
+            return;
+        }
+        chainSync.lastActivity = millis();
+    } else {
+        memcpy(pendingBlock.block.txHashes[msg->position], tx.txHash, 32);
+        pendingBlock.txBytes += TX_WIRE_SIZE(tx.readingCount);
+        relayStats.txFetched++;
+        relayStats.compactBytes += packet->dataLen;
+    }
     
-    return tx;
+    // Pool it so the commit logs and indexes it like any other tx
+    addToTxPool(&tx);
+    
+    if(!pendingBlock.missing) completePendingBlock();
 }
 
-bool addToTxPool(Transaction* tx) {
-    if(txPoolCount >= TX_POOL_SIZE) {
-        Serial.println("✗ Transaction pool full");
-        return false;
+// Send the block txs a peer asked for, and re-request our own missing ones
+void compactBlockTask() {
+    if(blockTxnServe.active) {
+        uint32_t height = blockTxnServe.height;
+        if(height >= totalBlocks || height < heldBase()) blockTxnServe.missing = 0;
+        
+        File log = openTxLog(FILE_READ);
+        for(uint8_t sent = 0; sent < SYNC_FRAMES_PER_PASS && blockTxnServe.missing && txQueueHasRoom(); ) {
+            uint8_t position = __builtin_ctz(blockTxnServe.missing);
+            blockTxnServe.missing &= ~(1UL << position);
+            
+            NetworkPacket packet;
+            BlockTxn* reply = (BlockTxn*)packet.data;
+            if(!findBlockTx(height, blockchain[height % MAX_BLOCKS].txHashes[position], log, &reply->tx)) continue;
+            
+            reply->height = height;
+            reply->position = position;
+            packet.type = MSG_BLOCK_TXN;
+            packet.dataLen = offsetof(BlockTxn, tx) + TX_WIRE_SIZE(reply->tx.readingCount);
+            sendToPeer(blockTxnServe.mac, &packet);
+            sent++;
+        }
+        if(log) log.close();
+        
+        if(!blockTxnServe.missing) blockTxnServe.active = false;
     }
     
-    txPool[txPoolCount++] = *tx;
-    
-    Serial.printf("✓ TX added to pool: %s (%.1f°C)\n", 
-                 tx->data.sensorId, tx->data.temperature);
-    
-    return true;
+    if(pendingBlock.active && millis() - pendingBlock.requestedAt >= BLOCK_TXN_TIMEOUT_MS) {
+        if(pendingBlock.synced && pendingBlock.retries >= BLOCK_TXN_RETRIES) {
+            // The peer no longer holds them: keep the block, without its txs
+            Serial.printf("⚠️  Synced block #%u: %u txs unavailable, added without them\n",
+                          pendingBlock.block.index, __builtin_popcount(pendingBlock.missing));
+            pendingBlock.missing = 0;
+            completePendingBlock();
+        } else if(pendingBlock.retries++ >= BLOCK_TXN_RETRIES) {
+            Serial.printf("⚠️  Block #%u txs unavailable, syncing chain\n", pendingBlock.block.index);
+            pendingBlock.active = false;
+            startChainSync(pendingBlock.peer, pendingBlock.block.index + 1);
+        } else {
+            requestBlockTxn();
+        }
+    }
 }
 
-void queryTelemetryData(const char* sensorId, uint32_t startTime, uint32_t endTime) {
-    Serial.printf("\n=== Telemetry Query: %s ===\n", sensorId);
-    int count = 0;
-
-    for (int i = 0; i < txPoolCount; i++) {
-        Transaction* tx = &txPool[i];
+// ==================== CONSENSUS ====================
 
-        if(strcmp(tx->data.sensorId, sensorId) == 0 &&
-           tx->data.timestamp >= startTime &&
-           tx->data.timestamp <= endTime)
-        {
-            Serial.printf(" Temp: %.1f°C | Humidity: %.1f%% | Time: %u\n",
-                          tx->data.temperature,
-                          tx->data.humidity,
-                          tx->data.timestamp);
-            count++;
-        }
-    }
+// Validators are known by their heartbeats. The schedule is the sorted MACs of
+// those heard recently, fixed for an epoch of VALIDATOR_EPOCH_BLOCKS heights so
+// every node switches at the same block. Heartbeats also list the validators
+// their sender hears, so a node that missed some still schedules them from the
+// next epoch on; a schedule never changes mid-epoch.
 
-    Serial.printf("Found %d readings\n\n", count);
+inline unsigned long candidateLastSeen(const ValidatorCandidate* c) {
+    return (c->lastHeard > c->lastVouched) ? c->lastHeard : c->lastVouched;
 }
 
-// ==================== NETWORK FUNCTIONS ====================
+// Keep the set sorted; when full, the highest MACs give way
+bool validatorSetInsert(ValidatorSet* set, const uint8_t* mac) {
+    uint8_t i = 0;
+    while(i < set->count && memcmp(set->macs[i], mac, 6) < 0) i++;
+    if(i < set->count && memcmp(set->macs[i], mac, 6) == 0) return false;
+    if(i >= VALIDATOR_SET_MAX) return false;
+    
+    uint8_t last = (set->count < VALIDATOR_SET_MAX) ? set->count : VALIDATOR_SET_MAX - 1;
+    memmove(set->macs[i + 1], set->macs[i], (last - i) * 6);
+    memcpy(set->macs[i], mac, 6);
+    if(set->count < VALIDATOR_SET_MAX) set->count++;
+    return true;
+}
 
-void setupBroadcastPeer() {
-    if(broadcastPeerAdded) return;
-    
-    uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    esp_now_peer_info_t peerInfo = {};
-    memcpy(peerInfo.peer_addr, broadcastAddr, 6);
-    peerInfo.channel = 0;
-    peerInfo.encrypt = false;
-    
-    esp_err_t result = esp_now_add_peer(&peerInfo);
-    if(result == ESP_OK) {
-        broadcastPeerAdded = true;
-        Serial.println("✓ Broadcast peer added");
-    } else if(result != ESP_ERR_ESPNOW_EXIST) {
-        Serial.printf("✗ Failed to add broadcast peer: %d\n", result);
+// direct: its own heartbeat; otherwise another validator vouches for it
+void heardValidator(const uint8_t* mac, bool direct) {
+    ValidatorCandidate* slot = NULL;
+    for(uint8_t i = 0; i < validatorCandidateCount; i++) {
+        if(memcmp(validatorCandidates[i].mac, mac, 6) == 0) slot = &validatorCandidates[i];
+    }
+    if(slot == NULL) {
+        if(validatorCandidateCount < VALIDATOR_CANDIDATES) {
+            slot = &validatorCandidates[validatorCandidateCount++];
+        } else {
+            // Replace the longest silent
+            slot = &validatorCandidates[0];
+            for(uint8_t i = 1; i < VALIDATOR_CANDIDATES; i++) {
+                if(candidateLastSeen(&validatorCandidates[i]) < candidateLastSeen(slot)) {
+                    slot = &validatorCandidates[i];
+                }
+            }
+        }
+        memcpy(slot->mac, mac, 6);
+        slot->lastHeard = 0;
+        slot->lastVouched = 0;
+        if(!direct) scheduleStats.merged++;
     }
+    if(direct) slot->lastHeard = millis();
+    else slot->lastVouched = millis();
 }
 
-void onDataReceived(const uint8_t* mac, const uint8_t* data, int len) {
-    NetworkPacket* packet = (NetworkPacket*)data;
+// Rebuild the schedule once our chain enters a new epoch
+void updateValidatorSet() {
+    uint32_t epoch = totalBlocks / VALIDATOR_EPOCH_BLOCKS;
+    bool first = (validatorSet.count == 0);
+    if(!first && validatorSet.epoch == epoch) return;
     
-    bool peerExists = false;
-    for(int i = 0; i < peerCount; i++) {
-        if(memcmp(peerList[i], mac, 6) == 0) {
-            peerExists = true;
-            break;
+    unsigned long now = millis();
+    if(first && (long)(now - scheduleListenUntil) < 0) return;
+    
+    validatorSet.epoch = epoch;
+    validatorSet.count = 0;
+    for(uint8_t i = 0; i < validatorCandidateCount; i++) {
+        ValidatorCandidate* c = &validatorCandidates[i];
+        if((c->lastHeard && now - c->lastHeard < VALIDATOR_EXPIRY_MS) ||
+           (c->lastVouched && now - c->lastVouched < VALIDATOR_EXPIRY_MS)) {
+            validatorSetInsert(&validatorSet, c->mac);
         }
     }
-    if(!peerExists && peerCount < MAX_PEERS) {
-        memcpy(peerList[peerCount++], mac, 6);
-        Serial.printf("✓ New peer added: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    }
     
-    switch(packet->type) {
-        case MSG_NEW_TELEMETRY: {
-            Transaction* tx = (Transaction*)packet->data;
-            addToTxPool(tx);
-            break;
-        }
-        
-        case MSG_NEW_BLOCK: {
-            BlockHeader* header = (BlockHeader*)packet->data;
-            Serial.printf("✓ Block header received: #%u\n", header->index);
-            break;
-        }
-        
-        case MSG_REQUEST_CHAIN: {
-            Serial.println("Chain sync requested");
-            break;
-        }
-        
-        case MSG_PEER_ANNOUNCE: {
-            Serial.printf("Peer announced: %s\n", packet->sender);
-            break;
-        }
-    }
+    // Joining a running chain mid-epoch: the others' schedule has no slot for us until the boundary
+    bool joiningLate = first && validatorSet.count > 0 && totalBlocks > 1 &&
+                       totalBlocks % VALIDATOR_EPOCH_BLOCKS != 0;
+    if(MY_ROLE == VALIDATOR_NODE && !joiningLate) validatorSetInsert(&validatorSet, myMac);
+    scheduleStats.epochs++;
+    Serial.printf("✓ Epoch %u: %u validators\n", epoch, validatorSet.count);
 }
 
-void broadcastPacket(NetworkPacket* packet) {
-    strcpy(packet->sender, myAddress);
-    setupBroadcastPeer();
-    
-    uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    esp_err_t result = esp_now_send(broadcastAddr, (uint8_t*)packet, sizeof(NetworkPacket));
+// Whose block is next: the height's validator, or after SLOT_TIMEOUT_MS
+// without one, each following validator in turn
+const uint8_t* scheduledValidator(unsigned long now, uint32_t* passed) {
+    uint32_t turn = 0;
+    unsigned long waited = now - lastBlockTime;
+    if(waited >= BLOCK_TIME_MS) turn = (waited - BLOCK_TIME_MS) / SLOT_TIMEOUT_MS;
+    if(passed) *passed = turn;
+    return validatorSet.macs[(totalBlocks + turn) % validatorSet.count];
+}
+
+bool isMyTurnToValidate() {
+    updateValidatorSet();
+    if(validatorSet.count == 0) return false;
     
-    if(result != ESP_OK && result != ESP_ERR_ESPNOW_NOT_FOUND) {
-        Serial.printf("✗ Broadcast error: %d\n", result);
-    }
+    uint32_t passed;
+    return memcmp(scheduledValidator(millis(), &passed), myMac, 6) == 0;
 }
 
-void broadcastTelemetry(Transaction* tx) {
-    NetworkPacket packet;
-    packet.type = MSG_NEW_TELEMETRY;
-    memcpy(packet.data, tx, sizeof(Transaction));
-    packet.dataLen = sizeof(Transaction);
+// A block's validator field is its miner's myAddress
+bool inValidatorSet(const char* validator) {
+    updateValidatorSet();
+    if(validatorSet.count == 0) return true;    // No schedule yet to judge by
     
-    broadcastPacket(&packet);
+    for(uint8_t i = 0; i < validatorSet.count; i++) {
+        const uint8_t* m = validatorSet.macs[i];
+        char address[17];
+        snprintf(address, sizeof(address), "%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+        if(strcmp(address, validator) == 0) return true;
+    }
+    return false;
 }
 
-void broadcastBlock(Block* block) {
-    NetworkPacket packet;
-    packet.type = MSG_NEW_BLOCK;
+void validatorHeartbeatTask() {
+    if(MY_ROLE != VALIDATOR_NODE) return;
     
-    BlockHeader header;
-    header.index = block->index;
-    header.timestamp = block->timestamp;
-    header.txCount = block->txCount;
-    memcpy(header.blockHash, block->blockHash, 32);
-    memcpy(header.previousHash, block->previousHash, 32);
-    strcpy(header.validator, block->validator);
+    unsigned long now = millis();
+    if(lastHeartbeat != 0 && now - lastHeartbeat < HEARTBEAT_INTERVAL_MS) return;
+    lastHeartbeat = now;
+    updateValidatorSet();
     
-    memcpy(packet.data, &header, sizeof(BlockHeader));
-    packet.dataLen = sizeof(BlockHeader);
+    NetworkPacket packet;
+    packet.type = MSG_VALIDATOR_HEARTBEAT;
+    // Vouch only for validators we hear ourselves, so a silent one ages out everywhere
+    ValidatorSet heard = {0};
+    validatorSetInsert(&heard, myMac);
+    for(uint8_t i = 0; i < validatorCandidateCount; i++) {
+        ValidatorCandidate* c = &validatorCandidates[i];
+        if(c->lastHeard && now - c->lastHeard < VALIDATOR_EXPIRY_MS) validatorSetInsert(&heard, c->mac);
+    }
     
-    broadcastPacket(&packet);
+    ValidatorHeartbeat* beat = (ValidatorHeartbeat*)packet.data;
+    memcpy(beat->validator, myMac, 6);
+    beat->epoch = validatorSet.epoch;
+    beat->height = totalBlocks;
+    beat->count = heard.count;
+    memcpy(beat->macs, heard.macs, heard.count * 6);
+    packet.dataLen = offsetof(ValidatorHeartbeat, macs) + heard.count * 6;
     
-    Serial.println("✓ Block header broadcast");
+    broadcastPacket(&packet);
 }
 
-// ==================== CONSENSUS ====================
-
-bool isMyTurnToValidate() {
-    if(peerCount == 0) return true;
-    
-    unsigned long interval = BLOCK_TIME_MS / 1000;
-    unsigned long currentSlot = (millis() / 1000) / interval;
-    
-    int myId = myAddress[15] % (peerCount + 1);
-    int validatorSlot = currentSlot % (peerCount + 1);
-    
-    return (myId == validatorSlot);
+void handleHeartbeat(const PacketView* packet) {
+    const ValidatorHeartbeat* beat = viewAs<ValidatorHeartbeat>(packet, offsetof(ValidatorHeartbeat, macs));
+    if(beat == NULL || beat->count > VALIDATOR_SET_MAX ||
+       packet->dataLen < offsetof(ValidatorHeartbeat, macs) + beat->count * 6) return;
+    if(memcmp(beat->validator, myMac, 6) == 0) return;
+    
+    // Candidates only: the schedule picks them up at the next epoch boundary
+    heardValidator(beat->validator, true);
+    for(uint8_t i = 0; i < beat->count; i++) {
+        if(memcmp(beat->macs[i], myMac, 6) != 0 && memcmp(beat->macs[i], beat->validator, 6) != 0) {
+            heardValidator(beat->macs[i], false);
+        }
+    }
 }
 
 void validatorTask() {
     if(MY_ROLE != VALIDATOR_NODE) return;
+    if(chainSync.active) return;    // Mine on the network's tip, not a stale one
     
     unsigned long now = millis();
     bool shouldMine = false;
     const char* reason = "";
     
-    if(txPoolCount >= (TX_POOL_SIZE - 4)) {
+    // Only the scheduled validator mines, even early for a full block, so two
+    // never race for one height
+    if(txPoolCount == 0 || !isMyTurnToValidate()) return;
+    
+    uint32_t passed = 0;
+    scheduledValidator(now, &passed);
+    if(txPoolCount >= blockTxCapacity(MAX_BLOCK_BYTES)) {
         shouldMine = true;
-        reason = "Emergency (pool nearly full)";
+        reason = "Full block pending";
     }
     else if(now - lastBlockTime >= BLOCK_TIME_MS) {
-        if(txPoolCount > 0 && isMyTurnToValidate()) {
-            shouldMine = true;
-            reason = "Scheduled";
-        }
+        shouldMine = true;
+        reason = passed ? "Scheduled (validator before us missed its slot)" : "Scheduled";
     }
     
-    if(shouldMine && txPoolCount > 0) {
+    if(shouldMine) {
         Serial.printf("\n⛏️  Mining new block (%d txs pending) - %s\n", txPoolCount, reason);
         
         Block newBlock = createBlock();
@@ -930,6 +6395,8 @@ void validatorTask() {
         if(addBlock(&newBlock)) {
             broadcastBlock(&newBlock);
             lastBlockTime = now;
+            scheduleStats.mined++;
+            if(passed) scheduleStats.takeovers++;
             
             Serial.printf("✓ Block #%u mined and broadcast\n", newBlock.index);
         }
@@ -943,31 +6410,55 @@ void sensorTask() {
     
     unsigned long now = millis();
     
-    if(now - lastTelemetryTime >= 10000) {
-        Transaction tx = createTelemetryTransaction();
+    if(now - lastTelemetryTime >= SENSOR_INTERVAL_MS) {
+        TelemetryData reading = sampleTelemetry();
         
-        addToTxPool(&tx);
-        broadcastTelemetry(&tx);
+        if(sensorBatch.readingCount == 0) {
+            sensorBatchStart = now;
+        }
+        appendReading(&sensorBatch, &reading);
         
         lastTelemetryTime = now;
     }
+    
+    // One hash, signature and broadcast per batch of readings
+    if(sensorBatch.readingCount > 0 &&
+       (sensorBatch.readingCount >= TX_BATCH_SIZE ||
+        now - sensorBatchStart >= TX_BATCH_WINDOW_MS)) {
+        Transaction tx = createTelemetryTransaction();
+        
+        if(addToTxPool(&tx)) announceTransaction(&tx, 0);
+    }
 }
 
 // ==================== PEER DISCOVERY ====================
 
+// Announcement payload: our sensorId and its handle, so peers can decode our
+// readings, and our chain height
+void buildPeerAnnounce(NetworkPacket* announce) {
+    PeerAnnounce self = {0};
+    snprintf(self.self.sensorId, sizeof(self.self.sensorId), "ESP_%s", myAddress + 9);
+    self.self.handle = internSensorId(self.self.sensorId);
+    self.height = totalBlocks;
+    if(blockCount > 0) memcpy(self.tipId, blockchain[(blockCount - 1) % MAX_BLOCKS].blockHash, SHORT_ID_BYTES);
+    
+    announce->type = MSG_PEER_ANNOUNCE;
+    strcpy(announce->sender, myAddress);
+    memcpy(announce->data, &self, sizeof(self));
+    announce->dataLen = sizeof(self);
+}
+
+// Besides the periodic announcement, a node announces as soon as its tip moves
+// (once a sync lands), so a neighbor beyond the blocks' flood range catches
+// up a hop at a time within seconds rather than an announce interval per hop
 void peerDiscoveryTask() {
     unsigned long now = millis();
     
-    if(now - lastAnnounceTime >= PEER_ANNOUNCE_INTERVAL) {
+    if(now - lastAnnounceTime >= PEER_ANNOUNCE_INTERVAL || (tipAnnounceDue && !chainSync.active)) {
+        tipAnnounceDue = false;
         NetworkPacket announce;
-        announce.type = MSG_PEER_ANNOUNCE;
-        strcpy(announce.sender, myAddress);
-        announce.dataLen = 0;
-        
-        setupBroadcastPeer();
-        
-        uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-        esp_now_send(broadcastAddr, (uint8_t*)&announce, sizeof(announce));
+        buildPeerAnnounce(&announce);
+        broadcastPacket(&announce);
         
         Serial.printf("📡 Peer announcement sent (peers: %d)\n", peerCount);
         lastAnnounceTime = now;
@@ -985,8 +6476,93 @@ void printStatus() {
                  MY_ROLE == SENSOR_NODE ? "SENSOR" : 
                  MY_ROLE == VALIDATOR_NODE ? "VALIDATOR" : "ARCHIVE");
     Serial.printf(" Blocks: %u (total: %u)\n", blockCount, totalBlocks);
+    if(chainSync.active) {
+        Serial.printf(" Chain sync: %s, #%u of %u\n",
+                      chainSync.kind == SYNC_HEADERS ? "headers" : "bodies",
+                      chainSync.nextApply, chainSync.tip);
+    }
+    if(validatorSet.count > 0) {
+        const uint8_t* next = scheduledValidator(millis(), NULL);
+        Serial.printf(" Schedule: epoch %u, %u validators, next %02X:%02X:%02X:%02X:%02X:%02X (%u mined, %u merged, %u takeovers)\n",
+                     validatorSet.epoch, validatorSet.count,
+                     next[0], next[1], next[2], next[3], next[4], next[5],
+                     scheduleStats.mined, scheduleStats.merged, scheduleStats.takeovers);
+    }
     Serial.printf(" TX Pool: %u / %d\n", txPoolCount, TX_POOL_SIZE);
-    Serial.printf(" Peers: %u connected\n", peerCount);
+    Serial.printf(" Readings: %u committed, %u evicted, %u rejected\n",
+                 mempoolStats.committed, mempoolStats.evicted, mempoolStats.rejected);
+    Serial.printf(" Duplicates dropped: %u (tracking %u hashes)\n",
+                 mempoolStats.duplicates, seenTxCount);
+    Serial.printf(" Rollups: %u sensors (%u late readings dropped)\n", sensorRollupCount, rollupLateDrops);
+    if(relayStats.blocks > 0) {
+        Serial.printf(" Block relay: %u blocks, %u tx from pool / %u fetched, %u bytes (full relay: %u)\n",
+                     relayStats.blocks, relayStats.txRebuilt, relayStats.txFetched,
+                     relayStats.compactBytes, relayStats.fullBytes);
+    }
+    
+    for(uint8_t i = 0; i < sensorLatencyCount; i++) {
+        SensorLatency* s = &sensorLatency[i];
+        char name[17];
+        sensorIdOf(s->sensor, name);
+        Serial.printf("   %s: %u included, avg %us, max %us\n",
+                     name, s->included,
+                     s->included ? s->totalDelay / s->included : 0, s->maxDelay);
+    }
+    
+    for(uint8_t i = 0; i < sensorStatsCount; i++) {
+        SensorStats* st = &sensorStats[i];
+        RunningStat* t = &st->field[STAT_TEMPERATURE];
+        RunningStat* h = &st->field[STAT_HUMIDITY];
+        RunningStat* v = &st->field[STAT_BATTERY];
+        char name[17];
+        sensorIdOf(st->sensor, name);
+        Serial.printf("   %s: T %.1f±%.1f°C (ewma %.1f, %+.2f/min) H %.1f±%.1f%% V %.2f (%+.3f/min), %u alarms\n",
+                     name, t->mean, statStddev(t), t->ewma, t->rate,
+                     h->mean, statStddev(h), v->ewma, v->rate, st->alarms);
+    }
+    
+    // Per-sensor sketches, then all sensors merged
+    if(sensorQuantilesCount > 0) {
+        Serial.println(" Quantiles:");
+        QuantileSketch all[QUANTILE_FIELDS];
+        memset(all, 0, sizeof(all));
+        
+        for(uint8_t i = 0; i < sensorQuantilesCount; i++) {
+            char name[17];
+            sensorIdOf(sensorQuantiles[i].sensor, name);
+            printQuantiles(name, sensorQuantiles[i].sketch);
+            for(uint8_t f = 0; f < QUANTILE_FIELDS; f++) {
+                sketchMerge(&all[f], &sensorQuantiles[i].sketch[f]);
+            }
+        }
+        if(sensorQuantilesCount > 1) printQuantiles("all sensors", all);
+    }
+    Serial.printf(" Peers: %u live, %u registered, %u expired, %u evicted\n",
+                 peerCount, espNowPeerCount, peersExpired, peersEvicted);
+    
+    Serial.printf(" Radio TX: %u messages in %u frames (%u saved), %u bytes\n",
+                 wireStats.messages, wireStats.airFrames,
+                 wireStats.messages - wireStats.airFrames, wireStats.airBytes);
+    Serial.printf(" Gossip: %u originated, %u received, %u relayed, %u duplicates, %u suppressed, %u dropped\n",
+                 gossipStats.originated, gossipStats.received, gossipStats.relayed,
+                 gossipStats.duplicates, gossipStats.suppressed, gossipStats.dropped);
+    Serial.printf(" Admission: %u rate-limited, %u malformed, %u invalid tx, %u over share, %u handle clash, %u ignored, %u bans, %u rx overflow\n",
+                 admissionStats.rateLimited, admissionStats.malformed, admissionStats.invalidTx,
+                 admissionStats.overShare, admissionStats.handleClash, admissionStats.ignored,
+                 admissionStats.bans, admissionStats.rxOverflow);
+    Serial.printf(" Inventory: %u announced, %u pushed, %u suppressed, %u pulled, %u covered, %u re-requested, %u served\n",
+                 invStats.announced, invStats.pushed, invStats.suppressed, invStats.requested,
+                 invStats.covered, invStats.rerequested, invStats.served);
+    Serial.printf(" Transport: %u/%u queued (peak %u), %u in flight, %u sent, %u acked, %u retries, %u failed, %u dropped, %u timeouts (%u late)\n",
+                 txQueueCount, TX_QUEUE_DEPTH, transportStats.peakDepth, txInFlight,
+                 transportStats.sent, transportStats.acked, transportStats.retries,
+                 transportStats.failed, transportStats.dropped, transportStats.timeouts,
+                 transportStats.late);
+    Serial.print("   by type (messages/bytes):");
+    for(uint8_t t = 0; t < MSG_TYPES; t++) {
+        if(wireStats.frames[t] > 0) Serial.printf(" %u: %u/%u", t, wireStats.frames[t], wireStats.bytes[t]);
+    }
+    Serial.println();
     
     if(blockCount > 0) {
         Block* lastBlock = &blockchain[(blockCount - 1) % MAX_BLOCKS];
@@ -1023,13 +6599,10 @@ void setup() {
         Serial.println("⚠️  Continuing without SPIFFS");
     }
     
-    // Initialize WiFi for ESP-NOW
-    WiFi.mode(WIFI_STA);
-    WiFi.disconnect();
-    
     // Get MAC address
     uint8_t mac[6];
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    memcpy(myMac, mac, 6);
     snprintf(myAddress, sizeof(myAddress), 
              "%02X:%02X:%02X:%02X:%02X:%02X",
              mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
@@ -1039,19 +6612,20 @@ void setup() {
     // Assign role
     assignNodeRole();
     
-    Serial.printf("Max TX per block: %d\n\n", MAX_TX_PER_BLOCK);
+    Serial.printf("Block size: %d-%d bytes (max %d tx)\n\n",
+                 MIN_BLOCK_BYTES, MAX_BLOCK_BYTES, blockTxCapacity(MAX_BLOCK_BYTES));
     
-    // Initialize ESP-NOW
-    if(esp_now_init() != ESP_OK) {
-        Serial.println("✗ ESP-NOW init failed");
+    // Bring up the radio
+    if(!radio.begin()) {
+        Serial.printf("✗ %s init failed\n", radio.name);
         return;
     }
-    
-    esp_now_register_recv_cb(onDataReceived);
+    Serial.printf("✓ Radio: %s\n", radio.name);
     
     // Try to load existing blockchain from SPIFFS
     bool loaded = false;
     if(spiffsInitialized) {
+        loadSensorRegistry();
         loaded = loadBlockchain();
         if(loaded) {
             loadTxPool();  // Also load pending transactions
@@ -1063,25 +6637,25 @@ void setup() {
         createGenesisBlock();
     }
     
+    rebuildSeenTxSet();
+    rebuildTelemetryIndex();
+    
     // Setup broadcast peer
     setupBroadcastPeer();
     
     // Initial announcement
     NetworkPacket announce;
-    announce.type = MSG_PEER_ANNOUNCE;
-    strcpy(announce.sender, myAddress);
-    announce.dataLen = 0;
-    
-    uint8_t broadcastAddr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    esp_now_send(broadcastAddr, (uint8_t*)&announce, sizeof(announce));
+    buildPeerAnnounce(&announce);
+    broadcastPacket(&announce);
     
     Serial.println("✓ System initialized");
-    Serial.println("\nCommands: V=Validator, S=Sensor, A=Archive");
-    Serial.println("          C=Clear storage, L=List files, W=Save now, ?=Help\n");
+    Serial.println("\nCommands: query, block, stats, files, role, save, clear (one per line)");
+    Serial.println("          V/S/A/C/L/W shortcuts still work, ?=Help\n");
     
     lastBlockTime = millis();
     lastTelemetryTime = millis();
     lastAnnounceTime = millis();
+    scheduleListenUntil = millis() + HEARTBEAT_INTERVAL_MS;
     lastSaveTime = millis();
 }
 
@@ -1091,11 +6665,22 @@ void loop() {
     static unsigned long lastStatus = 0;
     
     // Check for commands
-    checkRoleChangeCommand();
+    serialCommandTask();
+    receiveTask();
+    remoteQueryTask();
+    chainSyncTask();
+    compactBlockTask();
+    gossipTask();
+    inventoryTask();
+    coalesceTask();
+    peerMaintenanceTask();
+    transportTask();
     
     // Run tasks
     sensorTask();
+    sensorStatsReportTask();
     validatorTask();
+    validatorHeartbeatTask();
     peerDiscoveryTask();
     periodicSaveTask();  // NEW: Periodic SPIFFS saves
     
@@ -1105,14 +6690,22 @@ void loop() {
         lastStatus = millis();
         
         // Demo query
-        if(blockCount > 1 && txPoolCount > 0) {
+        if(blockCount > 1) {
             char querySensorId[20];
             snprintf(querySensorId, sizeof(querySensorId), "ESP_%s", myAddress + 9);
-            queryTelemetryData(querySensorId, 0, UINT32_MAX);
+            Serial.printf("\n=== Telemetry Query: %s ===\n", querySensorId);
+            uint32_t found = queryTelemetryData(querySensorId, 0, UINT32_MAX, true, printReading, NULL);
+            Serial.printf("Found %u readings (%u log records read, %u blocks / %u segments skipped)\n\n",
+                          found, lastQueryStats.recordsRead,
+                          lastQueryStats.blocksSkipped, lastQueryStats.segmentsSkipped);
+            
+            // Same sensor over the last day, answered mostly from rollups
+            uint32_t now = millis() / 1000;
+            printAggregate(querySensorId, (now > 86400) ? now - 86400 : 0, now);
         }
     }
     
-    delay(100);
+    transportIdle(100);
 }
 
 
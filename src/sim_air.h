@@ -0,0 +1,206 @@
+/*
+ * SIMULATED AIR for native builds (RADIO_BACKEND == RADIO_SIM)
+ *
+ * Include once in the host program that runs several node instances in one
+ * process. Each node attaches with its MAC. A frame reaches the nodes within
+ * range after the configured latency, and each receiver independently loses
+ * it with the configured probability. A unicast send reports success only if
+ * the destination got the frame, like the ESP-NOW ACK. Broadcasts always
+ * report success.
+ *
+ * Nodes call simAirSend() and simAirPoll() from their own loop, so frames and
+ * send results are handed over on the node's side of the host's scheduling.
+ */
+
+#ifndef SIM_AIR_H
+#define SIM_AIR_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define SIM_AIR_NODES 64
+#define SIM_AIR_FRAMES 1024     // Frames in flight across all nodes
+#define SIM_AIR_FRAME_MAX 250   // ESP-NOW payload limit
+
+struct SimAirConfig {
+    uint8_t lossPct;            // Per receiver, per frame
+    uint16_t latencyMs;         // Until the send result and earliest delivery
+    uint16_t jitterMs;          // Extra random delay on delivery
+    float range;                // Units of simAirPlace(); 0 = everyone hears everyone
+    uint32_t seed;
+};
+
+struct SimAirNode {
+    uint8_t mac[6];
+    float x;
+    float y;
+    void (*rx)(const uint8_t* mac, const uint8_t* data, int len, int8_t rssi);
+    void (*done)(const uint8_t* mac, bool ok);
+};
+
+struct SimAirFrame {
+    uint8_t from;
+    uint8_t to[6];              // Destination, handed back with the send result
+    uint64_t pending;           // Receivers not yet handed the frame, one bit per node
+    bool ok;                    // Send result
+    bool reported;
+    unsigned long doneAt;
+    unsigned long deliverAt;
+    uint8_t len;
+    uint8_t data[SIM_AIR_FRAME_MAX];
+};
+
+struct SimAirStats {
+    uint32_t sent;
+    uint32_t delivered;
+    uint32_t lost;
+    uint32_t busy;              // Sends refused because the air was full
+};
+
+static SimAirConfig simAirConfig = {0, 2, 0, 0, 1};
+static SimAirNode simAirNodes[SIM_AIR_NODES];
+static uint8_t simAirNodeCount = 0;
+static SimAirFrame simAirFrames[SIM_AIR_FRAMES];
+static uint16_t simAirTail = 0;     // Frames in flight are [tail, head)
+static uint16_t simAirHead = 0;
+static uint32_t simAirRandState = 1;
+static SimAirStats simAirStats = {0};
+
+static int simAirFind(const uint8_t* mac) {
+    for(uint8_t i = 0; i < simAirNodeCount; i++) {
+        if(memcmp(simAirNodes[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+// xorshift32: runs repeat exactly for a given seed
+static uint32_t simAirRandom() {
+    simAirRandState ^= simAirRandState << 13;
+    simAirRandState ^= simAirRandState >> 17;
+    simAirRandState ^= simAirRandState << 5;
+    return simAirRandState;
+}
+
+static float simAirDistance(uint8_t a, uint8_t b) {
+    float dx = simAirNodes[a].x - simAirNodes[b].x;
+    float dy = simAirNodes[a].y - simAirNodes[b].y;
+    return sqrtf(dx * dx + dy * dy);
+}
+
+static bool simAirHears(uint8_t from, uint8_t to) {
+    if(simAirConfig.range > 0 && simAirDistance(from, to) > simAirConfig.range) return false;
+    if((simAirRandom() % 100) < simAirConfig.lossPct) {
+        simAirStats.lost++;
+        return false;
+    }
+    return true;
+}
+
+// Received strength falls off linearly from -30 dBm to -90 dBm at the range edge
+static int8_t simAirRssi(uint8_t from, uint8_t to) {
+    if(simAirConfig.range <= 0) return -50;
+    return (int8_t)(-30 - 60 * simAirDistance(from, to) / simAirConfig.range);
+}
+
+extern "C" void simAirConfigure(const SimAirConfig* config) {
+    simAirConfig = *config;
+    simAirRandState = config->seed ? config->seed : 1;
+}
+
+extern "C" bool simAirAttach(const uint8_t* mac, void (*rx)(const uint8_t*, const uint8_t*, int, int8_t),
+                             void (*done)(const uint8_t*, bool)) {
+    int i = simAirFind(mac);
+    if(i < 0) {
+        if(simAirNodeCount >= SIM_AIR_NODES) return false;
+        i = simAirNodeCount++;
+        memcpy(simAirNodes[i].mac, mac, 6);
+        simAirNodes[i].x = 0;
+        simAirNodes[i].y = 0;
+    }
+    simAirNodes[i].rx = rx;
+    simAirNodes[i].done = done;
+    return true;
+}
+
+// Position a node; nodes start at the origin
+extern "C" bool simAirPlace(const uint8_t* mac, float x, float y) {
+    int i = simAirFind(mac);
+    if(i < 0) return false;
+    simAirNodes[i].x = x;
+    simAirNodes[i].y = y;
+    return true;
+}
+
+// 0 = on the air, 1 = air full (try again later), -1 = bad frame or sender
+extern "C" int simAirSend(const uint8_t* from, const uint8_t* to, const uint8_t* data, size_t len,
+                          unsigned long now) {
+    int sender = simAirFind(from);
+    if(sender < 0 || len > SIM_AIR_FRAME_MAX) return -1;
+
+    uint16_t next = (simAirHead + 1) % SIM_AIR_FRAMES;
+    if(next == simAirTail) {
+        simAirStats.busy++;
+        return 1;
+    }
+
+    SimAirFrame* frame = &simAirFrames[simAirHead];
+    frame->from = sender;
+    memcpy(frame->to, to, 6);
+    frame->pending = 0;
+
+    if(to[0] & 0x01) {
+        for(uint8_t i = 0; i < simAirNodeCount; i++) {
+            if(i != sender && simAirHears(sender, i)) frame->pending |= 1ULL << i;
+        }
+        frame->ok = true;
+    } else {
+        int dest = simAirFind(to);
+        if(dest >= 0 && dest != sender && simAirHears(sender, dest)) frame->pending = 1ULL << dest;
+        frame->ok = (frame->pending != 0);
+    }
+
+    // Results come back in send order, so only delivery gets the jitter
+    frame->reported = false;
+    frame->doneAt = now + simAirConfig.latencyMs;
+    frame->deliverAt = frame->doneAt + (simAirConfig.jitterMs ? simAirRandom() % (simAirConfig.jitterMs + 1) : 0);
+    frame->len = len;
+    memcpy(frame->data, data, len);
+
+    simAirHead = next;
+    simAirStats.sent++;
+    return 0;
+}
+
+// Hand a node its due frames and send results
+extern "C" void simAirPoll(const uint8_t* mac, unsigned long now) {
+    int self = simAirFind(mac);
+    if(self < 0) return;
+    uint64_t bit = 1ULL << self;
+
+    // A handler may send: new frames land at the head, past where this pass stops
+    uint16_t end = simAirHead;
+    for(uint16_t i = simAirTail; i != end; i = (i + 1) % SIM_AIR_FRAMES) {
+        SimAirFrame* frame = &simAirFrames[i];
+
+        if(frame->from == self && !frame->reported && (long)(now - frame->doneAt) >= 0) {
+            frame->reported = true;
+            if(simAirNodes[self].done) simAirNodes[self].done(frame->to, frame->ok);
+        }
+        if((frame->pending & bit) && (long)(now - frame->deliverAt) >= 0) {
+            frame->pending &= ~bit;
+            simAirStats.delivered++;
+            if(simAirNodes[self].rx) {
+                simAirNodes[self].rx(simAirNodes[frame->from].mac, frame->data, frame->len,
+                                     simAirRssi(frame->from, self));
+            }
+        }
+    }
+
+    while(simAirTail != simAirHead && simAirFrames[simAirTail].reported &&
+          simAirFrames[simAirTail].pending == 0) {
+        simAirTail = (simAirTail + 1) % SIM_AIR_FRAMES;
+    }
+}
+
+#endif
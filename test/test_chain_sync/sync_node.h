@@ -0,0 +1,38 @@
+// Included once per node namespace, after src/main.cpp (see test_main.cpp)
+
+// Mine 'blocks' blocks of 'txPerBlock' transactions each, one a second
+void buildChain(uint32_t blocks, uint8_t txPerBlock) {
+    static uint32_t serial = 0;
+    for(uint32_t b = 0; b < blocks; b++) {
+        for(uint8_t t = 0; t < txPerBlock; t++) {
+            Transaction tx = {0};
+            TelemetryData reading = {0};
+            snprintf(reading.sensorId, sizeof(reading.sensorId), "SYNC_%02u", t);
+            for(uint8_t r = 0; r < TX_BATCH_SIZE; r++) {
+                reading.temperature = 20.0f + random(1000) / 100.0f;
+                reading.humidity = 50.0f;
+                reading.timestamp = serial++;
+                appendReading(&tx, &reading);
+            }
+            calculateTxHash(&tx);
+            addToTxPool(&tx);
+        }
+
+        Block block = createBlock();
+        addBlock(&block);
+        delay(1000);
+    }
+}
+
+uint32_t chainHeight() {
+    return totalBlocks;
+}
+
+const uint8_t* chainTip() {
+    return blockchain[(blockCount - 1) % MAX_BLOCKS].blockHash;
+}
+
+// Readings the chain's blocks carried into our tx log
+uint32_t chainReadings() {
+    return mempoolStats.committed;
+}
@@ -0,0 +1,166 @@
+/*
+ * CHAIN SYNC BENCHMARK - catching up a 1,000-block gap
+ *
+ * A server node mines SYNC_GAP blocks on its own, then a fresh node boots next
+ * to it and syncs: headers first, then bodies in a windowed stream. Both run
+ * on simulated clocks over the simulated air, the one further behind first,
+ * as in tools/meshsim. The ring and tx log are raised to hold the whole gap,
+ * so every block and its txs are fetched rather than fast-forwarded past.
+ *
+ *   pio test -e native -f test_chain_sync -v
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_idf_version.h>
+#include <mbedtls/md.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <FS.h>
+#include <unity.h>
+
+#include "../../src/sim_air.h"
+
+#define MAX_BLOCKS 1024
+#define TX_LOG_SLOTS 8192
+#define SYNC_GAP 1000
+#define SYNC_TX_PER_BLOCK 5
+#define SYNC_LIMIT_MS 1800000UL  // Give up after 30 simulated minutes
+
+namespace clean0 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+namespace clean1 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+namespace lossy0 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+namespace lossy1 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+namespace harsh0 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+namespace harsh1 {
+#include "../../src/main.cpp"
+#include "sync_node.h"
+}
+
+struct SyncApi {
+    void (*setup)();
+    void (*loop)();
+    void (*quiet)();
+    void (*build)(uint32_t blocks, uint8_t txPerBlock);
+    uint32_t (*height)();
+    const uint8_t* (*tip)();
+    uint32_t (*readings)();
+};
+
+#define SYNC_API(ns) {                                      \
+    ns::setup,                                              \
+    ns::loop,                                               \
+    [] { ns::MY_ROLE = ns::ARCHIVE_NODE; },                 \
+    ns::buildChain,                                         \
+    ns::chainHeight,                                        \
+    ns::chainTip,                                           \
+    ns::chainReadings,                                      \
+}
+
+NativeNode serverNode;
+NativeNode clientNode;
+int scenario = 0;
+
+void setUp() {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "bench_chain_sync";
+    std::filesystem::remove_all(root);
+    serverNode = nativeDefaultNode;
+    clientNode = nativeDefaultNode;
+    serverNode.fsRoot = (root / "server").string();
+    clientNode.fsRoot = (root / "client").string();
+    serverNode.serialOut = NULL;
+    clientNode.serialOut = NULL;
+    randomSeed(1);
+}
+
+void tearDown() {
+    nativeNode = &nativeDefaultNode;
+}
+
+// Boot a node where the air can hear it; it neither senses nor mines
+void boot(const SyncApi* api, NativeNode* node, uint8_t tail, float x) {
+    uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x51, (uint8_t)scenario, tail};
+    memcpy(node->mac, mac, 6);
+    simAirAttach(mac, NULL, NULL);
+    simAirPlace(mac, x, 0);
+
+    nativeNode = node;
+    api->setup();
+    api->quiet();
+}
+
+// Seconds from the client's boot until it holds the server's tip, or -1
+double catchUp(const SyncApi* server, const SyncApi* client, uint8_t lossPct) {
+    // Each scenario gets its own stretch of air, out of range of the last one's nodes
+    scenario++;
+    float x = scenario * 100.0f;
+    SimAirConfig air = {lossPct, 2, 0, 1.0f, 1};
+    simAirConfigure(&air);
+
+    boot(server, &serverNode, 0x01, x);
+    server->build(SYNC_GAP, SYNC_TX_PER_BLOCK);
+
+    clientNode.clock = serverNode.clock;
+    boot(client, &clientNode, 0x02, x + 0.5f);
+    unsigned long start = clientNode.clock;
+
+    while(clientNode.clock - start < SYNC_LIMIT_MS) {
+        bool serverNext = (long)(serverNode.clock - clientNode.clock) < 0;
+        nativeNode = serverNext ? &serverNode : &clientNode;
+        (serverNext ? server : client)->loop();
+        nativeNode = &clientNode;
+
+        if(client->height() == server->height() && memcmp(client->tip(), server->tip(), 32) == 0) {
+            return (clientNode.clock - start) / 1000.0;
+        }
+    }
+    return -1;
+}
+
+void checkCatchUp(const char* label, const SyncApi* server, const SyncApi* client, uint8_t lossPct) {
+    double seconds = catchUp(server, client, lossPct);
+    printf("%s, %d%% loss: %d-block gap closed in %.1f s (%u of %u readings logged)\n", label, lossPct,
+           SYNC_GAP, seconds, client->readings(), server->readings());
+    TEST_ASSERT_TRUE_MESSAGE(seconds >= 0, "client never reached the server's tip");
+    TEST_ASSERT_EQUAL_MESSAGE(server->readings(), client->readings(), "synced blocks arrived without their txs");
+}
+
+const SyncApi CLEAN[2] = {SYNC_API(clean0), SYNC_API(clean1)};
+const SyncApi LOSSY[2] = {SYNC_API(lossy0), SYNC_API(lossy1)};
+const SyncApi HARSH[2] = {SYNC_API(harsh0), SYNC_API(harsh1)};
+
+void test_catch_up_clean() {
+    checkCatchUp("clean", &CLEAN[0], &CLEAN[1], 0);
+}
+
+void test_catch_up_lossy() {
+    checkCatchUp("lossy", &LOSSY[0], &LOSSY[1], 10);
+}
+
+void test_catch_up_harsh() {
+    checkCatchUp("harsh", &HARSH[0], &HARSH[1], 30);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_catch_up_clean);
+    RUN_TEST(test_catch_up_lossy);
+    RUN_TEST(test_catch_up_harsh);
+    return UNITY_END();
+}
@@ -0,0 +1,84 @@
+/*
+ * PACKET VIEW FUZZ AND BENCHMARK - the receive path reading frames in place
+ *
+ * Handlers read received records through PacketViews that point into the radio
+ * buffer, so a missing length check reads past the frame. The fuzz test
+ * feeds mutated copies of a valid frame of every message type (and a bundle)
+ * to handleFrame(), each from an exactly sized heap buffer; build with the
+ * native-asan settings to have any over-read fault. A compact block is kept
+ * waiting on the fuzzing peer so MSG_BLOCK_TXN gets past its pendingBlock gate.
+ *
+ * The benchmark times handleFrame() on the traffic a node hears most:
+ * duplicate telemetry, inventory of known txs, a duplicate compact block,
+ * announcements, an alarm and a bundle, from a neighborhood of peers.
+ *
+ *   pio test -e native -f test_packet_views -v
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_idf_version.h>
+#include <mbedtls/md.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <FS.h>
+#include <unity.h>
+
+#include "../../src/sim_air.h"
+
+#define FUZZ_FRAMES 300000
+#define BENCH_FRAMES 400000     // Per round
+#define BENCH_ROUNDS 5
+#define BENCH_PEERS 16          // Within PEER_TABLE_MAX, so no frame pays for an eviction
+
+namespace fuzzed {
+#include "../../src/main.cpp"
+#include "view_node.h"
+}
+namespace timed {
+#include "../../src/main.cpp"
+#include "view_node.h"
+}
+
+void setUp() {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "test_packet_views";
+    std::filesystem::remove_all(root);
+    nativeDefaultNode.fsRoot = root.string();
+    nativeDefaultNode.clock = 0;
+    nativeDefaultNode.serialOut = NULL;
+    randomSeed(1);
+}
+
+void tearDown() {
+}
+
+void test_mutated_frames() {
+    fuzzed::fuzzPacketViews(FUZZ_FRAMES);
+    printf("%d frames: %u malformed, %u invalid tx, %u bans, %u block txs fetched over %u armings\n",
+           FUZZ_FRAMES, fuzzed::admissionStats.malformed, fuzzed::admissionStats.invalidTx,
+           fuzzed::admissionStats.bans, fuzzed::relayStats.txFetched, fuzzed::viewArmings);
+    printf("%u unmutated frames, %u rejected\n", fuzzed::viewClean, fuzzed::viewCleanRejected);
+
+    TEST_ASSERT_TRUE_MESSAGE(fuzzed::viewClean > 0, "no seed was replayed unmutated");
+    TEST_ASSERT_EQUAL_MESSAGE(0, fuzzed::viewCleanRejected, "a well-formed frame was rejected");
+    TEST_ASSERT_TRUE_MESSAGE(fuzzed::admissionStats.malformed > 0, "mutations never reached the decoder");
+    TEST_ASSERT_TRUE_MESSAGE(fuzzed::relayStats.txFetched > 0, "no block txn got past pendingBlock");
+}
+
+void test_frame_cost() {
+    double ns = timed::benchPacketViews(BENCH_FRAMES, BENCH_PEERS, BENCH_ROUNDS);
+    printf("%.0f ns/frame over %d peers (%u duplicates, %u refused)\n", ns, BENCH_PEERS,
+           timed::gossipStats.duplicates, timed::admissionStats.rateLimited + timed::admissionStats.malformed);
+
+    TEST_ASSERT_TRUE_MESSAGE(timed::gossipStats.duplicates > 0, "flooded copies were not recognized");
+    TEST_ASSERT_EQUAL(0, timed::admissionStats.rateLimited);
+    TEST_ASSERT_EQUAL(0, timed::admissionStats.malformed);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_mutated_frames);
+    RUN_TEST(test_frame_cost);
+    return UNITY_END();
+}
@@ -0,0 +1,427 @@
+// Included once per node namespace, after src/main.cpp (see test_main.cpp)
+
+// A well-formed frame to replay or mutate, and who may send it
+struct ViewSeed {
+    uint8_t frame[ESPNOW_MAX_FRAME];
+    uint16_t len;
+    bool fromArmer;             // A block txn: only pendingBlock.peer gets it handled
+};
+
+ViewSeed viewSeeds[24];
+uint8_t viewSeedCount = 0;
+uint32_t viewArmings = 0;       // Compact blocks that left a pendingBlock waiting on us
+uint32_t viewClean = 0;         // Seeds replayed unmutated
+uint32_t viewCleanRejected = 0; // ...that the receive path still called malformed or invalid
+
+// Peer i's MAC; never the node's own
+void viewPeerMac(uint32_t i, uint8_t* mac) {
+    uint8_t m[6] = {0x24, 0x6F, 0x28, 0xA0, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(mac, m, 6);
+}
+
+// Frame a packet as 'mac' would have sent it: encodePacket() writes our own MAC
+uint16_t frameFrom(const uint8_t* mac, NetworkPacket* packet, uint8_t* out) {
+    if(isGossipType(packet->type)) {
+        packet->gossipId = esp_random();
+        packet->ttl = GOSSIP_TTL;
+    }
+    size_t len = encodePacket(packet, out);
+    memcpy(out + putHeader(out, packet->type, payloadSize(packet)), mac, 6);
+    return len;
+}
+
+// A MSG_BUNDLE frame carrying 'count' packets
+uint16_t bundleFrom(const uint8_t* mac, NetworkPacket* packets, uint8_t count, uint8_t* out) {
+    uint8_t records[ESPNOW_MAX_FRAME];
+    uint16_t used = 0;
+    for(uint8_t i = 0; i < count; i++) {
+        if(isGossipType(packets[i].type)) {
+            packets[i].gossipId = esp_random();
+            packets[i].ttl = GOSSIP_TTL;
+        }
+        used += putHeader(records + used, packets[i].type, payloadSize(&packets[i]));
+        used += putPayload(records + used, &packets[i]);
+    }
+    size_t head = putHeader(out, MSG_BUNDLE, used);
+    memcpy(out + head, mac, 6);
+    memcpy(out + head + 6, records, used);
+    return head + 6 + used;
+}
+
+// Hand a frame to the receive path from an exactly sized heap copy, so any
+// read past its end faults under ASan
+void deliverFrame(const uint8_t* mac, const uint8_t* frame, uint16_t len) {
+    uint8_t* copy = new uint8_t[len ? len : 1];
+    memcpy(copy, frame, len);
+    handleFrame(mac, copy, len, -60);
+    delete[] copy;
+}
+
+void fillPacket(NetworkPacket* packet, MessageType type, const void* data, uint16_t len) {
+    memset(packet, 0, sizeof(NetworkPacket));
+    packet->type = type;
+    memcpy(packet->data, data, len);
+    packet->dataLen = len;
+}
+
+// A signed-off batch of readings from a sensor we don't have yet
+void makeTransaction(Transaction* tx, uint32_t serial) {
+    memset(tx, 0, sizeof(Transaction));
+    TelemetryData reading = {0};
+    snprintf(reading.sensorId, sizeof(reading.sensorId), "VIEW_%04u", serial % 16);
+    for(uint8_t i = 0; i < TX_BATCH_MAX; i++) {
+        reading.temperature = 20.0f + random(1000) / 100.0f;
+        reading.humidity = 40.0f + random(400) / 10.0f;
+        reading.pressure = 1013.0f;
+        reading.batteryVoltage = 3.7f;
+        reading.timestamp = millis() / 1000 + serial * TX_BATCH_MAX + i;
+        appendReading(tx, &reading);
+    }
+    calculateTxHash(tx);
+}
+
+const uint8_t* tipHash() {
+    return blockchain[(blockCount - 1) % MAX_BLOCKS].blockHash;
+}
+
+// Compact block for the next height on our tip. Short IDs name nothing in the
+// pool, so every position is fetched with MSG_BLOCK_TXN.
+void makeCompactBlock(CompactBlock* compact, uint8_t txCount, const Transaction* pooled) {
+    memset(compact, 0, sizeof(CompactBlock));
+    compact->index = totalBlocks;
+    compact->timestamp = millis() / 1000;
+    compact->txCount = txCount;
+    memcpy(compact->previousHash, tipHash(), 32);
+    for(uint8_t i = 0; i < 32; i++) compact->blockHash[i] = esp_random();
+    strcpy(compact->validator, "VIEW_VALIDATOR");
+    for(uint8_t i = 0; i < txCount; i++) {
+        if(pooled) memcpy(compact->shortIds[i], pooled[i].txHash, SHORT_ID_BYTES);
+        else for(uint8_t b = 0; b < SHORT_ID_BYTES; b++) compact->shortIds[i][b] = esp_random();
+    }
+}
+
+void addSeed(const uint8_t* mac, NetworkPacket* packet, bool fromArmer = false) {
+    ViewSeed* seed = &viewSeeds[viewSeedCount++];
+    seed->len = frameFrom(mac, packet, seed->frame);
+    seed->fromArmer = fromArmer;
+}
+
+// One valid frame of every message type, and a bundle
+void buildSeeds(const uint8_t* mac) {
+    NetworkPacket packet;
+    NetworkPacket parts[3];
+    viewSeedCount = 0;
+
+    char own[16];
+    snprintf(own, sizeof(own), "ESP_%s", myAddress + 9);
+
+    Transaction tx;
+    makeTransaction(&tx, esp_random());
+    fillPacket(&packet, MSG_NEW_TELEMETRY, &tx, TX_WIRE_SIZE(tx.readingCount));
+    addSeed(mac, &packet);
+
+    InvAnnounce inv = {0};
+    inv.height = totalBlocks;
+    inv.count = 3;
+    for(uint8_t i = 0; i < inv.count; i++) {
+        for(uint8_t b = 0; b < SHORT_ID_BYTES; b++) inv.ids[i][b] = esp_random();
+    }
+    fillPacket(&packet, MSG_INV, &inv, offsetof(InvAnnounce, ids) + inv.count * SHORT_ID_BYTES);
+    addSeed(mac, &packet);
+
+    TxRequest get = {0};
+    memcpy(get.target, myMac, 6);
+    get.count = 1;
+    memcpy(get.ids[0], tx.txHash, SHORT_ID_BYTES);
+    fillPacket(&packet, MSG_GET_TX, &get, offsetof(TxRequest, ids) + SHORT_ID_BYTES);
+    addSeed(mac, &packet);
+
+    CompactBlock compact;
+    makeCompactBlock(&compact, 3, NULL);
+    fillPacket(&packet, MSG_NEW_BLOCK, &compact, offsetof(CompactBlock, shortIds) + 3 * SHORT_ID_BYTES);
+    addSeed(mac, &packet);
+
+    BlockTxnRequest want = {0};
+    want.height = totalBlocks - 1;
+    memcpy(want.blockId, tipHash(), SHORT_ID_BYTES);
+    want.missing = 1;
+    fillPacket(&packet, MSG_GET_BLOCK_TXN, &want, sizeof(want));
+    addSeed(mac, &packet);
+
+    for(uint8_t p = 0; p < 3; p++) {
+        BlockTxn txn;
+        txn.height = totalBlocks;
+        txn.position = p;
+        makeTransaction(&txn.tx, esp_random());
+        fillPacket(&packet, MSG_BLOCK_TXN, &txn, offsetof(BlockTxn, tx) + TX_WIRE_SIZE(txn.tx.readingCount));
+        addSeed(mac, &packet, true);
+    }
+
+    ChainRequest request = {1, SYNC_HEADERS, SYNC_RESTART, 0, 8};
+    fillPacket(&packet, MSG_REQUEST_CHAIN, &request, sizeof(request));
+    addSeed(mac, &packet);
+
+    ChainHeaders headers = {0};
+    headers.session = 1;
+    headers.kind = SYNC_HEADERS;
+    headers.count = 2;
+    headers.tip = totalBlocks + 2;
+    headers.from = totalBlocks;
+    fillPacket(&packet, MSG_CHAIN_DATA, &headers, offsetof(ChainHeaders, hashes) + 2 * sizeof(Hash32));
+    addSeed(mac, &packet);
+
+    ChainBody body = {0};
+    body.session = 1;
+    body.kind = SYNC_BODIES;
+    body.parts = 2;
+    body.height = totalBlocks;
+    fillPacket(&packet, MSG_CHAIN_DATA, &body, sizeof(body));
+    addSeed(mac, &packet);
+
+    PeerAnnounce announce = {0};
+    announce.self.handle = tx.sensor;
+    snprintf(announce.self.sensorId, sizeof(announce.self.sensorId), "VIEW_PEER");
+    announce.height = totalBlocks;
+    fillPacket(&packet, MSG_PEER_ANNOUNCE, &announce, sizeof(announce));
+    addSeed(mac, &packet);
+
+    ValidatorHeartbeat beat = {0};
+    memcpy(beat.validator, mac, 6);
+    beat.epoch = totalBlocks / VALIDATOR_EPOCH_BLOCKS;
+    beat.height = totalBlocks;
+    beat.count = 2;
+    memcpy(beat.macs[0], mac, 6);
+    memcpy(beat.macs[1], myMac, 6);
+    fillPacket(&packet, MSG_VALIDATOR_HEARTBEAT, &beat, offsetof(ValidatorHeartbeat, macs) + 2 * 6);
+    addSeed(mac, &packet);
+
+    QueryRequest query = {0};
+    query.queryId = 7;
+    query.window = 2;
+    memcpy(query.sensorId, own, sizeof(own));
+    query.endTime = 0xFFFFFFFF;
+    fillPacket(&packet, MSG_QUERY_REQUEST, &query, sizeof(query));
+    addSeed(mac, &packet);
+
+    QueryPage page = {0};
+    page.queryId = 7;
+    page.count = 2;
+    page.flags = QUERY_LAST;
+    fillPacket(&packet, MSG_QUERY_PAGE, &page, offsetof(QueryPage, readings) + 2 * sizeof(CompactReading));
+    addSeed(mac, &packet);
+
+    SketchRequest sketchWant = {0};
+    memcpy(sketchWant.sensorId, own, sizeof(own));
+    fillPacket(&packet, MSG_GET_SKETCH, &sketchWant, sizeof(sketchWant));
+    addSeed(mac, &packet);
+
+    SketchMessage sketch = {0};
+    memcpy(sketch.sensorId, own, sizeof(own));
+    sketch.count = 10;
+    sketch.min = 2000;
+    sketch.max = 2500;
+    sketch.centroidCount = 2;
+    sketch.centroids[0] = {2100, 5};
+    sketch.centroids[1] = {2400, 5};
+    fillPacket(&packet, MSG_SKETCH, &sketch, SKETCH_WIRE_SIZE(2));
+    addSeed(mac, &packet);
+
+    SensorAlarm alarm = {0};
+    alarm.sensor.handle = tx.sensor;
+    snprintf(alarm.sensor.sensorId, sizeof(alarm.sensor.sensorId), "VIEW_PEER");
+    alarm.kind = ALARM_HIGH;
+    alarm.value = 80.0f;
+    fillPacket(&packet, MSG_SENSOR_ALARM, &alarm, sizeof(alarm));
+    addSeed(mac, &packet);
+
+    fillPacket(&parts[0], MSG_INV, &inv, offsetof(InvAnnounce, ids) + inv.count * SHORT_ID_BYTES);
+    fillPacket(&parts[1], MSG_PEER_ANNOUNCE, &announce, sizeof(announce));
+    fillPacket(&parts[2], MSG_SENSOR_ALARM, &alarm, sizeof(alarm));
+    ViewSeed* seed = &viewSeeds[viewSeedCount++];
+    seed->len = bundleFrom(mac, parts, 3, seed->frame);
+    seed->fromArmer = false;
+}
+
+// Leave a compact block waiting on txs from 'mac', so MSG_BLOCK_TXN is handled
+void armPendingBlock(const uint8_t* mac) {
+    CompactBlock compact;
+    makeCompactBlock(&compact, 3, NULL);
+
+    NetworkPacket packet;
+    uint8_t frame[ESPNOW_MAX_FRAME];
+    fillPacket(&packet, MSG_NEW_BLOCK, &compact, offsetof(CompactBlock, shortIds) + 3 * SHORT_ID_BYTES);
+    pendingBlock.active = false;
+    deliverFrame(mac, frame, frameFrom(mac, &packet, frame));
+    if(pendingBlock.active) viewArmings++;
+}
+
+// Damage a copy of the frame: bit flips, byte overwrites, a different type or
+// record length, truncation or trailing junk
+uint16_t mutateFrame(uint8_t* frame, uint16_t len) {
+    uint8_t edits = 1 + random(4);
+    for(uint8_t e = 0; e < edits && len > 0; e++) {
+        switch(random(6)) {
+            case 0:
+                frame[random(len)] ^= 1 << random(8);
+                break;
+            case 1:
+                frame[random(len)] = esp_random();
+                break;
+            case 2:
+                frame[random(2)] = esp_random();
+                break;
+            case 3:
+                len = 1 + random(len);
+                break;
+            case 4: {
+                uint16_t grow = random(ESPNOW_MAX_FRAME - len + 1);
+                for(uint16_t i = 0; i < grow; i++) frame[len + i] = esp_random();
+                len += grow;
+                break;
+            }
+            case 5:
+                // Bundled records: hit the bytes right after the sender MAC
+                if(len > 11) frame[9 + random(3)] = esp_random();
+                break;
+        }
+    }
+    return len;
+}
+
+// Feed 'frames' frames to a node, all but about one in eight of them mutated
+void fuzzPacketViews(uint32_t frames) {
+    setup();
+
+    uint32_t nextPeer = 0;
+    uint32_t nextArmer = 0x8000;
+    uint8_t armer[6];
+
+    for(uint32_t n = 0; n < frames; n++) {
+        // Fresh seeds now and then, so heights and hashes follow the node
+        if(n % 512 == 0) {
+            uint8_t mac[6];
+            viewPeerMac(0, mac);
+            buildSeeds(mac);
+        }
+
+        // A banned armer never gets its block txs handled: start over with a new one
+        PeerEntry* armerPeer = pendingBlock.active ? findPeer(pendingBlock.peer, false) : NULL;
+        if(!pendingBlock.active || armerPeer == NULL || peerBanned(armerPeer)) {
+            viewPeerMac(nextArmer++, armer);
+            armPendingBlock(armer);
+        }
+
+        const ViewSeed* seed = &viewSeeds[random(viewSeedCount)];
+        uint8_t mac[6];
+        if(seed->fromArmer) memcpy(mac, armer, 6);
+        else viewPeerMac(nextPeer++ % 256, mac);
+
+        // Every frame names its sender twice: the radio's MAC and the one inside
+        uint8_t frame[ESPNOW_MAX_FRAME];
+        memcpy(frame, seed->frame, seed->len);
+        uint8_t type;
+        uint16_t dataLen;
+        int head = getHeader(frame, seed->len, &type, &dataLen);
+        memcpy(frame + head, mac, 6);
+
+        uint16_t len = seed->len;
+        bool clean = random(8) == 0;
+        if(!clean) len = mutateFrame(frame, len);
+        uint32_t rejected = admissionStats.malformed + admissionStats.invalidTx;
+        deliverFrame(mac, frame, len);
+        if(clean) {
+            viewClean++;
+            if(admissionStats.malformed + admissionStats.invalidTx != rejected) viewCleanRejected++;
+        }
+
+        nativeNode->clock++;
+        if(n % 64 == 63) loop();
+    }
+}
+
+// Average cost of handleFrame() on a steady mix of mostly redundant traffic
+// (what a node hears most of the time) from 'peers' neighbors; returns the
+// fastest round's ns/frame
+double benchPacketViews(uint32_t frames, uint8_t peers, uint8_t rounds) {
+    setup();
+
+    uint8_t mac[6];
+    viewPeerMac(0, mac);
+    NetworkPacket packet;
+    NetworkPacket parts[2];
+
+    // Pool a few txs, so the telemetry and inventory below are already known
+    Transaction pooled[3];
+    for(uint8_t i = 0; i < 3; i++) {
+        makeTransaction(&pooled[i], i);
+        addToTxPool(&pooled[i]);
+    }
+
+    viewSeedCount = 0;
+    fillPacket(&packet, MSG_NEW_TELEMETRY, &pooled[0], TX_WIRE_SIZE(pooled[0].readingCount));
+    addSeed(mac, &packet);
+
+    InvAnnounce inv = {0};
+    inv.height = totalBlocks;
+    inv.count = 3;
+    for(uint8_t i = 0; i < inv.count; i++) memcpy(inv.ids[i], pooled[i].txHash, SHORT_ID_BYTES);
+    fillPacket(&packet, MSG_INV, &inv, offsetof(InvAnnounce, ids) + inv.count * SHORT_ID_BYTES);
+    addSeed(mac, &packet);
+
+    CompactBlock compact;
+    makeCompactBlock(&compact, 3, pooled);
+    fillPacket(&packet, MSG_NEW_BLOCK, &compact, offsetof(CompactBlock, shortIds) + 3 * SHORT_ID_BYTES);
+    addSeed(mac, &packet);
+
+    PeerAnnounce announce = {0};
+    announce.self.handle = pooled[0].sensor;
+    snprintf(announce.self.sensorId, sizeof(announce.self.sensorId), "VIEW_0000");
+    announce.height = totalBlocks;
+    fillPacket(&packet, MSG_PEER_ANNOUNCE, &announce, sizeof(announce));
+    addSeed(mac, &packet);
+
+    SensorAlarm alarm = {0};
+    alarm.sensor = announce.self;
+    alarm.kind = ALARM_HIGH;
+    alarm.value = 80.0f;
+    fillPacket(&packet, MSG_SENSOR_ALARM, &alarm, sizeof(alarm));
+    addSeed(mac, &packet);
+
+    fillPacket(&parts[0], MSG_INV, &inv, offsetof(InvAnnounce, ids) + inv.count * SHORT_ID_BYTES);
+    fillPacket(&parts[1], MSG_PEER_ANNOUNCE, &announce, sizeof(announce));
+    ViewSeed* seed = &viewSeeds[viewSeedCount++];
+    seed->len = bundleFrom(mac, parts, 2, seed->frame);
+
+    // Sender MACs patched in up front, so the timed loop only delivers
+    static uint8_t mixed[256][ESPNOW_MAX_FRAME];
+    static uint8_t macs[256][6];
+    static uint16_t lens[256];
+    uint16_t variants = peers * viewSeedCount;
+    for(uint16_t v = 0; v < variants; v++) {
+        const ViewSeed* s = &viewSeeds[v % viewSeedCount];
+        viewPeerMac(v / viewSeedCount, macs[v]);
+        memcpy(mixed[v], s->frame, s->len);
+        uint8_t type;
+        uint16_t dataLen;
+        memcpy(mixed[v] + getHeader(s->frame, s->len, &type, &dataLen), macs[v], 6);
+        lens[v] = s->len;
+    }
+
+    // First pass: the compact block and alarm go from new to duplicate
+    for(uint16_t v = 0; v < variants; v++) handleFrame(macs[v], mixed[v], lens[v], -60);
+
+    // Best of several rounds: a busy host only ever adds time
+    double best = 0;
+    for(uint8_t round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint32_t n = 0; n < frames; n++) {
+            uint16_t v = n % variants;
+            handleFrame(macs[v], mixed[v], lens[v], -60);
+            nativeNode->clock += 8;     // Keeps every peer inside RX_TX_RATE
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)frames;
+        if(round == 0 || ns < best) best = ns;
+    }
+    return best;
+}
@@ -0,0 +1,53 @@
+// Included once per node namespace, after src/main.cpp (see test_main.cpp)
+
+// A sensor beyond the validator, with the batch it is filling
+struct BenchSensor {
+    char sensorId[16];
+    unsigned long nextReading;
+    Transaction batch;
+};
+
+BenchSensor benchSensors[BENCH_MAX_SENSORS];
+
+// Run a validator for 'minutes' of simulated time while sensors - 1 more
+// sensors feed it (the validator senses too); returns readings committed
+uint32_t benchThroughput(int sensors, unsigned long minutes) {
+    setup();
+    MY_ROLE = VALIDATOR_NODE;
+    
+    unsigned long start = millis();
+    for(int i = 0; i < sensors - 1; i++) {
+        BenchSensor* s = &benchSensors[i];
+        memset(s, 0, sizeof(BenchSensor));
+        snprintf(s->sensorId, sizeof(s->sensorId), "BENCH_%03d", i);
+        s->nextReading = start + (unsigned long)i * SENSOR_INTERVAL_MS / sensors;
+    }
+    
+    uint32_t committedBefore = mempoolStats.committed;
+    unsigned long end = start + minutes * 60000UL;
+    while(millis() < end) {
+        // Each sensor's batch arrives whole, as addToTxPool() gets it from gossip
+        for(int i = 0; i < sensors - 1; i++) {
+            BenchSensor* s = &benchSensors[i];
+            if(millis() < s->nextReading) continue;
+            s->nextReading += SENSOR_INTERVAL_MS;
+            
+            TelemetryData reading = {0};
+            memcpy(reading.sensorId, s->sensorId, sizeof(s->sensorId));
+            reading.temperature = 20.0f + random(1000) / 100.0f;
+            reading.humidity = 40.0f + random(400) / 10.0f;
+            reading.pressure = 1013.0f;
+            reading.batteryVoltage = 3.7f;
+            reading.timestamp = millis() / 1000;
+            appendReading(&s->batch, &reading);
+            
+            if(s->batch.readingCount >= TX_BATCH_SIZE) {
+                calculateTxHash(&s->batch);
+                addToTxPool(&s->batch);
+                memset(&s->batch, 0, sizeof(s->batch));
+            }
+        }
+        loop();
+    }
+    return mempoolStats.committed - committedBefore;
+}
@@ -0,0 +1,78 @@
+/*
+ * THROUGHPUT BENCHMARK - sustained committed readings per second
+ *
+ * One validator on the simulated clock, fed by 0, 9 or 99 more sensors that
+ * each take a reading every SENSOR_INTERVAL_MS. Each run gets a fresh copy of
+ * the firmware (its own namespace, as in tools/meshsim) and an hour of chain
+ * time. The chain has to keep up with what the sensors offer: whatever is
+ * still pending at the end is at most a block interval's worth.
+ *
+ *   pio test -e native -f test_throughput -v
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_idf_version.h>
+#include <mbedtls/md.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <FS.h>
+#include <unity.h>
+
+#include "../../src/sim_air.h"
+
+#define BENCH_MAX_SENSORS 100
+#define BENCH_MINUTES 60
+
+namespace sensors1 {
+#include "../../src/main.cpp"
+#include "bench_node.h"
+}
+namespace sensors10 {
+#include "../../src/main.cpp"
+#include "bench_node.h"
+}
+namespace sensors100 {
+#include "../../src/main.cpp"
+#include "bench_node.h"
+}
+
+void setUp() {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "bench_throughput";
+    std::filesystem::remove_all(root);
+    nativeDefaultNode.fsRoot = root.string();
+    nativeDefaultNode.clock = 0;
+    nativeDefaultNode.serialOut = NULL;
+    randomSeed(1);
+}
+
+void tearDown() {
+}
+
+void checkThroughput(int sensors, uint32_t committed) {
+    double offered = sensors * 1000.0 / SENSOR_INTERVAL_MS;
+    double rate = committed / (BENCH_MINUTES * 60.0);
+    printf("%3d sensors: %.2f readings/s committed (%.2f/s offered)\n", sensors, rate, offered);
+    TEST_ASSERT_TRUE_MESSAGE(rate >= 0.9 * offered, "chain falls behind the sensors");
+}
+
+void test_one_sensor() {
+    checkThroughput(1, sensors1::benchThroughput(1, BENCH_MINUTES));
+}
+
+void test_ten_sensors() {
+    checkThroughput(10, sensors10::benchThroughput(10, BENCH_MINUTES));
+}
+
+void test_hundred_sensors() {
+    checkThroughput(100, sensors100::benchThroughput(100, BENCH_MINUTES));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_one_sensor);
+    RUN_TEST(test_ten_sensors);
+    RUN_TEST(test_hundred_sensors);
+    return UNITY_END();
+}
@@ -0,0 +1,375 @@
+/*
+ * MESH SIMULATOR - many firmware nodes in one host process
+ *
+ * Each node is src/main.cpp compiled into a namespace of its own and built
+ * with RADIO_BACKEND == RADIO_SIM, so the nodes talk over the simulated air
+ * in sim_air.h. Every node keeps its own clock (delay() advances it); the
+ * host always resumes the node that is furthest behind.
+ *
+ *   pio run -e native
+ *   .pio/build/native/program --topology grid --nodes 9 --loss 10 --minutes 30
+ *
+ * Nodes sit one unit apart: line and grid (range 1, so a grid node hears four
+ * neighbors), dense (grid with range 1.5, eight neighbors) and full (everyone
+ * hears everyone). Validators are spread evenly; the rest are sensors.
+ * After --minutes the sensors stop and the validators get --drain seconds to
+ * commit what is pending.
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_idf_version.h>
+#include <mbedtls/md.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <FS.h>
+#include <filesystem>
+#include <vector>
+
+#include "../../src/sim_air.h"
+
+namespace node0 {
+#include "../../src/main.cpp"
+}
+namespace node1 {
+#include "../../src/main.cpp"
+}
+namespace node2 {
+#include "../../src/main.cpp"
+}
+namespace node3 {
+#include "../../src/main.cpp"
+}
+namespace node4 {
+#include "../../src/main.cpp"
+}
+namespace node5 {
+#include "../../src/main.cpp"
+}
+namespace node6 {
+#include "../../src/main.cpp"
+}
+namespace node7 {
+#include "../../src/main.cpp"
+}
+namespace node8 {
+#include "../../src/main.cpp"
+}
+namespace node9 {
+#include "../../src/main.cpp"
+}
+namespace node10 {
+#include "../../src/main.cpp"
+}
+namespace node11 {
+#include "../../src/main.cpp"
+}
+namespace node12 {
+#include "../../src/main.cpp"
+}
+namespace node13 {
+#include "../../src/main.cpp"
+}
+namespace node14 {
+#include "../../src/main.cpp"
+}
+namespace node15 {
+#include "../../src/main.cpp"
+}
+
+#define MESH_MAX_NODES 16
+
+// Every namespace has the same layout, so node0's types describe them all
+struct NodeProbe {
+    uint32_t height;
+    uint8_t tip[32];
+    bool syncing;
+    node0::MempoolStats mempool;
+    node0::WireStats wire;
+    node0::GossipStats gossip;
+    node0::RelayStats relay;
+    node0::ScheduleStats schedule;
+};
+
+struct NodeApi {
+    void (*setup)();
+    void (*loop)();
+    void (*setRole)(int role);
+    void (*probe)(NodeProbe* out);
+};
+
+#define NODE_API(ns) {                                                              \
+    ns::setup,                                                                      \
+    ns::loop,                                                                       \
+    [](int role) { ns::MY_ROLE = (ns::NodeRole)role; },                             \
+    [](NodeProbe* out) {                                                            \
+        out->height = ns::totalBlocks;                                              \
+        memcpy(out->tip, ns::blockchain[(ns::blockCount - 1) % MAX_BLOCKS].blockHash, 32); \
+        out->syncing = ns::chainSync.active;                                        \
+        memcpy(&out->mempool, &ns::mempoolStats, sizeof(out->mempool));             \
+        memcpy(&out->wire, &ns::wireStats, sizeof(out->wire));                      \
+        memcpy(&out->gossip, &ns::gossipStats, sizeof(out->gossip));                \
+        memcpy(&out->relay, &ns::relayStats, sizeof(out->relay));                   \
+        memcpy(&out->schedule, &ns::scheduleStats, sizeof(out->schedule));          \
+    }                                                                               \
+}
+
+const NodeApi NODE_APIS[MESH_MAX_NODES] = {
+    NODE_API(node0), NODE_API(node1), NODE_API(node2), NODE_API(node3),
+    NODE_API(node4), NODE_API(node5), NODE_API(node6), NODE_API(node7),
+    NODE_API(node8), NODE_API(node9), NODE_API(node10), NODE_API(node11),
+    NODE_API(node12), NODE_API(node13), NODE_API(node14), NODE_API(node15),
+};
+
+// Last bytes of each node's MAC: not in index order, so neither is the validator schedule
+const uint8_t MAC_TAILS[MESH_MAX_NODES] = {
+    0x3A, 0x91, 0x5C, 0xE4, 0x27, 0xB8, 0x6F, 0xD3, 0x48, 0x1E, 0x82, 0xC6, 0x7B, 0xA5, 0x09, 0xF0
+};
+
+struct MeshOptions {
+    const char* topology = "grid";
+    int nodes = 9;
+    int validators = 1;
+    int lossPct = 0;
+    int latencyMs = 2;
+    int jitterMs = 0;
+    long minutes = 10;
+    long drainSeconds = 60;
+    uint32_t seed = 1;
+    const char* logDir = NULL;  // Serial output per node, discarded if unset
+};
+
+struct MeshNode {
+    const NodeApi* api;
+    NativeNode native;
+    bool validator;
+    bool booted;
+    unsigned long bootAt;
+};
+
+std::vector<MeshNode> mesh;
+
+// Node 0's clock each time its chain grew while sensors ran, for block intervals
+std::vector<unsigned long> tipTimes;
+uint32_t tipHeight = 0;
+bool sensing = true;
+
+void usage() {
+    printf("usage: meshsim [--topology line|grid|dense|full] [--nodes N] [--validators N]\n"
+           "               [--loss PCT] [--latency MS] [--jitter MS] [--minutes M]\n"
+           "               [--drain S] [--seed N] [--logs DIR]\n");
+}
+
+bool parseOptions(int argc, char** argv, MeshOptions* opt) {
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if(value == NULL) return false;
+        i++;
+
+        if(strcmp(arg, "--topology") == 0) opt->topology = value;
+        else if(strcmp(arg, "--nodes") == 0) opt->nodes = atoi(value);
+        else if(strcmp(arg, "--validators") == 0) opt->validators = atoi(value);
+        else if(strcmp(arg, "--loss") == 0) opt->lossPct = atoi(value);
+        else if(strcmp(arg, "--latency") == 0) opt->latencyMs = atoi(value);
+        else if(strcmp(arg, "--jitter") == 0) opt->jitterMs = atoi(value);
+        else if(strcmp(arg, "--minutes") == 0) opt->minutes = atol(value);
+        else if(strcmp(arg, "--drain") == 0) opt->drainSeconds = atol(value);
+        else if(strcmp(arg, "--seed") == 0) opt->seed = strtoul(value, NULL, 10);
+        else if(strcmp(arg, "--logs") == 0) opt->logDir = value;
+        else return false;
+    }
+
+    if(opt->nodes < 1 || opt->nodes > MESH_MAX_NODES) return false;
+    if(opt->validators < 0 || opt->validators > opt->nodes) return false;
+    return strcmp(opt->topology, "line") == 0 || strcmp(opt->topology, "grid") == 0 ||
+           strcmp(opt->topology, "dense") == 0 || strcmp(opt->topology, "full") == 0;
+}
+
+void buildMesh(const MeshOptions* opt) {
+    std::filesystem::path fsDir = std::filesystem::temp_directory_path() / "meshsim";
+    std::filesystem::remove_all(fsDir);
+
+    bool line = strcmp(opt->topology, "line") == 0;
+    int side = 1;
+    while(side * side < opt->nodes) side++;
+
+    SimAirConfig air = {(uint8_t)opt->lossPct, (uint16_t)opt->latencyMs, (uint16_t)opt->jitterMs,
+                        1.0f, opt->seed};
+    if(strcmp(opt->topology, "dense") == 0) air.range = 1.5f;
+    if(strcmp(opt->topology, "full") == 0) air.range = 0;
+    simAirConfigure(&air);
+    randomSeed(opt->seed);
+
+    mesh.resize(opt->nodes);
+    for(int i = 0; i < opt->nodes; i++) {
+        MeshNode* node = &mesh[i];
+        node->api = &NODE_APIS[i];
+        node->validator = false;
+        node->booted = false;
+        node->bootAt = i * 137;     // Nodes don't power up together
+
+        uint8_t mac[6] = {0x24, 0x6F, 0x28, (uint8_t)(0x10 + i), MAC_TAILS[i], (uint8_t)(0xC0 ^ MAC_TAILS[i])};
+        memcpy(node->native.mac, mac, 6);
+        node->native.clock = node->bootAt;
+        node->native.fsRoot = (fsDir / ("node" + std::to_string(i))).string();
+        node->native.serialOut = NULL;
+        if(opt->logDir) {
+            std::filesystem::create_directories(opt->logDir);
+            std::string path = std::string(opt->logDir) + "/node" + std::to_string(i) + ".log";
+            node->native.serialOut = fopen(path.c_str(), "w");
+        }
+
+        // The air needs the node before its setup() attaches the radio
+        simAirAttach(mac, NULL, NULL);
+        simAirPlace(mac, line ? i : i % side, line ? 0 : i / side);
+    }
+
+    for(int v = 0; v < opt->validators; v++) {
+        mesh[(v * opt->nodes) / opt->validators].validator = true;
+    }
+}
+
+// Run one setup() or loop() pass of the node furthest behind; false once all reach 'until'
+bool stepMesh(unsigned long until) {
+    MeshNode* next = NULL;
+    for(MeshNode& node : mesh) {
+        if(next == NULL || (long)(node.native.clock - next->native.clock) < 0) next = &node;
+    }
+    if(next == NULL || (long)(next->native.clock - until) >= 0) return false;
+
+    nativeNode = &next->native;
+    if(!next->booted) {
+        next->api->setup();
+        next->api->setRole(next->validator ? node0::VALIDATOR_NODE : node0::SENSOR_NODE);
+        next->booted = true;
+    } else {
+        next->api->loop();
+    }
+    nativeNode = &nativeDefaultNode;
+
+    if(next == &mesh[0] && sensing) {
+        NodeProbe probe;
+        next->api->probe(&probe);
+        if(probe.height > tipHeight) {
+            if(tipHeight > 0) tipTimes.push_back(next->native.clock);
+            tipHeight = probe.height;
+        }
+    }
+    return true;
+}
+
+void runMesh(const MeshOptions* opt) {
+    unsigned long sensingEnd = opt->minutes * 60000UL;
+    while(stepMesh(sensingEnd)) {
+    }
+
+    sensing = false;
+    for(MeshNode& node : mesh) {
+        if(!node.validator) node.api->setRole(node0::ARCHIVE_NODE);
+    }
+    while(stepMesh(sensingEnd + opt->drainSeconds * 1000UL)) {
+    }
+}
+
+void report(const MeshOptions* opt) {
+    std::vector<NodeProbe> probes(mesh.size());
+    for(size_t i = 0; i < mesh.size(); i++) mesh[i].api->probe(&probes[i]);
+
+    int agree = 0;
+    int syncing = 0;
+    uint64_t airFrames = 0;
+    uint64_t airBytes = 0;
+    uint64_t originated = 0;
+    uint64_t delivered = 0;
+    uint64_t relayed = 0;
+    uint64_t duplicates = 0;
+    node0::RelayStats relay = {0};
+    uint32_t mined = 0;
+    for(const NodeProbe& p : probes) {
+        if(p.height == probes[0].height && memcmp(p.tip, probes[0].tip, 32) == 0) agree++;
+        if(p.syncing) syncing++;
+        airFrames += p.wire.airFrames;
+        airBytes += p.wire.airBytes;
+        originated += p.gossip.originated;
+        delivered += p.gossip.received;
+        relayed += p.gossip.relayed;
+        duplicates += p.gossip.duplicates;
+        relay.blocks += p.relay.blocks;
+        relay.txRebuilt += p.relay.txRebuilt;
+        relay.txFetched += p.relay.txFetched;
+        relay.compactBytes += p.relay.compactBytes;
+        relay.fullBytes += p.relay.fullBytes;
+        mined += p.schedule.mined;
+    }
+
+    printf("%s n=%d validators=%d loss=%d%% %ld min + %ld s drain\n", opt->topology, opt->nodes,
+           opt->validators, opt->lossPct, opt->minutes, opt->drainSeconds);
+    printf("  chain: height %u, %d/%d nodes on node 0's tip, %d syncing\n",
+           probes[0].height - 1, agree, (int)probes.size(), syncing);
+    printf("  readings: %u committed on node 0\n", probes[0].mempool.committed);
+
+    // Blocks mined that node 0's chain did not keep, and how evenly its tip grew
+    uint32_t kept = probes[0].height - 1;
+    if(mined > 0) {
+        printf("  blocks: %u mined, %.1f%% orphaned\n", mined, mined > kept ? 100.0 * (mined - kept) / mined : 0.0);
+    }
+    if(tipTimes.size() > 1) {
+        double sum = 0;
+        double sumSq = 0;
+        double longest = 0;
+        for(size_t i = 1; i < tipTimes.size(); i++) {
+            double gap = (tipTimes[i] - tipTimes[i - 1]) / 1000.0;
+            sum += gap;
+            sumSq += gap * gap;
+            longest = std::max(longest, gap);
+        }
+        double n = tipTimes.size() - 1;
+        double mean = sum / n;
+        printf("  block interval: mean %.1f s, sd %.1f s, max %.1f s\n", mean,
+               sqrt(std::max(0.0, sumSq / n - mean * mean)), longest);
+    }
+
+    // Flooded messages (blocks, heartbeats, alarms): share of the other nodes
+    // each one reached, and broadcasts it took, originals plus relays
+    if(originated > 0 && probes.size() > 1) {
+        printf("  gossip: %llu messages, %.1f%% delivered, %.1f tx per message, %.1f duplicates per delivery\n",
+               (unsigned long long)originated, 100.0 * delivered / (originated * (probes.size() - 1)),
+               (double)(originated + relayed) / originated, delivered ? (double)duplicates / delivered : 0.0);
+    }
+
+    // Blocks other nodes applied from compact announcements, against sending
+    // each one whole with all of its txs
+    if(relay.blocks > 0) {
+        printf("  compact relay: %u blocks, %u vs %u B full (%.1f%%), %u txs from pool, %u fetched\n",
+               relay.blocks, relay.compactBytes, relay.fullBytes, 100.0 * relay.compactBytes / relay.fullBytes,
+               relay.txRebuilt, relay.txFetched);
+    }
+
+    // 1 Mb/s: ~536 us of preamble, headers and ACK slot per frame, 8 us per byte
+    double airMs = (airFrames * 536.0 + airBytes * 8.0) / 1000.0;
+    printf("  air: %llu frames, %llu bytes, %.1f s airtime\n",
+           (unsigned long long)airFrames, (unsigned long long)airBytes, airMs / 1000.0);
+    if(probes[0].mempool.committed > 0) {
+        printf("  per committed reading: %.2f ms airtime, %.0f bytes\n",
+               airMs / probes[0].mempool.committed, (double)airBytes / probes[0].mempool.committed);
+    }
+}
+
+int main(int argc, char** argv) {
+    MeshOptions opt;
+    if(!parseOptions(argc, argv, &opt)) {
+        usage();
+        return 2;
+    }
+
+    buildMesh(&opt);
+    runMesh(&opt);
+    report(&opt);
+
+    for(MeshNode& node : mesh) {
+        if(node.native.serialOut) fclose(node.native.serialOut);
+    }
+    return 0;
+}
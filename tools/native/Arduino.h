@@ -0,0 +1,162 @@
+/*
+ * HOST STAND-IN for the parts of the Arduino-ESP32 core the firmware uses
+ *
+ * Used by the [env:native] builds (tools/meshsim and the tests under test/).
+ * Header-only: the host program includes src/main.cpp after these headers.
+ *
+ * A host program may run several nodes in one process. Everything a node
+ * would own on real hardware (clock, MAC, flash, serial port, NVS) lives in a
+ * NativeNode, and the host points nativeNode at the node it is about to run.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "esp_err.h"
+
+struct NativeNode {
+    unsigned long clock;        // millis(); delay() advances it
+    uint8_t mac[6];
+    std::string fsRoot;         // Host directory standing in for SPIFFS
+    std::string serialIn;       // Bytes waiting to be read from Serial
+    FILE* serialOut;            // NULL discards output
+    std::map<std::string, uint32_t> nvs;
+};
+
+inline NativeNode nativeDefaultNode = {0, {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01},
+                                       (std::filesystem::temp_directory_path() / "native_fs").string(),
+                                       "", stdout, {}};
+inline NativeNode* nativeNode = &nativeDefaultNode;
+inline uint32_t nativeRandomState = 1;
+inline bool nativeRealTime = false;     // One node per process: follow the wall clock
+
+// xorshift32: a run repeats exactly for a given seed
+inline uint32_t esp_random() {
+    nativeRandomState ^= nativeRandomState << 13;
+    nativeRandomState ^= nativeRandomState >> 17;
+    nativeRandomState ^= nativeRandomState << 5;
+    return nativeRandomState;
+}
+
+inline void randomSeed(unsigned long seed) {
+    nativeRandomState = seed ? seed : 1;
+}
+
+inline long random(long howBig) {
+    return (howBig > 0) ? esp_random() % howBig : 0;
+}
+
+inline long random(long howSmall, long howBig) {
+    return (howBig > howSmall) ? howSmall + random(howBig - howSmall) : howSmall;
+}
+
+inline unsigned long micros() {
+    if(nativeRealTime) {
+        static const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+    return nativeNode->clock * 1000;
+}
+
+inline unsigned long millis() {
+    return nativeRealTime ? micros() / 1000 : nativeNode->clock;
+}
+
+// In simulated time nothing else runs while a node waits, so waiting is just
+// the clock moving on
+inline void delay(unsigned long ms) {
+    if(nativeRealTime) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    else nativeNode->clock += ms;
+}
+
+inline void yield() {
+}
+
+#define PI 3.1415926535897932384626433832795
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class HardwareSerial {
+public:
+    void begin(unsigned long) {
+    }
+
+    int available() {
+        return nativeNode->serialIn.size();
+    }
+
+    int read() {
+        if(nativeNode->serialIn.empty()) return -1;
+        int c = (uint8_t)nativeNode->serialIn[0];
+        nativeNode->serialIn.erase(0, 1);
+        return c;
+    }
+
+    // The host drains output at once, so the UART never backs up
+    int availableForWrite() {
+        return 128;
+    }
+
+    size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buf, size_t len) {
+        return nativeNode->serialOut ? fwrite(buf, 1, len, nativeNode->serialOut) : len;
+    }
+
+    size_t print(const char* s) {
+        return write((const uint8_t*)s, strlen(s));
+    }
+
+    size_t println(const char* s = "") {
+        return print(s) + print("\n");
+    }
+
+    // No format checking: the firmware's %u for size_t is right on the 32-bit target
+    size_t printf(const char* format, ...) {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if(len < 0) return 0;
+        return write((const uint8_t*)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+
+    void flush() {
+        if(nativeNode->serialOut) fflush(nativeNode->serialOut);
+    }
+};
+
+inline HardwareSerial Serial;
+
+class EspClass {
+public:
+    // Nothing to measure on a host; reports the ESP32's usual figure after WiFi init
+    uint32_t getFreeHeap() {
+        return 200000;
+    }
+
+    void restart() {
+        exit(0);
+    }
+};
+
+inline EspClass ESP;
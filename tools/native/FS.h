@@ -0,0 +1,129 @@
+// Files map onto a host directory per node (NativeNode::fsRoot)
+
+#pragma once
+
+#include "Arduino.h"
+#include <dirent.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+enum SeekMode {
+    SeekSet = SEEK_SET,
+    SeekCur = SEEK_CUR,
+    SeekEnd = SEEK_END
+};
+
+// Copies share one handle, closed with the last copy, as in the Arduino core
+class File {
+public:
+    File() {
+    }
+
+    File(FILE* file, const std::string& path, const std::string& name) : impl(new Impl) {
+        impl->file = file;
+        impl->path = path;
+        impl->name = name;
+    }
+
+    File(DIR* dir, const std::string& path, const std::string& name) : impl(new Impl) {
+        impl->dir = dir;
+        impl->path = path;
+        impl->name = name;
+    }
+
+    explicit operator bool() const {
+        return impl && (impl->file || impl->dir);
+    }
+
+    size_t write(const uint8_t* buf, size_t len) {
+        return (impl && impl->file) ? fwrite(buf, 1, len, impl->file) : 0;
+    }
+
+    size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+
+    size_t read(uint8_t* buf, size_t len) {
+        return (impl && impl->file) ? fread(buf, 1, len, impl->file) : 0;
+    }
+
+    int read() {
+        uint8_t c;
+        return (read(&c, 1) == 1) ? c : -1;
+    }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+        return impl && impl->file && fseek(impl->file, pos, mode) == 0;
+    }
+
+    size_t position() const {
+        return (impl && impl->file) ? ftell(impl->file) : 0;
+    }
+
+    size_t size() const {
+        if(!impl || !impl->file) return 0;
+        long at = ftell(impl->file);
+        fseek(impl->file, 0, SEEK_END);
+        long end = ftell(impl->file);
+        fseek(impl->file, at, SEEK_SET);
+        return end;
+    }
+
+    int available() {
+        return size() - position();
+    }
+
+    void flush() {
+        if(impl && impl->file) fflush(impl->file);
+    }
+
+    const char* name() const {
+        return impl ? impl->name.c_str() : "";
+    }
+
+    bool isDirectory() const {
+        return impl && impl->dir;
+    }
+
+    File openNextFile() {
+        if(!impl || !impl->dir) return File();
+
+        struct dirent* entry;
+        while((entry = readdir(impl->dir)) != NULL) {
+            if(entry->d_name[0] == '.') continue;
+            std::string path = impl->path + "/" + entry->d_name;
+            FILE* file = fopen(path.c_str(), "rb");
+            if(file) return File(file, path, entry->d_name);
+        }
+        return File();
+    }
+
+    void close() {
+        if(impl) impl->close();
+        impl.reset();
+    }
+
+private:
+    struct Impl {
+        FILE* file = NULL;
+        DIR* dir = NULL;
+        std::string path;
+        std::string name;
+
+        void close() {
+            if(file) fclose(file);
+            if(dir) closedir(dir);
+            file = NULL;
+            dir = NULL;
+        }
+
+        ~Impl() {
+            close();
+        }
+    };
+
+    std::shared_ptr<Impl> impl;
+};
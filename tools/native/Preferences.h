@@ -0,0 +1,29 @@
+// NVS is kept per node in NativeNode::nvs
+
+#pragma once
+
+#include "Arduino.h"
+
+class Preferences {
+public:
+    bool begin(const char* name, bool = false) {
+        ns = name;
+        return true;
+    }
+
+    void end() {
+    }
+
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) {
+        auto it = nativeNode->nvs.find(ns + "/" + key);
+        return (it != nativeNode->nvs.end()) ? it->second : defaultValue;
+    }
+
+    size_t putUInt(const char* key, uint32_t value) {
+        nativeNode->nvs[ns + "/" + key] = value;
+        return sizeof(value);
+    }
+
+private:
+    std::string ns;
+};
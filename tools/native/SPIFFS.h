@@ -0,0 +1,55 @@
+#pragma once
+
+#include "FS.h"
+#include <sys/stat.h>
+
+class SPIFFSFS {
+public:
+    bool begin(bool = false) {
+        std::error_code error;
+        std::filesystem::create_directories(nativeNode->fsRoot, error);
+        return !error;
+    }
+
+    File open(const char* path, const char* mode = FILE_READ) {
+        std::string full = nativeNode->fsRoot + path;
+
+        if(strcmp(path, "/") == 0) {
+            DIR* dir = opendir(nativeNode->fsRoot.c_str());
+            return dir ? File(dir, nativeNode->fsRoot, "/") : File();
+        }
+
+        std::string binary = std::string(mode) + "b";
+        FILE* file = fopen(full.c_str(), binary.c_str());
+        return file ? File(file, full, path) : File();
+    }
+
+    bool exists(const char* path) {
+        struct stat st;
+        return stat((nativeNode->fsRoot + path).c_str(), &st) == 0;
+    }
+
+    bool remove(const char* path) {
+        return ::remove((nativeNode->fsRoot + path).c_str()) == 0;
+    }
+
+    bool rename(const char* from, const char* to) {
+        return ::rename((nativeNode->fsRoot + from).c_str(), (nativeNode->fsRoot + to).c_str()) == 0;
+    }
+
+    // The spiffs partition in default.csv
+    size_t totalBytes() {
+        return 0x170000;
+    }
+
+    size_t usedBytes() {
+        size_t used = 0;
+        std::error_code error;
+        for(const auto& entry : std::filesystem::directory_iterator(nativeNode->fsRoot, error)) {
+            if(entry.is_regular_file()) used += entry.file_size();
+        }
+        return used;
+    }
+};
+
+inline SPIFFSFS SPIFFS;
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define WIFI_STA 1
+
+typedef enum {
+    ESP_MAC_WIFI_STA,
+} esp_mac_type_t;
+
+inline esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t) {
+    memcpy(mac, nativeNode->mac, 6);
+    return ESP_OK;
+}
+
+class WiFiClass {
+public:
+    bool mode(int) {
+        return true;
+    }
+
+    bool disconnect() {
+        return true;
+    }
+
+    int8_t RSSI() {
+        return -60;
+    }
+};
+
+inline WiFiClass WiFi;
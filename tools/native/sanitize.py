@@ -0,0 +1,4 @@
+# build_flags only reach the compiler; the sanitizer runtimes must be linked too
+Import("env")
+
+env.Append(LINKFLAGS=["-fsanitize=address,undefined"])
@@ -0,0 +1,74 @@
+/*
+ * UDP NODE - one firmware node per host process
+ *
+ * Runs src/main.cpp built with RADIO_BACKEND == RADIO_UDP on the wall clock.
+ * Every process joins the same multicast group, so several of them on one
+ * machine (or one LAN) form a mesh. Lines typed on stdin reach the node as
+ * serial commands.
+ *
+ *   pio run -e native-udp
+ *   .pio/build/native-udp/program --id 1 --role validator
+ *   .pio/build/native-udp/program --id 2          (in another terminal)
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_idf_version.h>
+#include <mbedtls/md.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <FS.h>
+#include <mutex>
+#include <thread>
+
+#include "../../src/main.cpp"
+
+std::mutex stdinLock;
+std::string stdinPending;
+
+void readStdin() {
+    char line[256];
+    while(fgets(line, sizeof(line), stdin)) {
+        std::lock_guard<std::mutex> hold(stdinLock);
+        stdinPending += line;
+    }
+}
+
+int main(int argc, char** argv) {
+    int id = 1;
+    const char* role = NULL;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i], "--id") == 0) id = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "--role") == 0) role = argv[i + 1];
+    }
+    if(id < 1 || id > 255) {
+        printf("usage: udpnode [--id 1-255] [--role validator|sensor|archive]\n");
+        return 2;
+    }
+
+    nativeRealTime = true;
+    randomSeed(id);
+    uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x00, (uint8_t)id, (uint8_t)(0xC0 ^ id)};
+    memcpy(nativeDefaultNode.mac, mac, 6);
+    nativeDefaultNode.fsRoot = (std::filesystem::temp_directory_path() / ("udpnode" + std::to_string(id))).string();
+
+    std::thread(readStdin).detach();
+
+    setup();
+    if(role != NULL) {
+        if(strcmp(role, "validator") == 0) MY_ROLE = VALIDATOR_NODE;
+        else if(strcmp(role, "archive") == 0) MY_ROLE = ARCHIVE_NODE;
+        else MY_ROLE = SENSOR_NODE;
+    }
+
+    while(true) {
+        {
+            std::lock_guard<std::mutex> hold(stdinLock);
+            nativeDefaultNode.serialIn += stdinPending;
+            stdinPending.clear();
+        }
+        loop();
+        fflush(stdout);
+    }
+}